@@ -0,0 +1,76 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "disk.h"
+
+/*
+ * The virtual disk: a file of DISK_BLOCKS blocks of BLOCK_SIZE bytes, one
+ * open at a time. make_disk creates it sparse, so unwritten blocks read as
+ * zeros.
+ */
+
+static bool active = false;
+static int handle;
+
+int make_disk(const char *name)
+{
+    if (name == NULL) {
+        return -1;
+    }
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)DISK_BLOCKS * BLOCK_SIZE) == -1) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+int open_disk(const char *name)
+{
+    if (name == NULL || active) {
+        return -1;
+    }
+    handle = open(name, O_RDWR);
+    if (handle == -1) {
+        return -1;
+    }
+    active = true;
+    return 0;
+}
+
+int close_disk()
+{
+    if (!active) {
+        return -1;
+    }
+    close(handle);
+    active = false;
+    return 0;
+}
+
+int block_write(int block, const void *buf)
+{
+    if (!active || block < 0 || block >= DISK_BLOCKS) {
+        return -1;
+    }
+    if (pwrite(handle, buf, BLOCK_SIZE, (off_t)block * BLOCK_SIZE) != BLOCK_SIZE) {
+        return -1;
+    }
+    return 0;
+}
+
+int block_read(int block, void *buf)
+{
+    if (!active || block < 0 || block >= DISK_BLOCKS) {
+        return -1;
+    }
+    if (pread(handle, buf, BLOCK_SIZE, (off_t)block * BLOCK_SIZE) != BLOCK_SIZE) {
+        return -1;
+    }
+    return 0;
+}
@@ -3,49 +3,24 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "disk.h"
 #include "fs.h"
+#include "fs_format.h"
+#include "lz.h"
+#include "stripe.h"
 
-#define MAX_FILES 64
 #define MAX_FILDES 32 
-#define MAX_FILESIZE (1 << 20) // file size = 1MB
-#define MAX_FILENAME 15
+#define CHUNK_CACHE_SIZE 8 // number of decompressed chunks kept in memory
 
-/* data structures */
-/* information about where to find the file system and its data structures */
-struct superblock
-{
-    uint16_t block_bitmap_size;
-    uint16_t block_bitmap_offset;
-    uint16_t inode_bitmap_size;
-    uint16_t inode_bitmap_offset;
-    uint16_t dir_entry_size;
-    uint16_t dir_entry_offset;
-    uint16_t inode_offset;
-    uint16_t inode_size;
-    uint16_t data_block_offset;
-};
+/* fingerprint index: open addressing over block numbers, 0 = empty slot */
+#define FP_INDEX_SIZE (2 * DISK_BLOCKS)
 
-/* attributes of inode/file */
-struct inode 
-{
-    int file_type;
-    int size;
-    int direct_offset;  // offset to direct blocks (1MB/4kB)
-    //int single_indirect_offset; // offset to a single direct block
-};
-
-/* if the inode points to a directory entry 
-when taking data out of this block interpret it as a dir entry (root)
-*/
-struct dir_entry
-{
-    bool used;
-    int inode_num;
-    char name[MAX_FILENAME + 1];
-};
+/* inode numbers at or above MAX_FILES refer to the read-only snapshot table */
+#define SNAP_INODE(i) (MAX_FILES + (i))
 
+/* data structures */
 /* if the inode points to a file */
 struct fd_t
 {
@@ -54,228 +29,704 @@ struct fd_t
     int offset; // offset to the byte being looked at in the file (track position)
 };
 
+/* decompressed chunk of a compressed file */
+struct chunk_cache_entry
+{
+    bool valid;
+    int inode_num;
+    int chunk;
+    char data[CHUNK_SIZE];
+};
+
 /* global variables */
 uint8_t blocks_bitmap[1024]; // free list for used disk blocks (DISK_BLOCKS/8)
+uint16_t block_refs[DISK_BLOCKS]; // references to each data block (inodes, clones, snapshot)
+uint32_t block_fp[DISK_BLOCKS]; // content fingerprint of each data block written in dedup mode
 struct inode inode_bitmap[MAX_FILES]; // inode table (array cache/in-core copy of inodes)
 struct fd_t fd[MAX_FILDES]; // array of open file descriptors 
 struct superblock sb; // current state of the superblock (to know block offsets)
 struct dir_entry DIR[MAX_FILES]; // array of directory entries
+struct inode snap_inodes[MAX_FILES]; // inode table frozen by fs_snapshot()
+struct dir_entry snap_DIR[MAX_FILES]; // directory frozen by fs_snapshot()
 static bool mounted = false;
+static bool striped = false; // blocks go through the striping layer instead of disk.h
+static int free_blocks; // number of clear bits in blocks_bitmap
+static uint16_t fp_index[FP_INDEX_SIZE]; // fingerprint -> block, rebuilt at mount
+static int fp_index_count; // slots in use, including stale ones
+static struct fs_stats stats; // dedup counters of the current mount
+static struct chunk_cache_entry chunk_cache[CHUNK_CACHE_SIZE]; // direct-mapped by (inode, chunk)
 
 
 /* 
  * Helper Functions
  */
 
-int next_block(int curr, char idx){
-    char *buf = calloc(1, BLOCK_SIZE);
+static int dev_read(int b, void *buf)
+{
+    return striped ? stripe_read(b, buf) : block_read(b, buf);
+}
 
-    if (curr < BLOCK_SIZE){
-        block_read(sb.data_block_offset, buf);
-        for(int i = curr + 1; i < BLOCK_SIZE; i++) {
-            if (buf[i] == (idx + 1)){
-                return i;
-            }
+static int dev_write(int b, const void *buf)
+{
+    return striped ? stripe_write(b, buf) : block_write(b, buf);
+}
+
+/* reads n blocks into bufs; a striped device transfers them in parallel */
+static int dev_readv(int n, const int *blocks, char *const *bufs)
+{
+    if (striped) {
+        return stripe_readv(n, blocks, bufs);
+    }
+    for (int i = 0; i < n; i++) {
+        if (block_read(blocks[i], bufs[i]) == -1) {
+            return -1;
         }
-    } else {
-        block_read(sb.data_block_offset + 1, buf);
-        for(int i = curr - BLOCK_SIZE + 1; i < BLOCK_SIZE; i++) {
-            if (buf[i] == (idx + 1)){
-                return i + BLOCK_SIZE;
-            }
+    }
+    return 0;
+}
+
+static int dev_writev(int n, const int *blocks, char *const *bufs)
+{
+    if (striped) {
+        return stripe_writev(n, blocks, bufs);
+    }
+    for (int i = 0; i < n; i++) {
+        if (block_write(blocks[i], bufs[i]) == -1) {
+            return -1;
         }
     }
+    return 0;
+}
 
-    return -1; // no next block
+/* reads nblocks blocks starting at start into the len bytes at dst */
+static int meta_read(int start, int nblocks, void *dst, size_t len)
+{
+    char buffer[BLOCK_SIZE];
+    for (int i = 0; i < nblocks; i++) {
+        if (dev_read(start + i, buffer) == -1) {
+            perror("ERROR: block_read");
+            return -1;
+        }
+        size_t off = (size_t)i * BLOCK_SIZE;
+        if (off < len) {
+            memcpy((char *)dst + off, buffer, len - off < BLOCK_SIZE ? len - off : BLOCK_SIZE);
+        }
+    }
+    return 0;
 }
 
-/* 
- * Management Routines
- */
+/* writes the len bytes at src to nblocks blocks starting at start */
+static int meta_write(int start, int nblocks, const void *src, size_t len)
+{
+    char buffer[BLOCK_SIZE];
+    for (int i = 0; i < nblocks; i++) {
+        size_t off = (size_t)i * BLOCK_SIZE;
+        memset(buffer, 0, BLOCK_SIZE);
+        if (off < len) {
+            memcpy(buffer, (const char *)src + off, len - off < BLOCK_SIZE ? len - off : BLOCK_SIZE);
+        }
+        if (dev_write(start + i, buffer) == -1) {
+            perror("ERROR: block_write");
+            return -1;
+        }
+    }
+    return 0;
+}
 
-/* creates a fresh (and empty) file system on the virtual disk */
-int make_fs(const char *disk_name)
-{   
-    if (make_disk(disk_name) == -1) {
-        perror("ERROR: make_disk");
+/* write superblock, DIR, inode table and blocks bitmap back to disk */
+static int meta_flush()
+{
+    if (meta_write(0, 1, &sb, sizeof(struct superblock)) == -1 ||
+        meta_write(sb.dir_entry_offset, sb.dir_entry_size, DIR, sizeof(DIR)) == -1 ||
+        meta_write(sb.inode_offset, sb.inode_size, inode_bitmap, sizeof(inode_bitmap)) == -1 ||
+        meta_write(sb.block_bitmap_offset, sb.block_bitmap_size, blocks_bitmap, sizeof(blocks_bitmap)) == -1 ||
+        meta_write(sb.refcount_offset, sb.refcount_size, block_refs, sizeof(block_refs)) == -1 ||
+        meta_write(sb.snap_dir_offset, sb.dir_entry_size, snap_DIR, sizeof(snap_DIR)) == -1 ||
+        meta_write(sb.snap_inode_offset, sb.inode_size, snap_inodes, sizeof(snap_inodes)) == -1 ||
+        meta_write(sb.fp_offset, sb.fp_size, block_fp, sizeof(block_fp)) == -1) {
         return -1;
     }
+    return 0;
+}
 
-    if (open_disk(disk_name) == -1) {
-        perror("ERROR: open_disk");
+static bool block_is_used(int b)
+{
+    return (blocks_bitmap[b / 8] >> (b % 8)) & 1;
+}
+
+/* claim the first free data block with one reference, -1 if the disk is full */
+static int block_alloc()
+{
+    for (int b = sb.data_block_offset; b < DISK_BLOCKS; b++) {
+        if (!block_is_used(b)) {
+            blocks_bitmap[b / 8] |= (uint8_t)(1 << (b % 8));
+            block_refs[b] = 1;
+            block_fp[b] = 0;
+            free_blocks--;
+            return b;
+        }
+    }
+    return -1;
+}
+
+/* take another reference to a data block, 0 (hole) is ignored */
+static void block_get(int b)
+{
+    if (b != 0) {
+        block_refs[b]++;
+    }
+}
+
+/* drop a reference to a data block and release it with the last one */
+static void block_put(int b)
+{
+    if (b == 0 || !block_is_used(b)) {
+        return;
+    }
+    if (--block_refs[b] == 0) {
+        blocks_bitmap[b / 8] &= (uint8_t)~(1 << (b % 8));
+        block_fp[b] = 0;
+        free_blocks++;
+    }
+}
+
+/* blocks that would be released if every block in list were put */
+static int blocks_owned(const uint16_t *list, int n)
+{
+    int owned = 0;
+    for (int i = 0; i < n; i++) {
+        owned += list[i] != 0 && block_refs[list[i]] == 1;
+    }
+    return owned;
+}
+
+/* make *slot a private block before it is overwritten (copy on write)
+the caller writes the full new contents to the returned block */
+static int block_cow(uint16_t *slot)
+{
+    if (*slot == 0 || block_refs[*slot] > 1) {
+        int b = block_alloc();
+        if (b == -1) {
+            perror("ERROR: disk full");
+            return -1;
+        }
+        block_put(*slot);
+        *slot = (uint16_t)b;
+    }
+    block_fp[*slot] = 0; // contents are about to change
+    return *slot;
+}
+
+/* 32 bit fingerprint of a block, never 0 */
+static uint32_t block_hash(const char *buffer)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < BLOCK_SIZE; i += sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, buffer + i, sizeof(w));
+        h = (h ^ w) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    uint32_t fp = (uint32_t)(h ^ (h >> 32));
+    return fp == 0 ? 1 : fp;
+}
+
+static void fp_insert(int b)
+{
+    uint32_t i = block_fp[b] % FP_INDEX_SIZE;
+    while (fp_index[i] != 0) {
+        if (fp_index[i] == b) {
+            return;
+        }
+        i = (i + 1) % FP_INDEX_SIZE;
+    }
+    fp_index[i] = (uint16_t)b;
+    fp_index_count++;
+}
+
+/* rebuild the in-core index from block_fp, dropping stale slots */
+static void fp_rebuild()
+{
+    memset(fp_index, 0, sizeof(fp_index));
+    fp_index_count = 0;
+    for (int b = sb.data_block_offset; b < DISK_BLOCKS; b++) {
+        if (block_fp[b] != 0 && block_is_used(b)) {
+            fp_insert(b);
+        }
+    }
+}
+
+/* find a block whose contents equal buffer
+slots whose block was freed or rewritten no longer match block_fp and are skipped */
+static int fp_lookup(uint32_t fp, const char *buffer)
+{
+    char candidate[BLOCK_SIZE];
+    for (uint32_t i = fp % FP_INDEX_SIZE; fp_index[i] != 0; i = (i + 1) % FP_INDEX_SIZE) {
+        int b = fp_index[i];
+        if (block_fp[b] != fp || !block_is_used(b) || block_refs[b] == UINT16_MAX) {
+            continue;
+        }
+        if (dev_read(b, candidate) == 0 && memcmp(candidate, buffer, BLOCK_SIZE) == 0) {
+            return b;
+        }
+    }
+    return 0;
+}
+
+/* stores a full block in dedup mode: zero blocks become holes, blocks already
+on disk are referenced, anything else is written and fingerprinted */
+static int dedup_write(uint16_t *slot, const char *buffer)
+{
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    static const char zero[BLOCK_SIZE];
+    bool is_zero = memcmp(buffer, zero, BLOCK_SIZE) == 0;
+    uint32_t fp = block_hash(buffer);
+    int match = is_zero ? 0 : fp_lookup(fp, buffer);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    stats.dedup_nsec += (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec);
+    stats.dedup_hashed++;
+
+    if (is_zero) {
+        block_put(*slot);
+        *slot = 0;
+        stats.dedup_zero++;
+        return 0;
+    }
+
+    if (match != 0) {
+        if (match != *slot) {
+            block_get(match);
+            block_put(*slot);
+            *slot = (uint16_t)match;
+        }
+        stats.dedup_hits++;
+        return 0;
+    }
+
+    if (block_cow(slot) == -1) {
         return -1;
     }
+    if (dev_write(*slot, buffer) == -1) {
+        perror("fs_write: block_write()");
+        return -1;
+    }
+    block_fp[*slot] = fp;
+    if (fp_index_count >= FP_INDEX_SIZE * 3 / 4) {
+        fp_rebuild();
+    }
+    fp_insert(*slot);
+    return 0;
+}
+
+static struct inode *inode_get(int inode_num)
+{
+    if (inode_num >= MAX_FILES) {
+        return &snap_inodes[inode_num - MAX_FILES];
+    }
+    return &inode_bitmap[inode_num];
+}
+
+/* checks fds and returns the inode it refers to */
+static struct inode *fd_inode(int fds)
+{
+    if (fds < 0 || fds >= MAX_FILDES || !fd[fds].used) {
+        return NULL;
+    }
+    return inode_get(fd[fds].inode_num);
+}
+
+/* like fd_inode() but refuses descriptors of read-only snapshot files */
+static struct inode *fd_inode_rw(int fds)
+{
+    struct inode *in = fd_inode(fds);
+    if (in != NULL && fd[fds].inode_num >= MAX_FILES) {
+        perror("ERROR: snapshot files are read-only");
+        return NULL;
+    }
+    return in;
+}
+
+static void chunk_invalidate(int inode_num, int c)
+{
+    struct chunk_cache_entry *e = &chunk_cache[(inode_num * MAX_CHUNKS + c) % CHUNK_CACHE_SIZE];
+    if (e->inode_num == inode_num && e->chunk == c) {
+        e->valid = false;
+    }
+}
+
+/* returns the decompressed contents of chunk c of a compressed file
+bytes past the end of the chunk's data read as zero */
+static char *chunk_get(int inode_num, int c)
+{
+    struct chunk_cache_entry *e = &chunk_cache[(inode_num * MAX_CHUNKS + c) % CHUNK_CACHE_SIZE];
+    if (e->valid && e->inode_num == inode_num && e->chunk == c) {
+        return e->data;
+    }
+
+    struct inode *in = inode_get(inode_num);
+    int len = in->chunk_len[c] & ~CHUNK_RAW;
+    char packed[CHUNK_SIZE];
+    char *dst = (in->chunk_len[c] & CHUNK_RAW) ? e->data : packed;
+
+    e->valid = false;
+    memset(e->data, 0, CHUNK_SIZE);
+
+    /* only the blocks holding compressed bytes are read */
+    int blocks[CHUNK_BLOCKS];
+    char *bufs[CHUNK_BLOCKS];
+    for (int i = 0; i < BLOCKS_FOR(len); i++) {
+        blocks[i] = in->direct[c * CHUNK_BLOCKS + i];
+        bufs[i] = dst + i * BLOCK_SIZE;
+    }
+    if (dev_readv(BLOCKS_FOR(len), blocks, bufs) == -1) {
+        perror("ERROR: block_read");
+        return NULL;
+    }
+    if (dst == packed && len > 0 && lz_decompress(packed, len, e->data, CHUNK_SIZE) == -1) {
+        perror("ERROR: corrupt compressed chunk");
+        return NULL;
+    }
+
+    e->valid = true;
+    e->inode_num = inode_num;
+    e->chunk = c;
+    return e->data;
+}
+
+/* compresses the first valid bytes of chunk c and writes them to fresh blocks,
+replacing the chunk's previous blocks (shared ones stay with their other owners) */
+static int chunk_put(int inode_num, int c, const char *data, int valid)
+{
+    struct inode *in = inode_get(inode_num);
+    uint16_t *blocks = &in->direct[c * CHUNK_BLOCKS];
+    char packed[LZ_BOUND(CHUNK_SIZE)];
+    const char *src = packed;
+
+    int len = lz_compress(data, valid, packed, sizeof(packed));
+    uint16_t stored = (uint16_t)len;
+    if (len == -1 || BLOCKS_FOR(len) >= BLOCKS_FOR(valid)) { // no block saved, keep it raw
+        src = data;
+        len = valid;
+        stored = (uint16_t)(valid | CHUNK_RAW);
+    }
+
+    if (BLOCKS_FOR(len) > free_blocks + blocks_owned(blocks, CHUNK_BLOCKS)) {
+        perror("ERROR: disk full");
+        return -1;
+    }
+
+    for (int i = 0; i < CHUNK_BLOCKS; i++) {
+        block_put(blocks[i]);
+        blocks[i] = 0;
+    }
+    in->chunk_len[c] = 0;
+
+    char buffer[BLOCK_SIZE];
+    for (int i = 0; i < BLOCKS_FOR(len); i++) {
+        int n = len - i * BLOCK_SIZE < BLOCK_SIZE ? len - i * BLOCK_SIZE : BLOCK_SIZE;
+        memset(buffer, 0, BLOCK_SIZE);
+        memcpy(buffer, src + i * BLOCK_SIZE, n);
+        blocks[i] = (uint16_t)block_alloc();
+        if (dev_write(blocks[i], buffer) == -1) {
+            perror("ERROR: block_write");
+            return -1;
+        }
+    }
+    in->chunk_len[c] = stored;
+
+    return 0;
+}
+
+/* reads whole blocks lb.. of an uncompressed file straight into buf as one batch
+returns the number of blocks read */
+static int read_blocks(struct inode *in, int lb, int count, char *buf)
+{
+    int blocks[MAX_FILE_BLOCKS];
+    char *bufs[MAX_FILE_BLOCKS];
+    int n = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (in->direct[lb + i] == 0) {
+            memset(buf + i * BLOCK_SIZE, 0, BLOCK_SIZE);
+            continue;
+        }
+        blocks[n] = in->direct[lb + i];
+        bufs[n++] = buf + i * BLOCK_SIZE;
+    }
+
+    if (dev_readv(n, blocks, bufs) == -1) {
+        perror("ERROR: block_read");
+        return 0;
+    }
+    return count;
+}
+
+/* writes whole blocks lb.. of an uncompressed file straight from buf as one batch
+returns the number of blocks written, fewer when the disk fills up */
+static int write_blocks(struct inode *in, int lb, int count, const char *buf)
+{
+    int blocks[MAX_FILE_BLOCKS];
+    char *bufs[MAX_FILE_BLOCKS];
+    int n = 0;
+
+    /* unallocated and shared blocks get a block of their own */
+    while (n < count && block_cow(&in->direct[lb + n]) != -1) {
+        blocks[n] = in->direct[lb + n];
+        bufs[n] = (char *)buf + n * BLOCK_SIZE;
+        n++;
+    }
+
+    if (dev_writev(n, blocks, bufs) == -1) {
+        perror("fs_write: block_write()");
+        return 0;
+    }
+    return n;
+}
 
+/* release every block of a file from byte length onwards */
+static void free_from(int inode_num, int length)
+{
+    struct inode *in = inode_get(inode_num);
+    if (in->flags & INODE_COMPRESSED) {
+        for (int c = (length + CHUNK_SIZE - 1) / CHUNK_SIZE; c < MAX_CHUNKS; c++) {
+            for (int i = 0; i < CHUNK_BLOCKS; i++) {
+                block_put(in->direct[c * CHUNK_BLOCKS + i]);
+                in->direct[c * CHUNK_BLOCKS + i] = 0;
+            }
+            in->chunk_len[c] = 0;
+            chunk_invalidate(inode_num, c);
+        }
+    }
+    else {
+        for (int i = BLOCKS_FOR(length); i < MAX_FILE_BLOCKS; i++) {
+            block_put(in->direct[i]);
+            in->direct[i] = 0;
+        }
+    }
+}
+
+/* 
+ * Management Routines
+ */
+
+/* writes an empty file system to the opened device */
+static int format_fs(int ndisks, int unit)
+{
     /* initialize meta-information */
     struct superblock sb_;
-    sb_.dir_entry_size = (sizeof(struct dir_entry) * MAX_FILES) % BLOCK_SIZE == 0 ? \
-                         (sizeof(struct dir_entry) * MAX_FILES) / BLOCK_SIZE : \
-                         (sizeof(struct dir_entry) * MAX_FILES) / BLOCK_SIZE + 1;
+    sb_.dir_entry_size = BLOCKS_FOR(sizeof(DIR));
     sb_.dir_entry_offset = 1; 
 
-    sb_.inode_bitmap_size = sizeof(inode_bitmap) % BLOCK_SIZE == 0 ? \
-                            sizeof(inode_bitmap) / BLOCK_SIZE : \
-                            sizeof(inode_bitmap) / BLOCK_SIZE + 1;
+    sb_.inode_bitmap_size = 0; // the inode table itself marks inodes in use
     sb_.inode_bitmap_offset = sb_.dir_entry_offset + sb_.dir_entry_size; 
 
-    sb_.block_bitmap_size = sizeof(blocks_bitmap) % BLOCK_SIZE == 0 ? \
-                            sizeof(blocks_bitmap) / BLOCK_SIZE : \
-                            sizeof(blocks_bitmap) / BLOCK_SIZE + 1;
+    sb_.block_bitmap_size = BLOCKS_FOR(sizeof(blocks_bitmap));
     sb_.block_bitmap_offset = sb_.inode_bitmap_offset + sb_.inode_bitmap_size;
 
-    sb_.inode_size = (sizeof(struct inode) * MAX_FILES) % BLOCK_SIZE == 0 ? \
-                     (sizeof(struct inode) * MAX_FILES) / BLOCK_SIZE : \
-                     (sizeof(struct inode) * MAX_FILES) / BLOCK_SIZE + 1;
+    sb_.inode_size = BLOCKS_FOR(sizeof(inode_bitmap));
     sb_.inode_offset = sb_.block_bitmap_offset + sb_.block_bitmap_size;
 
-    sb_.data_block_offset = sb_.inode_offset + sb_.inode_size;
+    sb_.refcount_size = BLOCKS_FOR(sizeof(block_refs));
+    sb_.refcount_offset = sb_.inode_offset + sb_.inode_size;
+
+    sb_.snap_dir_offset = sb_.refcount_offset + sb_.refcount_size;
+    sb_.snap_inode_offset = sb_.snap_dir_offset + sb_.dir_entry_size;
+    sb_.snap_valid = 0;
+
+    sb_.fp_size = BLOCKS_FOR(sizeof(block_fp));
+    sb_.fp_offset = sb_.snap_inode_offset + sb_.inode_size;
+    sb_.dedup = 0;
+
+    sb_.data_block_offset = sb_.fp_offset + sb_.fp_size;
+
+    sb_.stripe_disks = (uint16_t)ndisks;
+    sb_.stripe_unit = (uint16_t)unit;
+
+    /* empty DIR and inode table, metadata blocks marked as used */
+    sb = sb_;
+    memset(DIR, 0, sizeof(DIR));
+    memset(inode_bitmap, 0, sizeof(inode_bitmap));
+    memset(blocks_bitmap, 0, sizeof(blocks_bitmap));
+    memset(block_refs, 0, sizeof(block_refs));
+    memset(snap_DIR, 0, sizeof(snap_DIR));
+    memset(snap_inodes, 0, sizeof(snap_inodes));
+    memset(block_fp, 0, sizeof(block_fp));
+    for (int b = 0; b < sb.data_block_offset; b++) {
+        blocks_bitmap[b / 8] |= (uint8_t)(1 << (b % 8));
+    }
 
     /* copy meta-information to disk blocks */
-    char *buffer = calloc(1, BLOCK_SIZE);
+    return meta_flush();
+}
 
-    /* block write superblock */
-    memcpy((void *)buffer, (void *)&sb, sizeof(struct superblock));
-    if (block_write(0, buffer) == -1) {
-        perror("ERROR: block_read");
+/* reads the file system on the opened device into memory */
+static int load_fs(int ndisks)
+{
+    /* block 0 is on the first disk whatever the stripe unit is */
+    if (meta_read(0, 1, &sb, sizeof(struct superblock)) == -1) {
         return -1;
     }
-
-    /* block write DIR */
-    struct dir_entry dir = {.used = false, .name[0] = '\0', .inode_num = 0}; // init empty entry
-    for (int i = 0; i < MAX_FILES; i++) {
-        memcpy((void *)(buffer + i * sizeof(struct dir_entry)), (void *)&dir, sizeof(struct dir_entry)); // populate single directory block buffer with empty entries
-    }
-    if (block_write(sb_.dir_entry_offset, buffer) == -1) {
-        perror("ERROR: block_write");
+    if (sb.stripe_disks != ndisks) {
+        fprintf(stderr, "ERROR: file system spans %d disk(s), %d given\n", sb.stripe_disks, ndisks);
         return -1;
     }
-
-    /* block write inode bitmap*/
-    struct inode in = {.file_type = 0, .size = 0, .direct_offset = 0};
-    for (int i = 0; i < MAX_FILES; i++) {
-        memcpy((void *)(buffer + i * sizeof(struct inode)), (void *)&in, sizeof(struct inode)); // populate buffer with empty inode entries
-    }
-    if (block_write(sb_.inode_bitmap_offset, buffer) == -1) {
-        perror("ERROR: block_write");
+    if (striped && stripe_set_unit(sb.stripe_unit) == -1) {
+        perror("ERROR: stripe unit");
         return -1;
     }
 
-    /* block write blocks bitmap*/
-    memcpy((void *)buffer, (void *)&blocks_bitmap, sizeof(blocks_bitmap));
-    if (block_write(sb_.block_bitmap_offset, buffer) == -1) {
-        perror("ERROR: block_read");
+    /* mount DIR, inode table, disk blocks bitmap, refcounts and snapshot */
+    if (meta_read(sb.dir_entry_offset, sb.dir_entry_size, DIR, sizeof(DIR)) == -1 ||
+        meta_read(sb.inode_offset, sb.inode_size, inode_bitmap, sizeof(inode_bitmap)) == -1 ||
+        meta_read(sb.block_bitmap_offset, sb.block_bitmap_size, blocks_bitmap, sizeof(blocks_bitmap)) == -1 ||
+        meta_read(sb.refcount_offset, sb.refcount_size, block_refs, sizeof(block_refs)) == -1 ||
+        meta_read(sb.snap_dir_offset, sb.dir_entry_size, snap_DIR, sizeof(snap_DIR)) == -1 ||
+        meta_read(sb.snap_inode_offset, sb.inode_size, snap_inodes, sizeof(snap_inodes)) == -1 ||
+        meta_read(sb.fp_offset, sb.fp_size, block_fp, sizeof(block_fp)) == -1) {
         return -1;
     }
 
+    free_blocks = 0;
+    for (int b = sb.data_block_offset; b < DISK_BLOCKS; b++) {
+        free_blocks += !block_is_used(b);
+    }
 
-    if (close_disk(disk_name) == -1) {
-        perror("ERROR: close");
-        return -1;
+    /* initialize file descriptor array and chunk cache for local use */
+    for (int i = 0; i < MAX_FILDES; i++) {
+        fd[i].used = false;
+        fd[i].inode_num = -1;
+        fd[i].offset = 0;
     }
+    for (int i = 0; i < CHUNK_CACHE_SIZE; i++) {
+        chunk_cache[i].valid = false;
+    }
+    memset(&stats, 0, sizeof(stats));
+    fp_rebuild();
 
+    mounted = true;
     return 0;
 }
 
-/* mounts a file system on virtual disk */
-int mount_fs(const char *disk_name)
+/* creates a fresh (and empty) file system on the virtual disk */
+int make_fs(const char *disk_name)
 {   
-    if (open_disk(disk_name) == -1) {
-        perror("ERROR: open_disk");
+    if (make_disk(disk_name) == -1) {
+        perror("ERROR: make_disk");
         return -1;
     }
 
-    if (mounted == true) {
-        perror("ERROR: disk already mounted");
+    if (open_disk(disk_name) == -1) {
+        perror("ERROR: open_disk");
         return -1;
     }
 
-    char *buffer = calloc(1, BLOCK_SIZE);
-    
-    /* mount superblock */
-    if (block_read(0, buffer) == -1) {
-        perror("ERROR: block_read");
+    if (format_fs(1, 1) == -1) {
+        close_disk();
         return -1;
     }
-    memcpy((void *)&sb, (void *)buffer, sizeof(struct superblock));
 
-    /* mount DIR */
-    if (block_read(sb.dir_entry_offset, buffer) == -1) {
-        perror("ERROR: block_read");
+    if (close_disk(disk_name) == -1) {
+        perror("ERROR: close");
         return -1;
     }
-    for (int i = 0; i < MAX_FILES; i++) {
-        memcpy((void *)DIR, (void *)buffer, sizeof(struct dir_entry));
-    }
 
-    /* mount inode bitmap */
-    if (block_read(sb.inode_bitmap_offset, buffer) == -1) {
-        perror("ERROR: block_read");
+    return 0;
+}
+
+/* creates a fresh file system striped across ndisks disk files,
+stripe_unit consecutive blocks per disk */
+int make_fs_striped(const char **disk_names, int ndisks, int stripe_unit)
+{
+    if (stripe_make(disk_names, ndisks, stripe_unit) == -1) {
+        perror("ERROR: stripe_make");
         return -1;
     }
-    memcpy((void *)inode_bitmap, (void *)buffer, MAX_FILES);
 
-    /* mount disk blocks bitmap */
-    if (block_read(sb.block_bitmap_offset, buffer) == -1) {
-        perror("ERROR: block_read");
+    if (stripe_open(disk_names, ndisks, stripe_unit) == -1) {
+        perror("ERROR: stripe_open");
         return -1;
     }
-    memcpy((void *)blocks_bitmap, (void *)buffer, sizeof(blocks_bitmap));
 
-    /* initialize file descriptor array for local use */
-    for (int i = 0; i < MAX_FILDES; i++) {
-        fd[i].used = false;
-        fd[i].inode_num = -1;
-        fd[i].offset = 0;
+    striped = true;
+    int rc = format_fs(ndisks, stripe_unit);
+    striped = false;
+
+    if (stripe_close() == -1) {
+        perror("ERROR: close");
+        return -1;
     }
 
-    mounted = true;
-    return 0;
+    return rc;
 }
 
-/* unmounts a file system stored on virtual disk */
-int umount_fs(const char *disk_name) 
+/* mounts a file system on virtual disk */
+int mount_fs(const char *disk_name)
 {   
-    char* buffer = calloc(1, BLOCK_SIZE);
+    if (mounted == true) {
+        perror("ERROR: disk already mounted");
+        return -1;
+    }
 
-    /* write back superblock */
-    memcpy((void *)buffer, (void *)&sb, sizeof(struct superblock));
-    if (block_write(0, buffer) == -1) {
-        perror("ERROR: block_write");
+    if (open_disk(disk_name) == -1) {
+        perror("ERROR: open_disk");
         return -1;
     }
 
-    /* write back DIR */
-    for (int i = 0; i < MAX_FILES; i++) {
-        memcpy((void *)(buffer + i * sizeof(struct dir_entry)), (void *)DIR, sizeof(struct dir_entry)); 
+    if (load_fs(1) == -1) {
+        close_disk();
+        return -1;
     }
-    if (block_write(sb.dir_entry_offset, buffer) == -1) {
-        perror("ERROR: block_write");
+
+    return 0;
+}
+
+/* mounts a file system made by make_fs_striped, disks given in the same order */
+int mount_fs_striped(const char **disk_names, int ndisks)
+{
+    if (mounted == true) {
+        perror("ERROR: disk already mounted");
         return -1;
     }
 
-    /* write back inode bitmap */
-    for (int i = 0; i < MAX_FILES; i++) {
-        memcpy((void *)(buffer + i * sizeof(struct inode)), (void *)inode_bitmap, sizeof(struct inode));
+    if (stripe_open(disk_names, ndisks, 1) == -1) {
+        perror("ERROR: stripe_open");
+        return -1;
     }
-    if (block_write(sb.inode_bitmap_offset, buffer) == -1) {
-        perror("ERROR: block_write");
+
+    striped = true;
+    if (load_fs(ndisks) == -1) {
+        striped = false;
+        stripe_close();
         return -1;
     }
 
-    /* write back disk blocks bitmap */
-    memcpy((void *)buffer, (void *)blocks_bitmap, sizeof(blocks_bitmap));
-    if (block_write(sb.block_bitmap_offset, buffer) == -1) {
-        perror("ERROR: block_write");
+    return 0;
+}
+
+/* unmounts a file system stored on virtual disk (or on the striped disks) */
+int umount_fs(const char *disk_name) 
+{   
+    if (mounted == false) {
+        perror("ERROR: disk not mounted");
         return -1;
     }
 
-    /* fd not written since not persistent across mounts */
+    /* write back superblock, DIR, inode table, disk blocks bitmap, refcounts and snapshot
+    fd not written since not persistent across mounts */
+    if (meta_flush() == -1) {
+        return -1;
+    }
 
-    if (close_disk(disk_name) == -1) {
+    if ((striped ? stripe_close() : close_disk(disk_name)) == -1) {
         perror("ERROR: close");
         return -1;
     }
 
+    striped = false;
+    mounted = false;
     return 0;
 }
 
@@ -302,9 +753,9 @@ int fs_open(const char *name)
 
     /* find in directory */
     for (int i = 0; i < MAX_FILES; i++) {
-        if (strcmp(name, DIR[i].name) == 0){
+        if (DIR[i].used && strcmp(name, DIR[i].name) == 0){
             fd[idx].used = true;
-            fd[idx].inode_num = idx;
+            fd[idx].inode_num = DIR[i].inode_num;
             fd[idx].offset = 0;
             break;
         }
@@ -360,6 +811,7 @@ int fs_create(const char *name)
             DIR[i].used = true;
             strcpy(DIR[i].name, name);
             DIR[i].inode_num = i;
+            memset(&inode_bitmap[i], 0, sizeof(struct inode));
             break;
         }
         else if (i == MAX_FILES - 1) {
@@ -377,11 +829,7 @@ int fs_delete(const char *name)
 {
     int idx;
     for (idx = 0; idx < MAX_FILES; idx++) {
-        if (strcmp(DIR[idx].name, name) == 0) {
-            if (fd[idx].used == true) {
-                perror("ERROR: open files with name");
-                return -1;
-            }
+        if (DIR[idx].used && strcmp(DIR[idx].name, name) == 0) {
             break;
         }
         else if (idx == MAX_FILES - 1) {
@@ -390,21 +838,17 @@ int fs_delete(const char *name)
         }
     }
 
-    /* clear blocks from used block bitmap */
-    for (int i = 0; i < inode_bitmap[idx].direct_offset; i++) {
-        //blocks_bitmap[idx] = 0;
-    }
-
-
-    /* clear file descriptor */
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (DIR[i].inode_num == i) {
-            fd[i].used = false;
-            fd[i].inode_num = -1;
-            fd[i].offset = 0;
+    for (int i = 0; i < MAX_FILDES; i++) {
+        if (fd[i].used && fd[i].inode_num == DIR[idx].inode_num) {
+            perror("ERROR: open files with name");
+            return -1;
         }
     }
 
+    /* clear blocks from used block bitmap */
+    free_from(DIR[idx].inode_num, 0);
+    memset(&inode_bitmap[DIR[idx].inode_num], 0, sizeof(struct inode));
+
     /* clear directory entry */
     DIR[idx].used = false;
     memset(DIR[idx].name, '\0', MAX_FILENAME);
@@ -417,7 +861,8 @@ int fs_delete(const char *name)
 referenced by the descriptor fd into the buffer pointed to by buf */
 int fs_read(int fds, void *buf, size_t nbyte)
 {
-    if (fds < 0 || fds >= MAX_FILDES || !fd[fds].used) {
+    struct inode *in = fd_inode(fds);
+    if (in == NULL) {
         perror("ERROR: invalid fd fs_read");
         return -1;
     }
@@ -427,105 +872,168 @@ int fs_read(int fds, void *buf, size_t nbyte)
         return -1;
     }
 
-    int idx;
-    for (idx = 0; idx < MAX_FILES; idx++) {
-        if (DIR[idx].inode_num == fds) { // index of directory referred to by fds
-            break;
-        }
+    /* read does not go out of bounds of filesize */
+    int offset = fd[fds].offset;
+    if (offset + nbyte > in->size) {
+        nbyte = in->size - offset;
     }
 
-    char* buffer = calloc(1, BLOCK_SIZE * ((inode_bitmap[idx].size - 1) / BLOCK_SIZE + 1)); // allocate in multiples of blocks
-
-    for (int i = 0; i < (inode_bitmap[idx].size - 1)/BLOCK_SIZE + 1; i++) { // iter over number of blocks in buffer
-        if (block_read(DIR[idx].inode_num, buffer + i * BLOCK_SIZE) == -1) {
-            perror("ERROR: block_read");
-            return -1;
+    size_t done = 0;
+    char buffer[BLOCK_SIZE];
+    while (done < nbyte) {
+        size_t n;
+        if (in->flags & INODE_COMPRESSED) {
+            int c = offset / CHUNK_SIZE;
+            n = CHUNK_SIZE - offset % CHUNK_SIZE;
+            n = n < nbyte - done ? n : nbyte - done;
+
+            char *data = chunk_get(fd[fds].inode_num, c);
+            if (data == NULL) {
+                break;
+            }
+            memcpy((char *)buf + done, data + offset % CHUNK_SIZE, n);
         }
-    }
-    memcpy(buf, (void *)(buffer + fd[fds].offset), nbyte);
+        else if (offset % BLOCK_SIZE == 0 && nbyte - done >= BLOCK_SIZE) {
+            int count = (int)((nbyte - done) / BLOCK_SIZE);
+            int got = read_blocks(in, offset / BLOCK_SIZE, count, (char *)buf + done);
+            n = (size_t)got * BLOCK_SIZE;
+            if (got < count) {
+                done += n;
+                offset += n;
+                break;
+            }
+        }
+        else {
+            int b = in->direct[offset / BLOCK_SIZE];
+            n = BLOCK_SIZE - offset % BLOCK_SIZE;
+            n = n < nbyte - done ? n : nbyte - done;
 
-    if (fd[fds].offset + nbyte > inode_bitmap[idx].size) { // read does not go out of bounds of filesize
-        //int offset = fd[fds].offset;
-        fd[fds].offset = inode_bitmap[idx].size;
-        //return inode_bitmap[idx].size - offset;
+            if (b == 0) {
+                memset(buffer, 0, BLOCK_SIZE);
+            }
+            else if (dev_read(b, buffer) == -1) {
+                perror("ERROR: block_read");
+                break;
+            }
+            memcpy((char *)buf + done, buffer + offset % BLOCK_SIZE, n);
+        }
+        done += n;
+        offset += n;
     }
 
-    fd[fds].offset += nbyte;
-    return (int)nbyte;
+    fd[fds].offset = offset;
+    return (int)done;
 }
 
 /* attempts to write nbyte bytes of data from the file 
 referenced by the descriptor fd into the buffer pointed to by buf */
 int fs_write(int fds, void *buf, size_t nbyte)
 {   
-    if (fds < 0 || fds >= MAX_FILDES || !fd[fds].used) {
+    struct inode *in = fd_inode_rw(fds);
+    if (in == NULL) {
         perror("ERROR: invalid fd fs_write");
         return -1;
     }
 
-    int idx;
-    for (idx = 0; idx < MAX_FILES; idx++) {
-        if (DIR[idx].inode_num == fds) { // index of directory referred to by fds
-            break;
-        }
-    }
-
     /* check if nbyte exceeds file size limit of 1MB */
     if (fd[fds].offset + nbyte > MAX_FILESIZE) {
         nbyte = MAX_FILESIZE - fd[fds].offset;
     }
 
-    /* new file size */
-    if (fd[fds].offset + nbyte > inode_bitmap[idx].size) {
-        inode_bitmap[idx].size = fd[fds].offset + nbyte;
-    }
+    int offset = fd[fds].offset;
+    size_t done = 0;
+    char buffer[BLOCK_SIZE];
+    while (done < nbyte) {
+        size_t n;
+        if (in->flags & INODE_COMPRESSED) {
+            /* read-modify-write the whole chunk and recompress it */
+            int c = offset / CHUNK_SIZE;
+            n = CHUNK_SIZE - offset % CHUNK_SIZE;
+            n = n < nbyte - done ? n : nbyte - done;
+
+            char *data = chunk_get(fd[fds].inode_num, c);
+            if (data == NULL) {
+                break;
+            }
+            memcpy(data + offset % CHUNK_SIZE, (char *)buf + done, n);
 
-    char *buffer = calloc(1, BLOCK_SIZE * ((inode_bitmap[idx].size - 1) / BLOCK_SIZE + 1));  // allocate as multiples of blocks
+            int size = offset + (int)n > in->size ? offset + (int)n : in->size;
+            int valid = size - c * CHUNK_SIZE < CHUNK_SIZE ? size - c * CHUNK_SIZE : CHUNK_SIZE;
+            if (chunk_put(fd[fds].inode_num, c, data, valid) == -1) {
+                chunk_invalidate(fd[fds].inode_num, c);
+                break;
+            }
+        }
+        else if (!sb.dedup && offset % BLOCK_SIZE == 0 && nbyte - done >= BLOCK_SIZE) {
+            int count = (int)((nbyte - done) / BLOCK_SIZE);
+            int put = write_blocks(in, offset / BLOCK_SIZE, count, (char *)buf + done);
+            n = (size_t)put * BLOCK_SIZE;
+            if (put < count) {
+                done += n;
+                offset += n;
+                if (offset > in->size) {
+                    in->size = offset;
+                }
+                break;
+            }
+        }
+        else {
+            int lb = offset / BLOCK_SIZE;
+            n = BLOCK_SIZE - offset % BLOCK_SIZE;
+            n = n < nbyte - done ? n : nbyte - done;
+
+            /* partial writes keep the rest of an existing block */
+            if (in->direct[lb] != 0 && n < BLOCK_SIZE) {
+                if (dev_read(in->direct[lb], buffer) == -1) {
+                    perror("fs_write: block_read()");
+                    break;
+                }
+            }
+            else {
+                memset(buffer, 0, BLOCK_SIZE);
+            }
+            memcpy(buffer + offset % BLOCK_SIZE, (char *)buf + done, n);
 
-    /* copy existing blocks over */
-    for (int i = 0; i < (inode_bitmap[idx].size - 1) / BLOCK_SIZE + 1; i++) {  // empty blocks do not matter
-        if (block_read(sb.inode_bitmap_offset, buffer + i * BLOCK_SIZE) == -1) {   
-            perror("fs_write: block_read()");
-            return -1;
+            if (sb.dedup && n == BLOCK_SIZE) {
+                if (dedup_write(&in->direct[lb], buffer) == -1) {
+                    break;
+                }
+            }
+            else {
+                /* unallocated and shared blocks get a block of their own */
+                if (block_cow(&in->direct[lb]) == -1) {
+                    break;
+                }
+                if (dev_write(in->direct[lb], buffer) == -1) {
+                    perror("fs_write: block_write()");
+                    break;
+                }
+            }
         }
-    }
-    /* memcpy new bytes to write into buffer */
-    memcpy((void *)(buffer + fd[fds].offset), buf, nbyte);
+        done += n;
+        offset += n;
 
-    /* write entire buffer back to respective blocks */
-    for (int i = 0; i < (inode_bitmap[idx].size - 1) / BLOCK_SIZE + 1; ++i) { 
-        if (block_write(sb.inode_bitmap_offset, buffer + i * BLOCK_SIZE) == -1) { 
-            perror("fs_write: block_write()");
-            return -1;
+        /* new file size */
+        if (offset > in->size) {
+            in->size = offset;
         }
     }
 
     /* increment offset for next op */
-    fd[fds].offset += nbyte;
-    return nbyte;
+    fd[fds].offset = offset;
+    return (int)done;
 }
 
 /* returns the current size of the file referenced by the file descriptor fd */
 int fs_get_filesize(int fds)
 {
-    if (fds < 0 || fds > MAX_FILDES || !fd[fds].used) {
+    struct inode *in = fd_inode(fds);
+    if (in == NULL) {
         perror("ERROR: invalid fd");
         return -1;
     }
 
-    int idx;
-    for (idx = 0; idx < MAX_FILES; idx++) {
-        if (DIR[idx].inode_num == fds) { // index of directory referred to by fds
-            break;
-        }
-    }
-
-    if (idx == -1) {
-        perror("ERROR: fs_get_filesize");
-        return -1;
-    }
-
-    return inode_bitmap[idx].size;
+    return in->size;
 }
 
 /* creates and populates an array of all filenames currently known to the file system */
@@ -551,19 +1059,13 @@ int fs_listfiles(char ***files)
 associated with the file descriptor fd to the argument offset */
 int fs_lseek(int fds, off_t offset)
 {
-    if (fds < 0 || fds > MAX_FILDES || !fd[fds].used) {
+    struct inode *in = fd_inode(fds);
+    if (in == NULL) {
         perror("ERROR: invalid fd");
         return -1;
     }
 
-    int idx;
-    for (idx = 0; idx < MAX_FILES; idx++) {
-        if (DIR[idx].inode_num == fds) { // index of directory referred to by fds
-            break;
-        }
-    }
-
-    if (offset < 0 || offset > inode_bitmap[idx].size) { 
+    if (offset < 0 || offset > in->size) {
         perror("ERROR: invalid offset");
         return -1;
     }
@@ -575,53 +1077,229 @@ int fs_lseek(int fds, off_t offset)
 /* causes the file referenced by fd to be truncated to length bytes in size */
 int fs_truncate(int fds, off_t length)
 {
-    if (fds < 0 || fds > MAX_FILDES || !fd[fds].used) {
+    struct inode *in = fd_inode_rw(fds);
+    if (in == NULL) {
         perror("ERROR: invalid fd");
         return -1;
     }
 
-    int idx;
-    for (idx = 0; idx < MAX_FILES; idx++) {
-        if (DIR[idx].inode_num == fds) { // index of directory referred to by fds
-            break;
-        }
-    }
-
-    if (length > inode_bitmap[idx].size) {
+    if (length > in->size) {
         perror("ERROR: invalid length");
         return -1;
     }
 
     /* free blocks */
-    int nb = (uint16_t)(length + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    int b_idx = DIR[idx].inode_num;
-    for (int i = 0; i < nb; i++) {
-        b_idx = next_block(b_idx, fd[idx].inode_num);
-    }
-    while (idx > 0){
-        char* buf = calloc(1, BLOCK_SIZE);
-        if (b_idx < BLOCK_SIZE){
-            block_read(sb.data_block_offset, buf);
-            buf[b_idx] = '\0';
-            block_write(sb.data_block_offset, buf);
-        } 
-        else {
-            block_read(sb.data_block_offset + 1, buf);
-            buf[b_idx - BLOCK_SIZE] = '\0';
-            block_write(sb.data_block_offset + 1, buf);
+    int inode_num = fd[fds].inode_num;
+    free_from(inode_num, (int)length);
+
+    /* zero the tail of the last block/chunk so a later extension reads zeros */
+    if (in->flags & INODE_COMPRESSED) {
+        int c = (int)length / CHUNK_SIZE;
+        if (length % CHUNK_SIZE != 0) {
+            char *data = chunk_get(inode_num, c);
+            if (data == NULL) {
+                return -1;
+            }
+            memset(data + length % CHUNK_SIZE, 0, CHUNK_SIZE - length % CHUNK_SIZE);
+            if (chunk_put(inode_num, c, data, (int)(length % CHUNK_SIZE)) == -1) {
+                chunk_invalidate(inode_num, c);
+                return -1;
+            }
+        }
+    }
+    else if (length % BLOCK_SIZE != 0 && in->direct[length / BLOCK_SIZE] != 0) {
+        char buffer[BLOCK_SIZE];
+        if (dev_read(in->direct[length / BLOCK_SIZE], buffer) == -1) {
+            perror("ERROR: block_read");
+            return -1;
+        }
+        memset(buffer + length % BLOCK_SIZE, 0, BLOCK_SIZE - length % BLOCK_SIZE);
+        if (block_cow(&in->direct[length / BLOCK_SIZE]) == -1) {
+            return -1;
+        }
+        if (dev_write(in->direct[length / BLOCK_SIZE], buffer) == -1) {
+            perror("ERROR: block_write");
+            return -1;
         }
-        b_idx = next_block(b_idx, fd[idx].inode_num);
     }
 
      /* modify file information */
-    inode_bitmap[idx].size = (int)length;
+    in->size = (int)length;
 
     /* truncate fd offset */
     for(int i = 0; i < MAX_FILDES; i++) {
-        if(fd[i].used == true && fd[i].inode_num == fd[idx].inode_num) {
+        if(fd[i].used == true && fd[i].inode_num == inode_num && fd[i].offset > length) {
             fd[i].offset = (int)length;
         }
     }
 
     return 0;
 }
+
+/* turns transparent compression on or off for an empty file */
+int fs_set_compressed(int fds, int enable)
+{
+    struct inode *in = fd_inode_rw(fds);
+    if (in == NULL) {
+        perror("ERROR: invalid fd");
+        return -1;
+    }
+
+    if (in->size != 0) {
+        perror("ERROR: file not empty");
+        return -1;
+    }
+
+    if (enable) {
+        in->flags |= INODE_COMPRESSED;
+    }
+    else {
+        in->flags &= ~INODE_COMPRESSED;
+    }
+    return 0;
+}
+
+/* creates dst as a copy of src that shares all of src's data blocks
+blocks are copied on write, so the clone only costs metadata */
+int fs_clone_file(const char *src, const char *dst)
+{
+    int s;
+    for (s = 0; s < MAX_FILES; s++) {
+        if (DIR[s].used && strcmp(DIR[s].name, src) == 0) {
+            break;
+        }
+        else if (s == MAX_FILES - 1) {
+            perror("ERROR: filename does not exist");
+            return -1;
+        }
+    }
+
+    if (fs_create(dst) == -1) {
+        return -1;
+    }
+
+    int d;
+    for (d = 0; d < MAX_FILES; d++) {
+        if (DIR[d].used && strcmp(DIR[d].name, dst) == 0) {
+            break;
+        }
+    }
+
+    struct inode *in = &inode_bitmap[DIR[d].inode_num];
+    *in = inode_bitmap[DIR[s].inode_num];
+    for (int i = 0; i < MAX_FILE_BLOCKS; i++) {
+        block_get(in->direct[i]);
+    }
+
+    return 0;
+}
+
+/* drops the current snapshot and releases the blocks only it referenced */
+int fs_drop_snapshot()
+{
+    for (int i = 0; i < MAX_FILDES; i++) {
+        if (fd[i].used && fd[i].inode_num >= MAX_FILES) {
+            perror("ERROR: open snapshot files");
+            return -1;
+        }
+    }
+
+    if (sb.snap_valid) {
+        for (int i = 0; i < MAX_FILES; i++) {
+            free_from(SNAP_INODE(i), 0);
+        }
+    }
+    memset(snap_inodes, 0, sizeof(snap_inodes));
+    memset(snap_DIR, 0, sizeof(snap_DIR));
+    sb.snap_valid = 0;
+
+    return 0;
+}
+
+/* freezes the current DIR and inode table as a read-only snapshot root,
+replacing any earlier snapshot; data blocks are shared, not copied */
+int fs_snapshot()
+{
+    if (fs_drop_snapshot() == -1) {
+        return -1;
+    }
+
+    memcpy(snap_DIR, DIR, sizeof(DIR));
+    memcpy(snap_inodes, inode_bitmap, sizeof(inode_bitmap));
+    for (int i = 0; i < MAX_FILES; i++) {
+        for (int j = 0; j < MAX_FILE_BLOCKS; j++) {
+            block_get(snap_inodes[i].direct[j]);
+        }
+    }
+    sb.snap_valid = 1;
+
+    return 0;
+}
+
+/* opens a file of the snapshot root for reading */
+int fs_open_snapshot(const char *name)
+{
+    if (!sb.snap_valid) {
+        perror("ERROR: no snapshot");
+        return -1;
+    }
+
+    int idx;
+    for (idx = 0; idx < MAX_FILDES; idx++) {
+        if (fd[idx].used == false) {
+            break;
+        }
+        else if (idx == MAX_FILDES - 1) {
+            perror("ERROR: max open fds");
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (snap_DIR[i].used && strcmp(name, snap_DIR[i].name) == 0) {
+            fd[idx].used = true;
+            fd[idx].inode_num = SNAP_INODE(snap_DIR[i].inode_num);
+            fd[idx].offset = 0;
+            break;
+        }
+        else if (i == MAX_FILES - 1) {
+            perror("ERROR: filename not found");
+            return -1;
+        }
+    }
+
+    return idx;
+}
+
+/* turns block deduplication of full-block writes on or off for the mounted disk
+only uncompressed files are deduplicated */
+int fs_set_dedup(int enable)
+{
+    if (!mounted) {
+        perror("ERROR: disk not mounted");
+        return -1;
+    }
+
+    sb.dedup = enable ? 1 : 0;
+    return 0;
+}
+
+/* reports block usage and deduplication counters */
+int fs_get_stats(struct fs_stats *st)
+{
+    if (!mounted) {
+        perror("ERROR: disk not mounted");
+        return -1;
+    }
+
+    *st = stats;
+    st->data_blocks = DISK_BLOCKS - sb.data_block_offset;
+    st->free_blocks = free_blocks;
+    st->shared_refs = 0;
+    for (int b = sb.data_block_offset; b < DISK_BLOCKS; b++) {
+        if (block_is_used(b) && block_refs[b] > 1) {
+            st->shared_refs += block_refs[b] - 1;
+        }
+    }
+    return 0;
+}
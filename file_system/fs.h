@@ -2,8 +2,22 @@
 #define INCLUDE_FS_H
 #include <sys/types.h>
 
+/* space accounting; dedup counters cover the current mount */
+struct fs_stats
+{
+    int data_blocks; // data blocks on the disk
+    int free_blocks;
+    int shared_refs; // block references saved by clones, snapshots and dedup
+    int dedup_hashed; // full blocks fingerprinted by fs_write
+    int dedup_hits; // of those, stored as a reference to an existing block
+    int dedup_zero; // of those, all zero and stored as a hole
+    long dedup_nsec; // time spent hashing and verifying candidates
+};
+
 int make_fs(const char *disk_name);
+int make_fs_striped(const char **disk_names, int ndisks, int stripe_unit);
 int mount_fs(const char *disk_name);
+int mount_fs_striped(const char **disk_names, int ndisks);
 int umount_fs(const char *disk_name);
 int fs_open(const char *name);
 int fs_close(int fds);
@@ -15,4 +29,11 @@ int fs_get_filesize(int fildes);
 int fs_listfiles(char ***files);
 int fs_lseek(int fildes, off_t offset);
 int fs_truncate(int fildes, off_t length);
+int fs_set_compressed(int fildes, int enable);
+int fs_clone_file(const char *src, const char *dst);
+int fs_snapshot();
+int fs_drop_snapshot();
+int fs_open_snapshot(const char *name);
+int fs_set_dedup(int enable);
+int fs_get_stats(struct fs_stats *st);
 #endif /* INCLUDE_FS_H */
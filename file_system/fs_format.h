@@ -0,0 +1,72 @@
+#ifndef INCLUDE_FS_FORMAT_H
+#define INCLUDE_FS_FORMAT_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "disk.h"
+
+/* on-disk layout shared by fs.c and fsck.c */
+
+#define MAX_FILES 64
+#define MAX_FILESIZE (1 << 20) // file size = 1MB
+#define MAX_FILENAME 15
+#define MAX_FILE_BLOCKS (MAX_FILESIZE / BLOCK_SIZE) // direct blocks per file (1MB/4kB)
+
+/* compressed files are stored in fixed logical chunks of CHUNK_BLOCKS blocks */
+#define CHUNK_BLOCKS 4
+#define CHUNK_SIZE (CHUNK_BLOCKS * BLOCK_SIZE)
+#define MAX_CHUNKS (MAX_FILE_BLOCKS / CHUNK_BLOCKS)
+#define CHUNK_RAW 0x8000 // chunk_len flag: chunk did not compress and is stored as is
+
+/* inode flags */
+#define INODE_COMPRESSED 0x1
+
+#define BLOCKS_FOR(bytes) (((bytes) + BLOCK_SIZE - 1) / BLOCK_SIZE)
+
+/* information about where to find the file system and its data structures */
+struct superblock
+{
+    uint16_t block_bitmap_size;
+    uint16_t block_bitmap_offset;
+    uint16_t inode_bitmap_size;
+    uint16_t inode_bitmap_offset;
+    uint16_t dir_entry_size;
+    uint16_t dir_entry_offset;
+    uint16_t inode_offset;
+    uint16_t inode_size;
+    uint16_t data_block_offset;
+    uint16_t refcount_size;
+    uint16_t refcount_offset;
+    uint16_t snap_dir_offset; // snapshot DIR, dir_entry_size blocks
+    uint16_t snap_inode_offset; // snapshot inode table, inode_size blocks
+    uint16_t snap_valid;
+    uint16_t fp_size;
+    uint16_t fp_offset; // fingerprint of each data block, 0 = none
+    uint16_t dedup; // fs_write shares identical full blocks
+    uint16_t stripe_disks; // disk files the device is striped across
+    uint16_t stripe_unit; // consecutive blocks per disk
+};
+
+/* attributes of inode/file */
+struct inode 
+{
+    int file_type;
+    int size;
+    int flags; // INODE_COMPRESSED
+    /* disk block of each file block, 0 = hole (block 0 is the superblock)
+    compressed files keep chunk c in direct[c * CHUNK_BLOCKS ...] */
+    uint16_t direct[MAX_FILE_BLOCKS];
+    uint16_t chunk_len[MAX_CHUNKS]; // stored bytes of each chunk (compressed files), 0 = hole
+};
+
+/* if the inode points to a directory entry 
+when taking data out of this block interpret it as a dir entry (root)
+*/
+struct dir_entry
+{
+    bool used;
+    int inode_num;
+    char name[MAX_FILENAME + 1];
+};
+
+#endif /* INCLUDE_FS_FORMAT_H */
@@ -0,0 +1,423 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fs_format.h"
+
+/*
+ * Offline consistency checker for fs.c volumes.
+ *
+ * The metadata region is read once. Worker threads then scan slices of the
+ * live and snapshot inode tables and count the references they find to each
+ * data block. The merged counts are the truth that blocks_bitmap and the
+ * block refcounts are checked against (and rebuilt from with -r), again split
+ * across the workers by block range.
+ *
+ * usage: fsck [-r] [-j workers] disk
+ * exit status: 0 clean, 1 errors repaired, 4 errors left, 8 unusable volume
+ */
+
+#define MAX_WORKERS 64
+#define ALL_INODES (2 * MAX_FILES) // live table followed by the snapshot table
+
+/* in-core copy of the volume metadata */
+struct volume
+{
+    struct superblock sb;
+    struct dir_entry dir[MAX_FILES];
+    struct dir_entry snap_dir[MAX_FILES];
+    struct inode inodes[ALL_INODES];
+    uint8_t bitmap[DISK_BLOCKS / 8];
+    uint16_t refs[DISK_BLOCKS];
+    uint32_t fp[DISK_BLOCKS];
+    bool linked[ALL_INODES]; // inode is named by a directory entry
+};
+
+struct worker
+{
+    pthread_t thread;
+    int first, last; // inode slice, then block range [first, last)
+    uint16_t refs[DISK_BLOCKS]; // references found in this worker's inodes
+    int errors;
+};
+
+static struct volume vol;
+static struct worker workers[MAX_WORKERS];
+static int nworkers;
+static uint16_t owners[DISK_BLOCKS]; // merged reference counts
+static bool repair = false;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void report(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    pthread_mutex_lock(&report_lock);
+    vprintf(fmt, ap);
+    pthread_mutex_unlock(&report_lock);
+    va_end(ap);
+}
+
+static int read_region(int dfd, int start, int nblocks, void *dst, size_t len)
+{
+    if ((size_t)nblocks * BLOCK_SIZE < len) {
+        return -1;
+    }
+    if (pread(dfd, dst, len, (off_t)start * BLOCK_SIZE) != (ssize_t)len) {
+        return -1;
+    }
+    return 0;
+}
+
+static int write_region(int dfd, int start, const void *src, size_t len)
+{
+    if (pwrite(dfd, src, len, (off_t)start * BLOCK_SIZE) != (ssize_t)len) {
+        return -1;
+    }
+    return 0;
+}
+
+static bool bit_is_set(int b)
+{
+    return (vol.bitmap[b / 8] >> (b % 8)) & 1;
+}
+
+static void bit_set(int b, bool used)
+{
+    if (used) {
+        vol.bitmap[b / 8] |= (uint8_t)(1 << (b % 8));
+    }
+    else {
+        vol.bitmap[b / 8] &= (uint8_t)~(1 << (b % 8));
+    }
+}
+
+/* superblock offsets must describe the layout make_fs writes */
+static bool superblock_ok()
+{
+    struct superblock *sb = &vol.sb;
+    if (sb->dir_entry_offset != 1 ||
+        sb->dir_entry_size != BLOCKS_FOR(sizeof(vol.dir)) ||
+        sb->block_bitmap_size != BLOCKS_FOR(sizeof(vol.bitmap)) ||
+        sb->inode_size != BLOCKS_FOR(sizeof(struct inode) * MAX_FILES) ||
+        sb->refcount_size != BLOCKS_FOR(sizeof(vol.refs)) ||
+        sb->fp_size != BLOCKS_FOR(sizeof(vol.fp))) {
+        return false;
+    }
+    int ends[] = {
+        sb->dir_entry_offset + sb->dir_entry_size,
+        sb->block_bitmap_offset + sb->block_bitmap_size,
+        sb->inode_offset + sb->inode_size,
+        sb->refcount_offset + sb->refcount_size,
+        sb->snap_dir_offset + sb->dir_entry_size,
+        sb->snap_inode_offset + sb->inode_size,
+        sb->fp_offset + sb->fp_size,
+    };
+    for (int i = 0; i < (int)(sizeof(ends) / sizeof(ends[0])); i++) {
+        if (ends[i] > sb->data_block_offset) {
+            return false;
+        }
+    }
+    return sb->data_block_offset < DISK_BLOCKS;
+}
+
+/* entries must name distinct, valid inodes with distinct names */
+static int check_dir(struct dir_entry *dir, int base, const char *which)
+{
+    int errors = 0;
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (!dir[i].used) {
+            continue;
+        }
+        dir[i].name[MAX_FILENAME] = '\0';
+
+        const char *problem = NULL;
+        if (dir[i].inode_num < 0 || dir[i].inode_num >= MAX_FILES) {
+            problem = "invalid inode";
+        }
+        else if (vol.linked[base + dir[i].inode_num]) {
+            problem = "inode already linked";
+        }
+        else {
+            for (int j = 0; j < i; j++) {
+                if (dir[j].used && strcmp(dir[j].name, dir[i].name) == 0) {
+                    problem = "duplicate name";
+                }
+            }
+        }
+
+        if (problem != NULL) {
+            report("%s entry %d (%s): %s\n", which, i, dir[i].name, problem);
+            errors++;
+            if (repair) {
+                memset(&dir[i], 0, sizeof(struct dir_entry));
+            }
+            continue;
+        }
+        vol.linked[base + dir[i].inode_num] = true;
+    }
+    return errors;
+}
+
+/* phase 1: validate a slice of inodes and count their block references */
+static void *scan_inodes(void *arg)
+{
+    struct worker *w = arg;
+    for (int i = w->first; i < w->last; i++) {
+        struct inode *in = &vol.inodes[i];
+        const char *table = i < MAX_FILES ? "inode" : "snapshot inode";
+        int num = i % MAX_FILES;
+
+        if (!vol.linked[i]) {
+            int held = 0;
+            for (int j = 0; j < MAX_FILE_BLOCKS; j++) {
+                held += in->direct[j] != 0;
+            }
+            if (held > 0) {
+                report("%s %d: not in a directory but holds %d blocks\n", table, num, held);
+                w->errors++;
+            }
+            if (repair) {
+                memset(in, 0, sizeof(struct inode));
+            }
+            continue;
+        }
+
+        if (in->size < 0 || in->size > MAX_FILESIZE) {
+            report("%s %d: invalid size %d\n", table, num, in->size);
+            w->errors++;
+            if (repair) {
+                in->size = in->size < 0 ? 0 : MAX_FILESIZE;
+            }
+        }
+
+        bool compressed = in->flags & INODE_COMPRESSED;
+        for (int j = 0; j < MAX_FILE_BLOCKS; j++) {
+            int b = in->direct[j];
+            int c = j / CHUNK_BLOCKS;
+
+            /* the block a file has no use for is as good as leaked */
+            bool needed = compressed ?
+                j % CHUNK_BLOCKS < BLOCKS_FOR(in->chunk_len[c] & ~CHUNK_RAW) && c * CHUNK_SIZE < in->size :
+                j < BLOCKS_FOR(in->size);
+
+            if (b == 0) {
+                if (compressed && needed) {
+                    report("%s %d: chunk %d is missing block %d\n", table, num, c, j % CHUNK_BLOCKS);
+                    w->errors++;
+                    if (repair) {
+                        in->chunk_len[c] = 0;
+                    }
+                }
+                continue;
+            }
+
+            if (b < vol.sb.data_block_offset || b >= DISK_BLOCKS) {
+                report("%s %d: block %d points outside the data area (%d)\n", table, num, j, b);
+                w->errors++;
+                if (repair) {
+                    in->direct[j] = 0;
+                    if (compressed) {
+                        in->chunk_len[c] = 0;
+                    }
+                }
+                continue;
+            }
+
+            if (!needed) {
+                report("%s %d: block %d (%d) past the end of the file\n", table, num, j, b);
+                w->errors++;
+                if (repair) {
+                    in->direct[j] = 0;
+                    continue;
+                }
+            }
+
+            w->refs[b]++;
+        }
+    }
+    return NULL;
+}
+
+/* phase 2: compare a block range against the merged reference counts */
+static void *check_blocks(void *arg)
+{
+    struct worker *w = arg;
+    for (int b = w->first; b < w->last; b++) {
+        bool used = bit_is_set(b);
+
+        if (b < vol.sb.data_block_offset) {
+            if (!used) {
+                report("block %d: metadata block marked free\n", b);
+                w->errors++;
+                if (repair) {
+                    bit_set(b, true);
+                }
+            }
+            continue;
+        }
+
+        int n = owners[b];
+        if (n > 0 && !used) {
+            report("block %d: used by %d file block(s) but marked free\n", b, n);
+            w->errors++;
+        }
+        else if (n == 0 && used) {
+            report("block %d: leaked, marked used but not referenced\n", b);
+            w->errors++;
+        }
+        else if (n > vol.refs[b]) {
+            report("block %d: cross-linked, %d references but refcount %d\n", b, n, vol.refs[b]);
+            w->errors++;
+        }
+        else if (n < vol.refs[b]) {
+            report("block %d: refcount %d but only %d references\n", b, vol.refs[b], n);
+            w->errors++;
+        }
+
+        if (repair) {
+            bit_set(b, n > 0);
+            vol.refs[b] = (uint16_t)n;
+            if (n == 0) {
+                vol.fp[b] = 0;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* split [0, total) among the workers in multiples of align and run fn on each
+share; a share whose thread cannot be created runs in the calling thread */
+static void run_workers(void *(*fn)(void *), int total, int align)
+{
+    bool started[MAX_WORKERS];
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].first = total * i / nworkers / align * align;
+        workers[i].last = i == nworkers - 1 ? total : total * (i + 1) / nworkers / align * align;
+        started[i] = pthread_create(&workers[i].thread, NULL, fn, &workers[i]) == 0;
+        if (!started[i]) {
+            fn(&workers[i]);
+        }
+    }
+    for (int i = 0; i < nworkers; i++) {
+        if (started[i]) {
+            pthread_join(workers[i].thread, NULL);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "rj:")) != -1) {
+        switch (opt) {
+        case 'r':
+            repair = true;
+            break;
+        case 'j':
+            nworkers = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r] [-j workers] disk\n", argv[0]);
+            return 8;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-r] [-j workers] disk\n", argv[0]);
+        return 8;
+    }
+    if (nworkers < 1) {
+        nworkers = 1;
+    }
+    if (nworkers > MAX_WORKERS) {
+        nworkers = MAX_WORKERS;
+    }
+
+    int dfd = open(argv[optind], repair ? O_RDWR : O_RDONLY);
+    if (dfd == -1) {
+        perror("ERROR: open");
+        return 8;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    struct superblock *sb = &vol.sb;
+    if (pread(dfd, sb, sizeof(*sb), 0) != sizeof(*sb) || !superblock_ok()) {
+        fprintf(stderr, "ERROR: %s: bad superblock\n", argv[optind]);
+        return 8;
+    }
+    /* a member of a striped set holds only every stripe_disks-th stripe
+    unit of the volume: its tables would look corrupt, and "repairs" ruin it */
+    if (sb->stripe_disks != 1) {
+        fprintf(stderr, "ERROR: %s: one of %d striped disks, fsck checks single-disk volumes only\n",
+            argv[optind], sb->stripe_disks);
+        return 8;
+    }
+
+    if (read_region(dfd, sb->dir_entry_offset, sb->dir_entry_size, vol.dir, sizeof(vol.dir)) == -1 ||
+        read_region(dfd, sb->inode_offset, sb->inode_size, vol.inodes, sizeof(struct inode) * MAX_FILES) == -1 ||
+        read_region(dfd, sb->block_bitmap_offset, sb->block_bitmap_size, vol.bitmap, sizeof(vol.bitmap)) == -1 ||
+        read_region(dfd, sb->refcount_offset, sb->refcount_size, vol.refs, sizeof(vol.refs)) == -1 ||
+        read_region(dfd, sb->snap_dir_offset, sb->dir_entry_size, vol.snap_dir, sizeof(vol.snap_dir)) == -1 ||
+        read_region(dfd, sb->snap_inode_offset, sb->inode_size, vol.inodes + MAX_FILES, sizeof(struct inode) * MAX_FILES) == -1 ||
+        read_region(dfd, sb->fp_offset, sb->fp_size, vol.fp, sizeof(vol.fp)) == -1) {
+        fprintf(stderr, "ERROR: %s: cannot read metadata\n", argv[optind]);
+        return 8;
+    }
+
+    int errors = check_dir(vol.dir, 0, "directory");
+    if (sb->snap_valid) {
+        errors += check_dir(vol.snap_dir, MAX_FILES, "snapshot directory");
+    }
+
+    run_workers(scan_inodes, ALL_INODES, 1);
+    for (int i = 0; i < nworkers; i++) {
+        for (int b = 0; b < DISK_BLOCKS; b++) {
+            owners[b] += workers[i].refs[b];
+        }
+    }
+    run_workers(check_blocks, DISK_BLOCKS, 8); // workers never share a bitmap byte
+
+    int used = 0, files = 0;
+    for (int i = 0; i < nworkers; i++) {
+        errors += workers[i].errors;
+    }
+    for (int b = sb->data_block_offset; b < DISK_BLOCKS; b++) {
+        used += owners[b] > 0;
+    }
+    for (int i = 0; i < ALL_INODES; i++) {
+        files += vol.linked[i];
+    }
+
+    if (repair && errors > 0) {
+        if (write_region(dfd, sb->dir_entry_offset, vol.dir, sizeof(vol.dir)) == -1 ||
+            write_region(dfd, sb->inode_offset, vol.inodes, sizeof(struct inode) * MAX_FILES) == -1 ||
+            write_region(dfd, sb->block_bitmap_offset, vol.bitmap, sizeof(vol.bitmap)) == -1 ||
+            write_region(dfd, sb->refcount_offset, vol.refs, sizeof(vol.refs)) == -1 ||
+            write_region(dfd, sb->snap_dir_offset, vol.snap_dir, sizeof(vol.snap_dir)) == -1 ||
+            write_region(dfd, sb->snap_inode_offset, vol.inodes + MAX_FILES, sizeof(struct inode) * MAX_FILES) == -1 ||
+            write_region(dfd, sb->fp_offset, vol.fp, sizeof(vol.fp)) == -1) {
+            perror("ERROR: write back");
+            return 8;
+        }
+    }
+    close(dfd);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+    printf("%s: %d files, %d/%d data blocks in use, %d error(s)%s, %d worker(s), %.3f ms\n",
+           argv[optind], files, used, DISK_BLOCKS - sb->data_block_offset, errors,
+           errors > 0 ? (repair ? " repaired" : " found") : "", nworkers, ms);
+
+    if (errors == 0) {
+        return 0;
+    }
+    return repair ? 1 : 4;
+}
@@ -0,0 +1,203 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+/*
+ * Small LZ4-style block codec used for compressed files.
+ *
+ * A compressed block is a list of sequences. Each sequence is a token byte
+ * (high nibble = literal count, low nibble = match length - LZ_MIN_MATCH),
+ * optional length extension bytes for the literals, the literals themselves,
+ * a 2 byte little-endian match offset and optional extension bytes for the
+ * match length. A nibble of 15 means "add the following bytes until one is
+ * not 255". The last sequence carries literals only.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5 // the last bytes of the input are always literals
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+static uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* write the extension bytes of a length that did not fit in its nibble */
+static uint8_t *lz_put_length(uint8_t *op, int len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/* emit one sequence; mlen == 0 means literals only (end of block) */
+static uint8_t *lz_put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, int nlit, int offset, int mlen)
+{
+    /* token + literal extension + literals + offset + match extension */
+    if (op + 1 + nlit / 255 + 1 + nlit + 2 + mlen / 255 + 1 > oend) {
+        return NULL;
+    }
+
+    uint8_t *token = op++;
+    *token = (uint8_t)((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15) {
+        op = lz_put_length(op, nlit - 15);
+    }
+    memcpy(op, lit, nlit);
+    op += nlit;
+
+    if (mlen == 0) {
+        return op;
+    }
+
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    mlen -= LZ_MIN_MATCH;
+    *token |= (uint8_t)(mlen < 15 ? mlen : 15);
+    if (mlen >= 15) {
+        op = lz_put_length(op, mlen - 15);
+    }
+    return op;
+}
+
+/* compresses srclen bytes of src into dst
+returns the compressed size or -1 if it does not fit in dstcap bytes */
+int lz_compress(const void *src, int srclen, void *dst, int dstcap)
+{
+    const uint8_t *base = src;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    const uint8_t *iend = base + srclen;
+    uint8_t *op = dst;
+    uint8_t *oend = op + dstcap;
+    int table[1 << LZ_HASH_BITS];
+
+    memset(table, 0xff, sizeof(table)); // -1 = no candidate
+
+    if (srclen >= LZ_MIN_MATCH + LZ_LAST_LITERALS) {
+        const uint8_t *mlimit = iend - LZ_LAST_LITERALS;
+        while (ip + LZ_MIN_MATCH <= mlimit) {
+            uint32_t seq = lz_read32(ip);
+            uint32_t h = lz_hash(seq);
+            int ref = table[h];
+            table[h] = (int)(ip - base);
+
+            if (ref < 0 || (ip - base) - ref > LZ_MAX_OFFSET || lz_read32(base + ref) != seq) {
+                ip++;
+                continue;
+            }
+
+            /* extend the match as far as the last literals allow */
+            const uint8_t *mp = ip + LZ_MIN_MATCH;
+            const uint8_t *rp = base + ref + LZ_MIN_MATCH;
+            while (mp < mlimit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+
+            op = lz_put_sequence(op, oend, anchor, (int)(ip - anchor), (int)(ip - (base + ref)), (int)(mp - ip));
+            if (op == NULL) {
+                return -1;
+            }
+            ip = mp;
+            anchor = ip;
+        }
+    }
+
+    op = lz_put_sequence(op, oend, anchor, (int)(iend - anchor), 0, 0);
+    if (op == NULL) {
+        return -1;
+    }
+    return (int)(op - (uint8_t *)dst);
+}
+
+/* read the extension bytes of a length, -1 on truncated input */
+static int lz_get_length(const uint8_t **ip, const uint8_t *iend)
+{
+    int len = 0;
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            return -1;
+        }
+        b = *(*ip)++;
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+/* decompresses srclen bytes of src into dst
+returns the decompressed size or -1 on corrupt input or overflow of dstcap */
+int lz_decompress(const void *src, int srclen, void *dst, int dstcap)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = ip + srclen;
+    uint8_t *op = dst;
+    uint8_t *oend = op + dstcap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        int nlit = token >> 4;
+        if (nlit == 15) {
+            int ext = lz_get_length(&ip, iend);
+            if (ext < 0) {
+                return -1;
+            }
+            nlit += ext;
+        }
+        if (nlit > iend - ip || nlit > oend - op) {
+            return -1;
+        }
+        memcpy(op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+
+        if (ip == iend) {
+            break; // last sequence has no match
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op - (uint8_t *)dst) {
+            return -1;
+        }
+
+        int mlen = token & 15;
+        if (mlen == 15) {
+            int ext = lz_get_length(&ip, iend);
+            if (ext < 0) {
+                return -1;
+            }
+            mlen += ext;
+        }
+        mlen += LZ_MIN_MATCH;
+        if (mlen > oend - op) {
+            return -1;
+        }
+
+        /* byte copy: the match may overlap the bytes it produces */
+        const uint8_t *mp = op - offset;
+        for (int i = 0; i < mlen; i++) {
+            op[i] = mp[i];
+        }
+        op += mlen;
+    }
+
+    return (int)(op - (uint8_t *)dst);
+}
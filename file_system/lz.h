@@ -0,0 +1,9 @@
+#ifndef INCLUDE_LZ_H
+#define INCLUDE_LZ_H
+
+/* worst-case compressed size of srclen bytes (incompressible input) */
+#define LZ_BOUND(srclen) ((srclen) + (srclen) / 255 + 16)
+
+int lz_compress(const void *src, int srclen, void *dst, int dstcap);
+int lz_decompress(const void *src, int srclen, void *dst, int dstcap);
+#endif /* INCLUDE_LZ_H */
@@ -0,0 +1,276 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "disk.h"
+#include "stripe.h"
+
+/*
+ * Striping layer under fs.c.
+ *
+ * Logical block b lives in stripe b / unit, which is stored on member
+ * (b / unit) % ndisks. Every member has a worker thread. A batch from
+ * stripe_readv/stripe_writev is split by member. Each worker merges runs
+ * that are contiguous on its disk and in memory into single
+ * pread/pwrite calls, and the members transfer in parallel.
+ */
+
+#define STRIPE_BATCH 256 // blocks handed to the members at once
+
+struct member
+{
+    int fd;
+    pthread_t thread;
+    /* this member's share of the current batch */
+    int n;
+    int blocks[STRIPE_BATCH]; // member-local block numbers
+    char *bufs[STRIPE_BATCH];
+};
+
+static struct member members[STRIPE_MAX_DISKS];
+static int ndisks = 0;
+static int unit = 1;
+
+/* batch hand-off between the caller and the member workers */
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t io_done = PTHREAD_COND_INITIALIZER;
+static unsigned io_gen = 0;
+static int io_pending = 0;
+static bool io_write = false;
+static bool io_error = false;
+static bool io_stop = false;
+
+static int member_blocks(int ndisks_, int unit_)
+{
+    int stripes = (DISK_BLOCKS + unit_ - 1) / unit_;
+    return (stripes + ndisks_ - 1) / ndisks_ * unit_;
+}
+
+static void stripe_map(int block, int *disk, int *mblock)
+{
+    int s = block / unit;
+    *disk = s % ndisks;
+    *mblock = (s / ndisks) * unit + block % unit;
+}
+
+/* transfer this member's share of the batch, one syscall per contiguous run */
+static int member_io(struct member *m, bool write)
+{
+    for (int i = 0; i < m->n;) {
+        int j = i + 1;
+        while (j < m->n && m->blocks[j] == m->blocks[j - 1] + 1 && m->bufs[j] == m->bufs[j - 1] + BLOCK_SIZE) {
+            j++;
+        }
+
+        size_t len = (size_t)(j - i) * BLOCK_SIZE;
+        off_t off = (off_t)m->blocks[i] * BLOCK_SIZE;
+        ssize_t rc = write ? pwrite(m->fd, m->bufs[i], len, off) : pread(m->fd, m->bufs[i], len, off);
+        if (rc != (ssize_t)len) {
+            return -1;
+        }
+        i = j;
+    }
+    return 0;
+}
+
+static void *member_worker(void *arg)
+{
+    struct member *m = arg;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&io_lock);
+    for (;;) {
+        while (io_gen == seen && !io_stop) {
+            pthread_cond_wait(&io_start, &io_lock);
+        }
+        if (io_stop) {
+            break;
+        }
+        seen = io_gen;
+        bool write = io_write;
+        pthread_mutex_unlock(&io_lock);
+
+        int rc = member_io(m, write);
+
+        pthread_mutex_lock(&io_lock);
+        if (rc == -1) {
+            io_error = true;
+        }
+        if (--io_pending == 0) {
+            pthread_cond_signal(&io_done);
+        }
+    }
+    pthread_mutex_unlock(&io_lock);
+    return NULL;
+}
+
+/* creates (sparse) member images sized for a striped device of DISK_BLOCKS blocks */
+int stripe_make(const char **names, int ndisks_, int unit_)
+{
+    if (ndisks_ < 1 || ndisks_ > STRIPE_MAX_DISKS || unit_ < 1) {
+        return -1;
+    }
+
+    for (int i = 0; i < ndisks_; i++) {
+        int fd = open(names[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            return -1;
+        }
+        if (ftruncate(fd, (off_t)member_blocks(ndisks_, unit_) * BLOCK_SIZE) == -1) {
+            close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+/* opens the member images and starts one worker per member */
+int stripe_open(const char **names, int ndisks_, int unit_)
+{
+    if (ndisks != 0 || ndisks_ < 1 || ndisks_ > STRIPE_MAX_DISKS || unit_ < 1) {
+        return -1;
+    }
+
+    for (int i = 0; i < ndisks_; i++) {
+        members[i].fd = open(names[i], O_RDWR);
+        if (members[i].fd == -1) {
+            while (i-- > 0) {
+                close(members[i].fd);
+            }
+            return -1;
+        }
+    }
+
+    ndisks = ndisks_;
+    unit = unit_;
+    io_stop = false;
+    io_gen = 0; // workers start having seen batch 0, whatever the last open left
+    for (int i = 0; i < ndisks; i++) {
+        members[i].n = 0;
+        if (pthread_create(&members[i].thread, NULL, member_worker, &members[i]) != 0) {
+            /* stop the workers already started */
+            pthread_mutex_lock(&io_lock);
+            io_stop = true;
+            pthread_cond_broadcast(&io_start);
+            pthread_mutex_unlock(&io_lock);
+            for (int j = 0; j < i; j++) {
+                pthread_join(members[j].thread, NULL);
+            }
+            for (int j = 0; j < ndisks; j++) {
+                close(members[j].fd);
+            }
+            ndisks = 0;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* changes the stripe unit, e.g. to the one recorded in the superblock
+(block 0 maps to member 0 for any unit) */
+int stripe_set_unit(int unit_)
+{
+    if (ndisks == 0 || unit_ < 1) {
+        return -1;
+    }
+    unit = unit_;
+    return 0;
+}
+
+int stripe_close()
+{
+    if (ndisks == 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&io_lock);
+    io_stop = true;
+    pthread_cond_broadcast(&io_start);
+    pthread_mutex_unlock(&io_lock);
+
+    for (int i = 0; i < ndisks; i++) {
+        pthread_join(members[i].thread, NULL);
+        close(members[i].fd);
+    }
+    ndisks = 0;
+    return 0;
+}
+
+/* split n blocks across the members and run the transfer */
+static int stripe_batch(int n, const int *blocks, char *const *bufs, bool write)
+{
+    if (n == 0) {
+        return 0;
+    }
+    for (int done = 0; done < n; done += STRIPE_BATCH) {
+        int count = n - done < STRIPE_BATCH ? n - done : STRIPE_BATCH;
+        int busy = 0, last = 0;
+
+        for (int i = 0; i < ndisks; i++) {
+            members[i].n = 0;
+        }
+        for (int i = done; i < done + count; i++) {
+            int disk, mblock;
+            if (blocks[i] < 0 || blocks[i] >= DISK_BLOCKS) {
+                return -1;
+            }
+            stripe_map(blocks[i], &disk, &mblock);
+            struct member *m = &members[disk];
+            m->blocks[m->n] = mblock;
+            m->bufs[m->n] = bufs[i];
+            busy += m->n++ == 0;
+            last = disk;
+        }
+
+        /* a share for a single member is not worth a thread hand-off */
+        if (busy == 1) {
+            if (member_io(&members[last], write) == -1) {
+                return -1;
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&io_lock);
+        io_write = write;
+        io_error = false;
+        io_pending = ndisks;
+        io_gen++;
+        pthread_cond_broadcast(&io_start);
+        while (io_pending > 0) {
+            pthread_cond_wait(&io_done, &io_lock);
+        }
+        bool failed = io_error;
+        pthread_mutex_unlock(&io_lock);
+
+        if (failed) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int stripe_readv(int n, const int *blocks, char *const *bufs)
+{
+    return stripe_batch(n, blocks, bufs, false);
+}
+
+int stripe_writev(int n, const int *blocks, char *const *bufs)
+{
+    return stripe_batch(n, blocks, bufs, true);
+}
+
+int stripe_read(int block, void *buf)
+{
+    char *bufs[1] = {buf};
+    return stripe_batch(1, &block, bufs, false);
+}
+
+int stripe_write(int block, const void *buf)
+{
+    char *bufs[1] = {(char *)buf};
+    return stripe_batch(1, &block, bufs, true);
+}
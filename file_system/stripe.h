@@ -0,0 +1,18 @@
+#ifndef INCLUDE_STRIPE_H
+#define INCLUDE_STRIPE_H
+
+/* presents several disk image files as one device of DISK_BLOCKS blocks;
+consecutive runs of unit blocks go to consecutive member disks */
+
+#define STRIPE_MAX_DISKS 16
+
+int stripe_make(const char **names, int ndisks, int unit);
+int stripe_open(const char **names, int ndisks, int unit);
+int stripe_set_unit(int unit);
+int stripe_close();
+
+int stripe_read(int block, void *buf);
+int stripe_write(int block, const void *buf);
+int stripe_readv(int n, const int *blocks, char *const *bufs);
+int stripe_writev(int n, const int *blocks, char *const *bufs);
+#endif /* INCLUDE_STRIPE_H */
@@ -0,0 +1,82 @@
+/* fsck time on a full volume, by worker count.
+ *
+ * Fills a 32 MB volume with 1 MB files, some compressed and some clones,
+ * until no block is left, takes a snapshot, then runs ./fsck with 1 to
+ * MAX_WORKERS workers and reports the best of RUNS times fsck measures
+ * itself (from reading the metadata to the verdict, without process start).
+ * The whole volume should check in a few milliseconds.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs.h"
+#include "fs_format.h"
+
+#define MAX_WORKERS 8
+#define RUNS 5
+
+static char data[MAX_FILESIZE];
+
+/* the milliseconds fsck -j workers reports, -1 if it does not check clean */
+static double run(int workers)
+{
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "./fsck -j %d testfs", workers);
+    FILE *out = popen(cmd, "r");
+    char line[256] = "";
+    if (out == NULL || fgets(line, sizeof(line), out) == NULL) {
+        return -1;
+    }
+    int status = pclose(out);
+    char *ms = strrchr(line, ',');
+    return status == 0 && ms != NULL ? atof(ms + 1) : -1;
+}
+
+int main(void)
+{
+    for (int i = 0; i < MAX_FILESIZE; i++) {
+        data[i] = (char)(i * 7 + i / 5000);
+    }
+
+    if (make_fs("testfs") == -1 || mount_fs("testfs") == -1) {
+        return 1;
+    }
+    int files = 0;
+    for (int full = 0; !full && files < MAX_FILES - 8; files++) {
+        char name[16];
+        snprintf(name, sizeof(name), "f%d", files);
+        fs_create(name);
+        int fd = fs_open(name);
+        fs_set_compressed(fd, files % 4 == 3);
+        full = fs_write(fd, data, MAX_FILESIZE) < MAX_FILESIZE;
+        fs_close(fd);
+        if (files % 8 == 0) {
+            char clone[16];
+            snprintf(clone, sizeof(clone), "c%d", files);
+            fs_clone_file(name, clone);
+        }
+    }
+    fs_snapshot();
+    struct fs_stats st;
+    fs_get_stats(&st);
+    printf("%d files, %d/%d data blocks used\n", files, st.data_blocks - st.free_blocks, st.data_blocks);
+    umount_fs("testfs");
+
+    printf("workers  fsck ms\n");
+    for (int w = 1; w <= MAX_WORKERS; w *= 2) {
+        double best = -1;
+        for (int r = 0; r < RUNS; r++) {
+            double ms = run(w);
+            if (ms < 0) {
+                printf("fsck -j %d did not check clean\n", w);
+                return 1;
+            }
+            if (best < 0 || ms < best) {
+                best = ms;
+            }
+        }
+        printf("%7d  %7.3f\n", w, best);
+    }
+    return 0;
+}
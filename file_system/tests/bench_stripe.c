@@ -0,0 +1,114 @@
+/* Sequential throughput of a striped volume, by member count.
+ *
+ * Writes FILES files of 1 MB, unmounts, drops the member images from the
+ * page cache (fsync and POSIX_FADV_DONTNEED) and reads the files back, on a
+ * single disk with mount_fs and on 1, 2 and 4 striped members. Each member
+ * is read by its own worker, so read throughput should grow with the member
+ * count as long as the members are on devices that work in parallel.
+ * Writes mostly land in the page cache and measure the layer's overhead.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "fs_format.h"
+
+#define FILES 24
+#define UNIT 16
+#define MAX_DISKS 4
+
+static const char *names[MAX_DISKS] = {"testfs0", "testfs1", "testfs2", "testfs3"};
+static char data[MAX_FILESIZE], buf[MAX_FILESIZE];
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int mount_disks(int ndisks)
+{
+    return ndisks == 0 ? mount_fs("testfs") : mount_fs_striped(names, ndisks);
+}
+
+static void drop_cache(const char *name)
+{
+    int fd = open(name, O_RDONLY);
+    if (fd != -1) {
+        fsync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/* MB/s written and read back on ndisks members, 0 for a single disk */
+static int run(int ndisks, double *write_mbs, double *read_mbs)
+{
+    if ((ndisks == 0 ? make_fs("testfs") : make_fs_striped(names, ndisks, UNIT)) == -1 ||
+        mount_disks(ndisks) == -1) {
+        return -1;
+    }
+    double start = now();
+    for (int i = 0; i < FILES; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "f%d", i);
+        fs_create(name);
+        int fd = fs_open(name);
+        if (fs_write(fd, data, MAX_FILESIZE) != MAX_FILESIZE) {
+            return -1;
+        }
+        fs_close(fd);
+    }
+    umount_fs("testfs");
+    *write_mbs = FILES / (now() - start);
+
+    if (ndisks == 0) {
+        drop_cache("testfs");
+    }
+    for (int i = 0; i < ndisks; i++) {
+        drop_cache(names[i]);
+    }
+
+    mount_disks(ndisks);
+    start = now();
+    for (int i = 0; i < FILES; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "f%d", i);
+        int fd = fs_open(name);
+        if (fs_read(fd, buf, MAX_FILESIZE) != MAX_FILESIZE || memcmp(buf, data, MAX_FILESIZE) != 0) {
+            return -1;
+        }
+        fs_close(fd);
+    }
+    *read_mbs = FILES / (now() - start);
+    umount_fs("testfs");
+    return 0;
+}
+
+int main(void)
+{
+    for (int i = 0; i < MAX_FILESIZE; i++) {
+        data[i] = (char)(i * 13 + i / 4096);
+    }
+
+    printf("disks  write MB/s  read MB/s (cold)\n");
+    for (int ndisks = 0; ndisks <= MAX_DISKS; ndisks = ndisks == 0 ? 1 : ndisks * 2) {
+        double write_mbs, read_mbs;
+        if (run(ndisks, &write_mbs, &read_mbs) == -1) {
+            printf("%d disks failed\n", ndisks);
+            return 1;
+        }
+        char label[8];
+        snprintf(label, sizeof(label), ndisks == 0 ? "plain" : "%d", ndisks);
+        printf("%5s  %10.0f  %9.0f\n", label, write_mbs, read_mbs);
+    }
+    unlink("testfs");
+    for (int i = 0; i < MAX_DISKS; i++) {
+        unlink(names[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+/* Clones: a clone shares every block of its source and costs no data blocks;
+ * a write to either side copies only the block it touches and leaves the
+ * other side as it was, for plain and compressed files; deleting both frees
+ * every block once and clones survive a remount.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs.h"
+#include "fs_format.h"
+
+#define check(cond) do { if (!(cond)) { \
+    printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+#define SIZE (300 * 1024)
+
+static char data[SIZE], changed[SIZE], buf[MAX_FILESIZE];
+
+static struct fs_stats stats(void)
+{
+    struct fs_stats st;
+    check(fs_get_stats(&st) == 0);
+    return st;
+}
+
+static void read_back(const char *name, const char *expected, int len)
+{
+    int fd = fs_open(name);
+    check(fd >= 0);
+    check(fs_get_filesize(fd) == len);
+    check(fs_read(fd, buf, sizeof(buf)) == len);
+    check(memcmp(buf, expected, len) == 0);
+    check(fs_close(fd) == 0);
+}
+
+static void overwrite(const char *name, int offset, const char *bytes, int len)
+{
+    int fd = fs_open(name);
+    check(fd >= 0);
+    check(fs_lseek(fd, offset) == 0);
+    check(fs_write(fd, (void *)bytes, len) == len);
+    check(fs_close(fd) == 0);
+}
+
+static void clone_and_write(int compressed)
+{
+    check(fs_create("src") == 0);
+    int fd = fs_open("src");
+    check(fs_set_compressed(fd, compressed) == 0);
+    check(fs_write(fd, data, SIZE) == SIZE);
+    check(fs_close(fd) == 0);
+
+    // a clone costs metadata only
+    int before = stats().free_blocks;
+    check(fs_clone_file("src", "dst") == 0);
+    check(stats().free_blocks == before);
+    check(fs_clone_file("src", "dst") == -1);
+    read_back("dst", data, SIZE);
+
+    // a one-byte write copies one block (or one chunk) of the clone
+    memcpy(changed, data, SIZE);
+    changed[BLOCK_SIZE + 1] = 'X';
+    overwrite("dst", BLOCK_SIZE + 1, "X", 1);
+    int copied = before - stats().free_blocks;
+    check(compressed ? copied >= 1 && copied <= CHUNK_BLOCKS : copied == 1);
+    read_back("dst", changed, SIZE);
+    read_back("src", data, SIZE);
+
+    // and the source can be written without touching the clone
+    overwrite("src", SIZE - 10, "YYYYYYYYYY", 10);
+    char src_now[SIZE];
+    memcpy(src_now, data, SIZE);
+    memcpy(src_now + SIZE - 10, "YYYYYYYYYY", 10);
+    read_back("src", src_now, SIZE);
+    read_back("dst", changed, SIZE);
+
+    check(umount_fs("testfs") == 0);
+    check(mount_fs("testfs") == 0);
+    read_back("src", src_now, SIZE);
+    read_back("dst", changed, SIZE);
+
+    // the last owner of a shared block frees it
+    check(fs_delete("src") == 0);
+    read_back("dst", changed, SIZE);
+    check(fs_delete("dst") == 0);
+    struct fs_stats st = stats();
+    check(st.free_blocks == st.data_blocks);
+    check(st.shared_refs == 0);
+}
+
+int main(void)
+{
+    for (int i = 0; i < SIZE; i++) {
+        data[i] = (char)(i * 7 + i / 4096);
+    }
+
+    check(make_fs("testfs") == 0);
+    check(mount_fs("testfs") == 0);
+    check(fs_clone_file("missing", "dst") == -1);
+    clone_and_write(0);
+    clone_and_write(1);
+    check(umount_fs("testfs") == 0);
+    return 0;
+}
@@ -0,0 +1,142 @@
+/* Compressed files: compressible and random data read back as written, also
+ * after overwrites, truncation and a remount; compressible chunks take fewer
+ * blocks and chunks that do not compress are stored raw (CHUNK_RAW).
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "fs_format.h"
+
+#define check(cond) do { if (!(cond)) { \
+    printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+static char text[MAX_FILESIZE], noise[MAX_FILESIZE], buf[MAX_FILESIZE];
+
+static int free_blocks(void)
+{
+    struct fs_stats st;
+    check(fs_get_stats(&st) == 0);
+    return st.free_blocks;
+}
+
+/* writes data to a new compressed file and returns the blocks it took */
+static int write_file(const char *name, char *data, int len)
+{
+    int before = free_blocks();
+    check(fs_create(name) == 0);
+    int fd = fs_open(name);
+    check(fd >= 0);
+    check(fs_set_compressed(fd, 1) == 0);
+    check(fs_write(fd, data, len) == len);
+    check(fs_close(fd) == 0);
+    return before - free_blocks();
+}
+
+static void read_back(const char *name, const char *data, int len)
+{
+    int fd = fs_open(name);
+    check(fd >= 0);
+    check(fs_get_filesize(fd) == len);
+    memset(buf, 0, sizeof(buf));
+    check(fs_read(fd, buf, sizeof(buf)) == len);
+    check(memcmp(buf, data, len) == 0);
+    check(fs_close(fd) == 0);
+}
+
+/* the inode of name, read from the unmounted image */
+static void image_inode(const char *name, struct inode *in)
+{
+    struct superblock sb;
+    struct dir_entry dir[MAX_FILES];
+    int fd = open("testfs", O_RDONLY);
+    check(fd != -1);
+    check(pread(fd, &sb, sizeof(sb), 0) == sizeof(sb));
+    check(pread(fd, dir, sizeof(dir), (off_t)sb.dir_entry_offset * BLOCK_SIZE) == sizeof(dir));
+    int i = 0;
+    while (i < MAX_FILES && !(dir[i].used && strcmp(dir[i].name, name) == 0)) {
+        i++;
+    }
+    check(i < MAX_FILES);
+    off_t at = (off_t)sb.inode_offset * BLOCK_SIZE + dir[i].inode_num * sizeof(struct inode);
+    check(pread(fd, in, sizeof(*in), at) == sizeof(*in));
+    close(fd);
+}
+
+int main(void)
+{
+    // log-like lines compress well; xorshift output does not compress at all
+    for (int i = 0; i < MAX_FILESIZE; i++) {
+        text[i] = "0123456789 request ok\n"[(i / 3 + i % 7) % 22];
+    }
+    unsigned x = 2463534242u;
+    for (int i = 0; i < MAX_FILESIZE; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        noise[i] = (char)x;
+    }
+
+    check(make_fs("testfs") == 0);
+    check(mount_fs("testfs") == 0);
+
+    // only an empty file can change its mode
+    check(fs_create("plain") == 0);
+    int fd = fs_open("plain");
+    check(fs_write(fd, text, 10) == 10);
+    check(fs_set_compressed(fd, 1) == -1);
+    check(fs_close(fd) == 0);
+
+    int text_blocks = write_file("text", text, MAX_FILESIZE);
+    int noise_blocks = write_file("noise", noise, MAX_FILESIZE);
+    check(text_blocks > 0 && text_blocks <= MAX_FILE_BLOCKS / 4);
+    check(noise_blocks == MAX_FILE_BLOCKS); // raw chunks cost no more than a plain file
+    read_back("text", text, MAX_FILESIZE);
+    read_back("noise", noise, MAX_FILESIZE);
+
+    // overwrites inside a chunk and across chunk boundaries
+    fd = fs_open("text");
+    check(fs_lseek(fd, 5000) == 0);
+    check(fs_write(fd, "HELLO", 5) == 5);
+    memcpy(text + 5000, "HELLO", 5);
+    check(fs_lseek(fd, CHUNK_SIZE - 100) == 0);
+    check(fs_write(fd, noise, 300) == 300);
+    memcpy(text + CHUNK_SIZE - 100, noise, 300);
+    check(fs_close(fd) == 0);
+    read_back("text", text, MAX_FILESIZE);
+
+    // truncation into a chunk, then growing the file again
+    fd = fs_open("noise");
+    check(fs_truncate(fd, 10000) == 0);
+    check(fs_lseek(fd, 10000) == 0);
+    check(fs_write(fd, text, 100) == 100);
+    memcpy(noise + 10000, text, 100);
+    check(fs_close(fd) == 0);
+    read_back("noise", noise, 10100);
+    check(umount_fs("testfs") == 0);
+
+    // on disk: the random chunks are raw, the text chunks are not
+    struct inode in;
+    image_inode("noise", &in);
+    check(in.flags & INODE_COMPRESSED);
+    check(in.chunk_len[0] == (CHUNK_RAW | 10100));
+    image_inode("text", &in);
+    for (int c = 0; c < MAX_CHUNKS; c++) {
+        check(in.chunk_len[c] != 0 && !(in.chunk_len[c] & CHUNK_RAW));
+    }
+
+    check(mount_fs("testfs") == 0);
+    read_back("text", text, MAX_FILESIZE);
+    read_back("noise", noise, 10100);
+    check(fs_delete("text") == 0);
+    check(fs_delete("noise") == 0);
+    check(fs_delete("plain") == 0);
+    struct fs_stats st;
+    check(fs_get_stats(&st) == 0);
+    check(st.free_blocks == st.data_blocks);
+    check(umount_fs("testfs") == 0);
+    return 0;
+}
@@ -0,0 +1,119 @@
+/* Deduplication: full blocks already on disk become references and zero
+ * blocks become holes, counted in fs_get_stats; data reads back as written,
+ * writes to shared blocks copy them, the fingerprint index survives a
+ * remount, and with dedup off nothing is shared.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs.h"
+#include "fs_format.h"
+
+#define check(cond) do { if (!(cond)) { \
+    printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+#define DISTINCT 8 // different blocks in a file
+#define ZEROS 4 // zero blocks in a file
+#define REPEATS 4 // copies of block 0 in a file
+#define BLOCKS (DISTINCT + ZEROS + REPEATS)
+
+static char data[BLOCKS * BLOCK_SIZE], buf[MAX_FILESIZE];
+
+static struct fs_stats stats(void)
+{
+    struct fs_stats st;
+    check(fs_get_stats(&st) == 0);
+    return st;
+}
+
+static void write_file(const char *name, const char *bytes, int len)
+{
+    check(fs_create(name) == 0);
+    int fd = fs_open(name);
+    check(fd >= 0);
+    check(fs_write(fd, (void *)bytes, len) == len);
+    check(fs_close(fd) == 0);
+}
+
+static void read_back(const char *name, const char *expected, int len)
+{
+    int fd = fs_open(name);
+    check(fd >= 0);
+    check(fs_read(fd, buf, sizeof(buf)) == len);
+    check(memcmp(buf, expected, len) == 0);
+    check(fs_close(fd) == 0);
+}
+
+int main(void)
+{
+    // DISTINCT template blocks, then ZEROS zero blocks, then REPEATS of block 0
+    for (int i = 0; i < DISTINCT * BLOCK_SIZE; i++) {
+        data[i] = (char)(i / BLOCK_SIZE + i * 31);
+    }
+    for (int r = 0; r < REPEATS; r++) {
+        memcpy(data + (DISTINCT + ZEROS + r) * BLOCK_SIZE, data, BLOCK_SIZE);
+    }
+
+    check(make_fs("testfs") == 0);
+    check(mount_fs("testfs") == 0);
+    check(fs_set_dedup(1) == 0);
+
+    // within one file: repeats are hits, zero blocks take no space
+    int before = stats().free_blocks;
+    write_file("one", data, sizeof(data));
+    struct fs_stats st = stats();
+    check(st.dedup_hashed == BLOCKS);
+    check(st.dedup_zero == ZEROS);
+    check(st.dedup_hits == REPEATS);
+    check(before - st.free_blocks == DISTINCT);
+    read_back("one", data, sizeof(data));
+
+    // a second file of the same blocks takes none
+    write_file("two", data, sizeof(data));
+    st = stats();
+    check(st.dedup_hits == REPEATS + DISTINCT + REPEATS);
+    check(before - st.free_blocks == DISTINCT);
+    check(st.shared_refs == DISTINCT + 2 * REPEATS);
+    read_back("two", data, sizeof(data));
+
+    // the counters are per mount; the fingerprints are on disk
+    check(umount_fs("testfs") == 0);
+    check(mount_fs("testfs") == 0);
+    st = stats();
+    check(st.dedup_hashed == 0 && st.dedup_hits == 0);
+    check(fs_set_dedup(1) == 0);
+    write_file("three", data, DISTINCT * BLOCK_SIZE);
+    st = stats();
+    check(st.dedup_hits == DISTINCT);
+    check(before - st.free_blocks == DISTINCT);
+
+    // a new block in a shared slot is copied, the others keep the old one
+    char block[BLOCK_SIZE];
+    memset(block, 'n', sizeof(block));
+    int fd = fs_open("two");
+    check(fs_write(fd, block, sizeof(block)) == sizeof(block));
+    check(fs_close(fd) == 0);
+    check(before - stats().free_blocks == DISTINCT + 1);
+    char changed[sizeof(data)];
+    memcpy(changed, data, sizeof(data));
+    memcpy(changed, block, sizeof(block));
+    read_back("two", changed, sizeof(data));
+    read_back("one", data, sizeof(data));
+    read_back("three", data, DISTINCT * BLOCK_SIZE);
+
+    // with dedup off, the same data gets blocks of its own
+    check(fs_set_dedup(0) == 0);
+    int shared = before - stats().free_blocks;
+    write_file("four", data, DISTINCT * BLOCK_SIZE);
+    check(before - stats().free_blocks == shared + DISTINCT);
+
+    check(fs_delete("one") == 0);
+    check(fs_delete("two") == 0);
+    check(fs_delete("three") == 0);
+    check(fs_delete("four") == 0);
+    st = stats();
+    check(st.free_blocks == st.data_blocks);
+    check(umount_fs("testfs") == 0);
+    return 0;
+}
@@ -0,0 +1,133 @@
+/* fsck: a clean volume with plain, compressed, cloned, deduplicated and
+ * snapshot files checks clean on one and several workers; a corrupted
+ * bitmap and corrupted refcounts are found, repaired with -r and then check
+ * clean, and the files read back intact. Runs ./fsck, so make check builds it.
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "fs_format.h"
+
+#define check(cond) do { if (!(cond)) { \
+    printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+#define SIZE (100 * 1024)
+
+static char data[SIZE], buf[MAX_FILESIZE];
+static struct superblock sb;
+
+/* the exit status of fsck with the given options on testfs */
+static int fsck(const char *options)
+{
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "./fsck %s testfs > /dev/null", options);
+    int status = system(cmd);
+    check(status != -1 && WIFEXITED(status));
+    return WEXITSTATUS(status);
+}
+
+static void write_file(const char *name, int compressed)
+{
+    check(fs_create(name) == 0);
+    int fd = fs_open(name);
+    check(fd >= 0);
+    check(fs_set_compressed(fd, compressed) == 0);
+    check(fs_write(fd, data, SIZE) == SIZE);
+    check(fs_close(fd) == 0);
+}
+
+static void read_back(const char *name)
+{
+    int fd = fs_open(name);
+    check(fd >= 0);
+    check(fs_read(fd, buf, sizeof(buf)) == SIZE);
+    check(memcmp(buf, data, SIZE) == 0);
+    check(fs_close(fd) == 0);
+}
+
+/* read or write len bytes at byte offset of block region start of testfs */
+static void image_io(int start, size_t offset, void *bytes, size_t len, int write)
+{
+    int fd = open("testfs", O_RDWR);
+    check(fd != -1);
+    off_t at = (off_t)start * BLOCK_SIZE + offset;
+    check((write ? pwrite(fd, bytes, len, at) : pread(fd, bytes, len, at)) == (ssize_t)len);
+    close(fd);
+}
+
+static void check_repaired(void)
+{
+    check(fsck("") == 4);
+    check(fsck("-r -j 3") == 1);
+    check(fsck("") == 0);
+
+    check(mount_fs("testfs") == 0);
+    const char *names[] = {"plain", "packed", "clone", "dup"};
+    for (int i = 0; i < 4; i++) {
+        read_back(names[i]);
+    }
+    int fd = fs_open_snapshot("plain");
+    check(fs_read(fd, buf, sizeof(buf)) == SIZE);
+    check(fs_close(fd) == 0);
+    check(umount_fs("testfs") == 0);
+}
+
+int main(void)
+{
+    for (int i = 0; i < SIZE; i++) {
+        data[i] = (char)(i % 97 + i / 1000);
+    }
+
+    check(make_fs("testfs") == 0);
+    check(mount_fs("testfs") == 0);
+    write_file("plain", 0);
+    write_file("packed", 1);
+    check(fs_clone_file("plain", "clone") == 0);
+    check(fs_snapshot() == 0);
+    check(fs_set_dedup(1) == 0);
+    write_file("dup", 0);
+    check(umount_fs("testfs") == 0);
+
+    check(fsck("-j 1") == 0);
+    check(fsck("-j 4") == 0);
+    check(fsck("-r") == 0);
+
+    image_io(0, 0, &sb, sizeof(sb), 0);
+    uint8_t bitmap[DISK_BLOCKS / 8];
+    uint16_t refs[DISK_BLOCKS];
+    image_io(sb.block_bitmap_offset, 0, bitmap, sizeof(bitmap), 0);
+    image_io(sb.refcount_offset, 0, refs, sizeof(refs), 0);
+    int first = sb.data_block_offset; // the first block of plain, shared by all but packed
+    check(bitmap[first / 8] & (1 << (first % 8)));
+    check(refs[first] > 1);
+
+    // a used block marked free, a free block marked used
+    uint8_t bad[DISK_BLOCKS / 8];
+    memcpy(bad, bitmap, sizeof(bad));
+    bad[first / 8] &= (uint8_t)~(1 << (first % 8));
+    bad[(DISK_BLOCKS - 1) / 8] |= 0x80;
+    image_io(sb.block_bitmap_offset, 0, bad, sizeof(bad), 1);
+    check_repaired();
+
+    // the repair put the bitmap back as it was
+    image_io(sb.block_bitmap_offset, 0, bad, sizeof(bad), 0);
+    check(memcmp(bad, bitmap, sizeof(bad)) == 0);
+
+    // a shared block with one reference recorded (cross-linked), and a block
+    // with more than it has
+    uint16_t bad_refs[DISK_BLOCKS];
+    memcpy(bad_refs, refs, sizeof(bad_refs));
+    bad_refs[first] = 1;
+    bad_refs[first + 1] += 5;
+    image_io(sb.refcount_offset, 0, bad_refs, sizeof(bad_refs), 1);
+    check_repaired();
+    image_io(sb.refcount_offset, 0, bad_refs, sizeof(bad_refs), 0);
+    check(memcmp(bad_refs, refs, sizeof(refs)) == 0);
+    return 0;
+}
@@ -0,0 +1,106 @@
+/* Snapshots: a snapshot keeps the files as they were when it was taken while
+ * the live files are written, truncated and deleted, is read-only, survives
+ * a remount, and fs_drop_snapshot frees the blocks only it still referenced.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs.h"
+#include "fs_format.h"
+
+#define check(cond) do { if (!(cond)) { \
+    printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+#define SIZE (200 * 1024)
+
+static char a[SIZE], b[SIZE], buf[MAX_FILESIZE];
+
+static int free_blocks(void)
+{
+    struct fs_stats st;
+    check(fs_get_stats(&st) == 0);
+    return st.free_blocks;
+}
+
+static void write_file(const char *name, const char *data, int len)
+{
+    check(fs_create(name) == 0);
+    int fd = fs_open(name);
+    check(fd >= 0);
+    check(fs_write(fd, (void *)data, len) == len);
+    check(fs_close(fd) == 0);
+}
+
+static void check_snapshot(const char *name, const char *expected, int len)
+{
+    int fd = fs_open_snapshot(name);
+    check(fd >= 0);
+    check(fs_get_filesize(fd) == len);
+    check(fs_read(fd, buf, sizeof(buf)) == len);
+    check(memcmp(buf, expected, len) == 0);
+    check(fs_close(fd) == 0);
+}
+
+int main(void)
+{
+    for (int i = 0; i < SIZE; i++) {
+        a[i] = (char)(i * 13);
+        b[i] = (char)(i / 3);
+    }
+
+    check(make_fs("testfs") == 0);
+    check(mount_fs("testfs") == 0);
+    check(fs_open_snapshot("a") == -1);
+    write_file("a", a, SIZE);
+    write_file("b", b, SIZE);
+
+    // taking a snapshot copies no data
+    int before = free_blocks();
+    check(fs_snapshot() == 0);
+    check(free_blocks() == before);
+
+    // change every live file: rewrite a, truncate b, delete a new c
+    int fd = fs_open("a");
+    check(fs_write(fd, b, SIZE) == SIZE);
+    check(fs_close(fd) == 0);
+    fd = fs_open("b");
+    check(fs_truncate(fd, 100) == 0);
+    check(fs_close(fd) == 0);
+    check(fs_delete("b") == 0);
+    write_file("c", a, 10);
+    check(fs_open_snapshot("c") == -1);
+
+    check_snapshot("a", a, SIZE);
+    check_snapshot("b", b, SIZE);
+
+    // snapshot files are read-only
+    fd = fs_open_snapshot("a");
+    check(fs_write(fd, a, 1) == -1);
+    check(fs_truncate(fd, 0) == -1);
+    check(fs_close(fd) == 0);
+
+    check(umount_fs("testfs") == 0);
+    check(mount_fs("testfs") == 0);
+    check_snapshot("a", a, SIZE);
+    check_snapshot("b", b, SIZE);
+
+    // not while a snapshot file is open
+    fd = fs_open_snapshot("b");
+    check(fs_drop_snapshot() == -1);
+    check(fs_close(fd) == 0);
+
+    // dropping it frees the old blocks of a and all of b
+    before = free_blocks();
+    check(fs_drop_snapshot() == 0);
+    check(free_blocks() == before + 2 * SIZE / BLOCK_SIZE);
+    check(fs_open_snapshot("a") == -1);
+
+    check(fs_delete("a") == 0);
+    check(fs_delete("c") == 0);
+    struct fs_stats st;
+    check(fs_get_stats(&st) == 0);
+    check(st.free_blocks == st.data_blocks);
+    check(umount_fs("testfs") == 0);
+    return 0;
+}
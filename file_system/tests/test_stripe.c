@@ -0,0 +1,119 @@
+/* Striping: a volume made over several member images mounts only with all
+ * of them, keeps plain and compressed files across umount/mount cycles, and
+ * lays logical blocks out round-robin in runs of the stripe unit; fsck
+ * refuses a single member.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "fs_format.h"
+
+#define check(cond) do { if (!(cond)) { \
+    printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+#define DISKS 4
+#define UNIT 2
+#define CYCLES 10
+#define ODD_SIZE (300 * 1024 + 123)
+
+static const char *names[DISKS] = {"testfs0", "testfs1", "testfs2", "testfs3"};
+static char data[MAX_FILESIZE], buf[MAX_FILESIZE];
+
+static void write_file(const char *name, int compressed, int offset, int len)
+{
+    int fd = fs_open(name);
+    if (fd == -1) {
+        check(fs_create(name) == 0);
+        fd = fs_open(name);
+        check(fs_set_compressed(fd, compressed) == 0);
+    }
+    check(fs_lseek(fd, offset) == 0);
+    check(fs_write(fd, data + offset, len) == len);
+    check(fs_close(fd) == 0);
+}
+
+static void read_back(const char *name, int len)
+{
+    int fd = fs_open(name);
+    check(fd >= 0);
+    check(fs_read(fd, buf, sizeof(buf)) == len);
+    check(memcmp(buf, data, len) == 0);
+    check(fs_close(fd) == 0);
+}
+
+/* block mblock of member disk */
+static void member_block(int disk, int mblock, void *block)
+{
+    int fd = open(names[disk], O_RDONLY);
+    check(fd != -1);
+    check(pread(fd, block, BLOCK_SIZE, (off_t)mblock * BLOCK_SIZE) == BLOCK_SIZE);
+    close(fd);
+}
+
+int main(void)
+{
+    for (int i = 0; i < MAX_FILESIZE; i++) {
+        data[i] = (char)(i * 11 + i / 7000);
+    }
+
+    check(make_fs_striped(names, DISKS, UNIT) == 0);
+    check(mount_fs_striped(names, DISKS - 1) == -1);
+    const char *missing[DISKS] = {"testfs0", "testfs1", "testfs2", "testfs-none"};
+    check(mount_fs_striped(missing, DISKS) == -1);
+
+    // every cycle rewrites part of the files and checks all of them
+    for (int c = 0; c < CYCLES; c++) {
+        check(mount_fs_striped(names, DISKS) == 0);
+        if (c == 0) {
+            write_file("plain", 0, 0, MAX_FILESIZE);
+            write_file("odd", 0, 0, ODD_SIZE);
+            write_file("packed", 1, 0, MAX_FILESIZE);
+        }
+        else {
+            data[c * 30000] ^= 1;
+            write_file("plain", 0, c * 30000, 1);
+            write_file("packed", 0, c * 30000, 1);
+            write_file("odd", 0, c * 30000 - BLOCK_SIZE, BLOCK_SIZE * 2);
+        }
+        read_back("plain", MAX_FILESIZE);
+        read_back("odd", ODD_SIZE);
+        read_back("packed", MAX_FILESIZE);
+        check(umount_fs(NULL) == 0);
+    }
+
+    // logical block b is block (b / UNIT / DISKS) * UNIT + b % UNIT of member
+    // (b / UNIT) % DISKS: the superblock is at the start of member 0, and
+    // block UNIT * DISKS + 1 of the volume is block UNIT + 1 of member 0
+    struct superblock sb;
+    char block[BLOCK_SIZE];
+    member_block(0, 0, block);
+    memcpy(&sb, block, sizeof(sb));
+    check(sb.stripe_disks == DISKS && sb.stripe_unit == UNIT);
+
+    check(mount_fs_striped(names, DISKS) == 0);
+    int fd = fs_open("plain");
+    check(fs_read(fd, buf, sizeof(buf)) == MAX_FILESIZE);
+    check(fs_close(fd) == 0);
+    check(umount_fs(NULL) == 0);
+    int found = 0;
+    for (int b = sb.data_block_offset; b < DISK_BLOCKS && !found; b++) {
+        int s = b / UNIT;
+        member_block(s % DISKS, (s / DISKS) * UNIT + b % UNIT, block);
+        found = memcmp(block, data, BLOCK_SIZE) == 0; // the first block of plain
+    }
+    check(found);
+
+    // a member alone is not a volume fsck can check
+    int status = system("./fsck testfs0 > /dev/null 2>&1");
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 8);
+
+    for (int i = 0; i < DISKS; i++) {
+        unlink(names[i]);
+    }
+    return 0;
+}
@@ -7,6 +7,7 @@
 #include <stddef.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -17,6 +18,9 @@
 /* Your stack should be this many bytes in size */
 #define THREAD_STACK_SIZE 32767
 
+/* Free stacks kept for reuse by pthread_create, the rest are unmapped */
+#define STACK_POOL_MAX 64
+
 /* Number of microseconds between scheduling events */
 #define SCHEDULER_INTERVAL_USECS (50 * 1000)
 
@@ -25,6 +29,13 @@
 
 /* Extracted from private libc headers. These are not part of the public
  * interface for jmp_buf.
+ *
+ * This single-threaded scheduler keeps switching with setjmp/longjmp and
+ * starting threads through ptr_mangle and start_thunk. The assembly
+ * context_switch, which saves only the callee-saved registers, is in
+ * thread_synchronization/ec440threads.h: that runtime, with its workers and
+ * its scheduler lock held across a switch, is where the scheduler work
+ * continues.
  */
 #define JB_RBX 0
 #define JB_RBP 1
@@ -57,7 +68,9 @@ struct thread_control_block {
 	/* TODO: add information about the status (e.g., use enum thread_status) */
 	enum thread_status status;
 	/* Add other information you need to manage this thread */
-	struct thread_control_block* next; 
+	struct thread_control_block* next; // link in the ready queue
+	void *(*start_routine)(void *); // what a new thread runs, with arg
+	void* arg;
 };
 
 /* Declare global variables here */
@@ -67,30 +80,105 @@ typedef struct {
 	struct thread_control_block* head;
 	struct thread_control_block* tail;
 }Queue;
+/* only TS_READY threads are queued: the running thread is off the queue
+and blocked/exited threads are never put back, so picking the next thread is O(1) */
 Queue* thread_queue;
 
-/* insert a TCB to the circular list/queue of available runnable threads */
+/* SIGALRM is blocked while the ready queue changes and across a switch: a
+tick in the middle would re-enter schedule(). The thread switched to unblocks
+it once it runs, in schedule() or thread_start(). */
+static sigset_t alarm_set;
+
+static void alarm_block()
+{
+	sigprocmask(SIG_BLOCK, &alarm_set, NULL);
+}
+
+static void alarm_unblock()
+{
+	sigprocmask(SIG_UNBLOCK, &alarm_set, NULL);
+}
+
+/* Thread stacks are page-aligned mappings with a PROT_NONE guard page below
+them, kept in a pool linked through their first word. An exited thread is
+left as the zombie and released by the thread that runs next, once nothing
+runs on its stack any more. They are all THREAD_STACK_SIZE: stacks that
+grow on demand up to a pthread_attr_t size need a SIGSEGV handler on an
+alternate stack, which only thread_synchronization has. */
+static size_t page_size;
+static size_t stack_size; // THREAD_STACK_SIZE rounded up to whole pages
+static char* stack_pool;
+static int stack_pool_count;
+static struct thread_control_block* zombie;
+
+/* take a stack from the pool or map a new one, NULL if out of memory */
+static char* stack_alloc()
+{
+	if (stack_pool != NULL) {
+		char* stack = stack_pool;
+		stack_pool = *(char**)stack;
+		stack_pool_count--;
+		return stack;
+	}
+
+	char* map = mmap(NULL, page_size + stack_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	// an overflow runs into the guard page and faults instead of corrupting memory
+	if (mprotect(map, page_size, PROT_NONE) == -1) {
+		munmap(map, page_size + stack_size);
+		return NULL;
+	}
+	return map + page_size;
+}
+
+/* return a stack that is no longer in use to the pool */
+static void stack_free(char* stack)
+{
+	if (stack_pool_count >= STACK_POOL_MAX) {
+		munmap(stack - page_size, page_size + stack_size);
+		return;
+	}
+	*(char**)stack = stack_pool;
+	stack_pool = stack;
+	stack_pool_count++;
+}
+
+/* release the thread that exited before the switch to the running one */
+static void reap()
+{
+	if (zombie != NULL) {
+		stack_free(zombie->stack);
+		free(zombie);
+		zombie = NULL;
+	}
+}
+
+/* append a TCB to the tail of the ready queue */
 void queue_insert(struct thread_control_block* new_thread) {
+	new_thread->next = NULL;
 	if(thread_queue->head == NULL) {
 		thread_queue->head = new_thread;
-		thread_queue->tail = new_thread;
-		//new_thread->next = thread_queue->head;
 	}
 	else {
 		thread_queue->tail->next = new_thread;
-		thread_queue->tail = new_thread;
-		thread_queue->tail->next = thread_queue->head;
 	}
+	thread_queue->tail = new_thread;
 }
 
-/* determine which is the next thread to run */
-struct thread_control_block* get_next_thread() {
-	if(curr_thread->next == NULL) {
-		return curr_thread;
-	}
-	else {
-		return curr_thread->next;
+/* take the TCB at the head of the ready queue, NULL if it is empty */
+struct thread_control_block* queue_remove() {
+	struct thread_control_block* t = thread_queue->head;
+	if(t != NULL) {
+		thread_queue->head = t->next;
+		if(thread_queue->head == NULL) {
+			thread_queue->tail = NULL;
+		}
+		t->next = NULL;
 	}
+	return t;
 }
 
 static void schedule(int signal)
@@ -102,27 +190,41 @@ static void schedule(int signal)
 	 * 3. Switch to the next thread (use longjmp on that thread's jmp_buf)
 	 */
 
+	// the running thread goes to the back of the ready queue
+	alarm_block();
+	curr_thread->status = TS_READY;
+	queue_insert(curr_thread);
+	struct thread_control_block* next = queue_remove();
+	if (next == curr_thread) {
+		// nothing else to run
+		curr_thread->status = TS_RUNNING;
+		alarm_unblock();
+		return;
+	}
+
 	// update curr_thread's jmp_buf
 	if (!setjmp(curr_thread->env)) {
-		if(curr_thread->status == TS_RUNNING) {
-			curr_thread->status = TS_READY;
-		}
-		for (int i = 0; i <= MAX_THREADS; i++) {
-			curr_thread = get_next_thread();
-			if (curr_thread->status == TS_READY) {
-				// activate the next read thread
-				curr_thread->status = TS_RUNNING;
-				longjmp(curr_thread->env, 1);
-				break;
-			}
-		}
+		// activate the next ready thread
+		curr_thread = next;
+		curr_thread->status = TS_RUNNING;
+		longjmp(curr_thread->env, 1);
 	}
 	else { // thread called longjmp and is now running
 		curr_thread->status = TS_RUNNING;
+		reap();
+		alarm_unblock();
 	}
 
 }
 
+/* the first function of a new thread, switched to with SIGALRM blocked */
+static void thread_start(struct thread_control_block* t)
+{
+	reap();
+	alarm_unblock();
+	pthread_exit(t->start_routine(t->arg));
+}
+
 static void scheduler_init()
 {
 	/* TODO: do everything that is needed to initialize your scheduler. For example:
@@ -136,6 +238,8 @@ static void scheduler_init()
 
 	// initialize global variables
 	thread_id_count = 0;
+	page_size = (size_t)sysconf(_SC_PAGESIZE);
+	stack_size = (THREAD_STACK_SIZE + page_size - 1) & ~(page_size - 1);
 	curr_thread = (struct thread_control_block*)malloc(sizeof(struct thread_control_block));
 	thread_queue = (Queue*)malloc(sizeof(Queue));
 	thread_queue->head = NULL;
@@ -144,11 +248,13 @@ static void scheduler_init()
 	// create tcb for main thread and add to runnnable thread queue
 	struct thread_control_block* main_thread = (struct thread_control_block*)malloc(sizeof(struct thread_control_block));
 	main_thread->id = thread_id_count;
-	main_thread->status = TS_READY;
-	queue_insert(main_thread);
+	main_thread->stack = NULL;
+	main_thread->status = TS_RUNNING;
 	curr_thread = main_thread;
 
 	// set up the timer to call schedule()
+	sigemptyset(&alarm_set);
+	sigaddset(&alarm_set, SIGALRM);
 	struct sigaction act;
 	sigemptyset(&act.sa_mask);
 	act.sa_flags = SA_NODEFER;
@@ -215,15 +321,25 @@ int pthread_create(
 	*/
 
 	struct thread_control_block* my_thread = (struct thread_control_block*)malloc(sizeof(struct thread_control_block));
+	if (my_thread == NULL) {
+		return EAGAIN;
+	}
 	char* sp;
-	
-	// set the thread id 
+
+	// create the stack and assign a stack pointer sp; the pool is shared
+	// with reap(), which runs at ticks
+	alarm_block();
+	my_thread->stack = stack_alloc();
+	alarm_unblock();
+	if (my_thread->stack == NULL) {
+		free(my_thread);
+		return EAGAIN;
+	}
+	sp = my_thread->stack + stack_size;
+
+	// set the thread id
 	thread_id_count += 1;
 	my_thread->id = thread_id_count;
-
-	// create the stack and assign a stack pointer sp
-	my_thread->stack = (char*)malloc(THREAD_STACK_SIZE);
-	sp = my_thread->stack + THREAD_STACK_SIZE;
 	unsigned long int exit_addr = (unsigned long int)pthread_exit;
 	memcpy(sp - ADDRESS_SIZE, &exit_addr, ADDRESS_SIZE);
 	sp -= ADDRESS_SIZE;
@@ -231,13 +347,17 @@ int pthread_create(
 	// assign my_thread registers using setjmp 
 	setjmp(my_thread->env);
 	my_thread->env[0].__jmpbuf[JB_PC] = ptr_mangle((unsigned long int)start_thunk);
-	my_thread->env[0].__jmpbuf[JB_R12] = (unsigned long int)start_routine;
-	my_thread->env[0].__jmpbuf[JB_R13] = (unsigned long int)arg;
+	my_thread->start_routine = start_routine;
+	my_thread->arg = arg;
+	my_thread->env[0].__jmpbuf[JB_R12] = (unsigned long int)thread_start;
+	my_thread->env[0].__jmpbuf[JB_R13] = (unsigned long int)my_thread;
 	my_thread->env[0].__jmpbuf[JB_RSP] = ptr_mangle((unsigned long int)sp);
 
 	// set my_thread as ready and add it to the runnable thread queue
+	alarm_block();
 	my_thread->status = TS_READY;
 	queue_insert(my_thread);
+	alarm_unblock();
 
 	// set *thread on success
 	*thread = my_thread->id;
@@ -259,21 +379,25 @@ void pthread_exit(void *value_ptr)
 	 * - Update the thread's status to indicate that it has exited
 	*/
 
+	alarm_block();
 	curr_thread->status = TS_EXITED;
-	if(curr_thread->stack != NULL) {
-		free(curr_thread->stack);
+	struct thread_control_block* next = queue_remove();
+	if (next == NULL) { // no threads remain so exit the program
+		exit(0);
 	}
 
-	// call schedule if a thread remains
-	if (curr_thread->next != NULL) {
-		free(curr_thread);
-		schedule(0);
+	// we are still on our stack: the next thread releases it
+	if (curr_thread->stack != NULL) {
+		zombie = curr_thread;
 	}
-	else { // no threads remain so exit the program
-		exit(0);
+	else { // the main thread runs on the process stack
+		free(curr_thread);
 	}
 
-	__builtin_unreachable();
+	// switch to the next ready thread without saving this one
+	curr_thread = next;
+	curr_thread->status = TS_RUNNING;
+	longjmp(curr_thread->env, 1);
 }
 
 pthread_t pthread_self(void)
@@ -285,6 +409,15 @@ pthread_t pthread_self(void)
 	return curr_thread->id;
 }
 
+/* give up the processor to the next ready thread */
+int sched_yield(void)
+{
+	if (curr_thread != NULL) {
+		schedule(0);
+	}
+	return 0;
+}
+
 /* Don't implement main in this file!
  * This is a library of functions, not an executable program. If you
  * want to run the functions in this file, create separate test programs
@@ -4,46 +4,59 @@
  * This file is derived from code provided by Prof. Egele
  */
 
-static unsigned long int ptr_demangle(unsigned long int p)
-{
-    unsigned long int ret;
-
-    asm("movq %1, %%rax;\n"
-        "rorq $0x11, %%rax;"
-        "xorq %%fs:0x30, %%rax;"
-        "movq %%rax, %0;"
-    : "=r"(ret)
-    : "r"(p)
-    : "%rax"
-    );
-    return ret;
-}
-
-static unsigned long int ptr_mangle(unsigned long int p)
-{
-    unsigned long int ret;
+/* context_switch(&old_sp, new_sp) pushes the callee-saved registers and the
+ * MXCSR/x87 control words on the current stack, stores the stack pointer in
+ * old_sp, then switches to new_sp and pops the context saved there.
+ * Caller-saved registers (rax, rcx, rdx, ...) are already spilled by the
+ * compiler at the call.
+ */
+void context_switch(void **old_sp, void *new_sp);
 
-    asm("movq %1, %%rax;\n"
-        "xorq %%fs:0x30, %%rax;"
-        "rolq $0x11, %%rax;"
-        "movq %%rax, %0;"
-    : "=r"(ret)
-    : "r"(p)
-    : "%rax"
-    );
-    return ret;
-}
+/* the first return address of a new thread: calls r12 with r13 as its argument */
+void context_start(void);
 
-static void *start_thunk() {
-  asm("popq %%rbp;\n"           //clean up the function prologue
-      "movq %%r13, %%rdi;\n"    //put arg in $rdi
-      "pushq %%r12;\n"          //push &start_routine
-      "retq;\n"                 //return to &start_routine
-      :
-      :
-      : "%rdi"
-  );
-  __builtin_unreachable();
-}
+asm(".text\n"
+    ".globl context_switch\n"
+    ".type context_switch, @function\n"
+    "context_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    pushq $0\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movl (%rsp), %eax\n"
+    "    movzwl 4(%rsp), %ecx\n"
+    "    movq %rsp, (%rdi)\n"       //save the old stack pointer
+    "    movq %rsi, %rsp\n"         //and take the new one
+    "    xorl (%rsp), %eax\n"       //reloading the control words is slow,
+    "    testl $0xffc0, %eax\n"     //skip it when the control bits match
+    "    jz 1f\n"                   //(the low 6 bits are sticky status flags)
+    "    ldmxcsr (%rsp)\n"
+    "1:  cmpw 4(%rsp), %cx\n"
+    "    je 2f\n"
+    "    fldcw 4(%rsp)\n"
+    "2:  addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    popq %rdx\n"               //jump rather than ret: the return address
+    "    jmpq *%rdx\n"              //was not pushed by a matching call
+    ".size context_switch, .-context_switch\n"
+    "\n"
+    ".globl context_start\n"
+    ".type context_start, @function\n"
+    "context_start:\n"
+    "    movq %r13, %rdi\n"         //put arg in $rdi
+    "    callq *%r12\n"             //the start function never returns
+    "    ud2\n"
+    ".size context_start, .-context_start\n"
+);
 
 #endif
@@ -0,0 +1,74 @@
+/* Barrier rounds per second, from 2 to MAX_THREADS threads.
+ *
+ * Each thread waits at the barrier over and over, about WAITS waits in all
+ * for each thread count, first at a central barrier and then at a tree
+ * barrier. Every round must have exactly one serial thread. The tree
+ * barrier's time per round should grow with the logarithm of the thread
+ * count, and it should pull ahead as THREAD_WORKERS grows.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "threads_ext.h"
+
+#define MAX_THREADS 1024
+#define WAITS 400000
+#define MIN_ROUNDS 100
+
+static pthread_barrier_t barrier;
+static long rounds;
+static long serial;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *waiter(void *arg)
+{
+	for (long i = 0; i < rounds; i++) {
+		if (pthread_barrier_wait(&barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+			__atomic_add_fetch(&serial, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return arg;
+}
+
+/* microseconds per round of n threads at a barrier of kind */
+static double run(int kind, int n)
+{
+	static pthread_t threads[MAX_THREADS];
+	pthread_barrierattr_t attr;
+	pthread_barrierattr_init(&attr);
+	pthread_barrierattr_setkind_np(&attr, kind);
+	pthread_barrier_init(&barrier, &attr, n);
+	rounds = WAITS / n > MIN_ROUNDS ? WAITS / n : MIN_ROUNDS;
+	serial = 0;
+
+	double start = now();
+	for (int i = 0; i < n; i++) {
+		pthread_create(&threads[i], NULL, waiter, NULL);
+	}
+	for (int i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	double secs = now() - start;
+	pthread_barrier_destroy(&barrier);
+	return serial == rounds ? secs / rounds * 1e6 : -1;
+}
+
+int main(void)
+{
+	int failed = 0;
+	printf("%8s %16s %16s\n", "threads", "central us/round", "tree us/round");
+	for (int n = 2; n <= MAX_THREADS; n *= 2) {
+		double central = run(PTHREAD_BARRIER_CENTRAL_NP, n);
+		double tree = run(PTHREAD_BARRIER_TREE_NP, n);
+		printf("%8d %16.2f %16.2f\n", n, central, tree);
+		failed |= central < 0 || tree < 0;
+	}
+	return failed;
+}
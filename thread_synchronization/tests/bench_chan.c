@@ -0,0 +1,196 @@
+/* Pipeline throughput over channels.
+ *
+ * A source sends MESSAGES integers through STAGES threads that each add one,
+ * to a sink that sums them, over unbuffered and buffered channels. For
+ * comparison the same pipeline runs over hand-rolled queues of a mutex and
+ * sched_yield() polling. Last, PRODUCERS threads send on channels of their
+ * own and one consumer takes from all of them with chan_select().
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "threads_ext.h"
+
+#define MESSAGES 200000
+#define STAGES 4
+#define PRODUCERS 4
+#define QUEUE_SIZE 64
+
+static chan_t chans[STAGES + 1];
+
+/* the hand-rolled alternative: a ring under a mutex, polled */
+struct queue {
+	pthread_mutex_t lock;
+	long items[QUEUE_SIZE];
+	int head, count;
+};
+static struct queue queues[STAGES + 1];
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *chan_stage(void *arg)
+{
+	long i = (long)arg, v;
+	while (chan_recv(chans[i], &v) == 0) {
+		v++;
+		chan_send(chans[i + 1], &v);
+	}
+	chan_close(chans[i + 1]);
+	return NULL;
+}
+
+static void *chan_source(void *arg)
+{
+	for (long v = 0; v < MESSAGES; v++) {
+		chan_send(chans[0], &v);
+	}
+	chan_close(chans[0]);
+	return arg;
+}
+
+static void queue_put(struct queue *q, long v)
+{
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		if (q->count < QUEUE_SIZE) {
+			q->items[(q->head + q->count++) % QUEUE_SIZE] = v;
+			pthread_mutex_unlock(&q->lock);
+			return;
+		}
+		pthread_mutex_unlock(&q->lock);
+		sched_yield();
+	}
+}
+
+static long queue_get(struct queue *q)
+{
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		if (q->count > 0) {
+			long v = q->items[q->head];
+			q->head = (q->head + 1) % QUEUE_SIZE;
+			q->count--;
+			pthread_mutex_unlock(&q->lock);
+			return v;
+		}
+		pthread_mutex_unlock(&q->lock);
+		sched_yield();
+	}
+}
+
+static void *queue_stage(void *arg)
+{
+	long i = (long)arg, v;
+	while ((v = queue_get(&queues[i])) >= 0) {
+		queue_put(&queues[i + 1], v + 1);
+	}
+	queue_put(&queues[i + 1], -1);
+	return NULL;
+}
+
+static void *queue_source(void *arg)
+{
+	for (long v = 0; v < MESSAGES; v++) {
+		queue_put(&queues[0], v);
+	}
+	queue_put(&queues[0], -1);
+	return arg;
+}
+
+static void *producer(void *arg)
+{
+	chan_t c = arg;
+	for (long v = 0; v < MESSAGES / PRODUCERS; v++) {
+		chan_send(c, &v);
+	}
+	chan_close(c);
+	return NULL;
+}
+
+static void pipeline(unsigned capacity)
+{
+	pthread_t threads[STAGES + 1];
+	for (int i = 0; i <= STAGES; i++) {
+		chan_create(&chans[i], sizeof(long), capacity);
+	}
+	double t0 = now();
+	pthread_create(&threads[0], NULL, chan_source, NULL);
+	for (long i = 0; i < STAGES; i++) {
+		pthread_create(&threads[i + 1], NULL, chan_stage, (void *)i);
+	}
+	long v, sum = 0;
+	while (chan_recv(chans[STAGES], &v) == 0) {
+		sum += v;
+	}
+	double t = now() - t0;
+	for (int i = 0; i <= STAGES; i++) {
+		pthread_join(threads[i], NULL);
+		chan_destroy(chans[i]);
+	}
+	printf("channels, capacity %4u: %6.2f M msgs/s (sum %ld)\n", capacity, MESSAGES / t / 1e6, sum);
+}
+
+int main(void)
+{
+	unsigned capacities[] = {0, 1, 64, 1024};
+	for (int i = 0; i < 4; i++) {
+		pipeline(capacities[i]);
+	}
+
+	pthread_t threads[STAGES + 1];
+	for (int i = 0; i <= STAGES; i++) {
+		pthread_mutex_init(&queues[i].lock, NULL);
+	}
+	double t0 = now();
+	pthread_create(&threads[0], NULL, queue_source, NULL);
+	for (long i = 0; i < STAGES; i++) {
+		pthread_create(&threads[i + 1], NULL, queue_stage, (void *)i);
+	}
+	long v, sum = 0;
+	while ((v = queue_get(&queues[STAGES])) >= 0) {
+		sum += v;
+	}
+	double t = now() - t0;
+	for (int i = 0; i <= STAGES; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	printf("mutex queues, size %4d: %6.2f M msgs/s (sum %ld)\n", QUEUE_SIZE, MESSAGES / t / 1e6, sum);
+
+	// fan-in with select
+	struct chan_case cases[PRODUCERS];
+	long values[PRODUCERS];
+	for (int i = 0; i < PRODUCERS; i++) {
+		chan_create(&cases[i].chan, sizeof(long), 0);
+		cases[i].op = CHAN_RECV;
+		cases[i].elem = &values[i];
+		pthread_create(&threads[i], NULL, producer, cases[i].chan);
+	}
+	t0 = now();
+	long received = 0;
+	for (int open = PRODUCERS; open > 0;) {
+		int i = chan_select(cases, open, 1);
+		if (cases[i].err != 0) {
+			// that producer is done: stop selecting on its channel
+			struct chan_case done = cases[i];
+			cases[i] = cases[open - 1];
+			cases[--open] = done;
+		}
+		else {
+			received++;
+		}
+	}
+	t = now() - t0;
+	for (int i = 0; i < PRODUCERS; i++) {
+		pthread_join(threads[i], NULL);
+		chan_destroy(cases[i].chan);
+	}
+	printf("select over %d channels: %6.2f M msgs/s (%ld received)\n", PRODUCERS, received / t / 1e6, received);
+	return 0;
+}
@@ -0,0 +1,137 @@
+/* A bounded buffer between producers and consumers.
+ *
+ * PRODUCERS threads put ITEMS integers in all through a buffer of
+ * BUFFER_SIZE, CONSUMERS threads take them out and sum them. The buffer is
+ * guarded by a mutex; threads wait for room or items on condition variables,
+ * signalled once per item or broadcast, or poll with sched_yield() instead.
+ * Switches counts the switches to producers and consumers, from tracing.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "threads_ext.h"
+
+#define ITEMS 400000
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define BUFFER_SIZE 16
+
+enum mode { SIGNAL, BROADCAST, POLL };
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t not_full = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+static long buffer[BUFFER_SIZE];
+static int head, count;
+static enum mode mode;
+static long sum;
+static unsigned long switches;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* wait for the condition with lock held */
+static void wait(pthread_cond_t *cond)
+{
+	if (mode == POLL) {
+		pthread_mutex_unlock(&lock);
+		sched_yield();
+		pthread_mutex_lock(&lock);
+	}
+	else {
+		pthread_cond_wait(cond, &lock);
+	}
+}
+
+static void wake(pthread_cond_t *cond)
+{
+	if (mode == SIGNAL) {
+		pthread_cond_signal(cond);
+	}
+	else if (mode == BROADCAST) {
+		pthread_cond_broadcast(cond);
+	}
+}
+
+/* count the switches to the running thread, before it exits */
+static void count_switches(void)
+{
+	struct thread_stats_np stats;
+	pthread_getstats_np(pthread_self(), &stats);
+	pthread_mutex_lock(&lock);
+	switches += stats.switches;
+	pthread_mutex_unlock(&lock);
+}
+
+static void *producer(void *arg)
+{
+	for (long i = 0; i < ITEMS / PRODUCERS; i++) {
+		pthread_mutex_lock(&lock);
+		while (count == BUFFER_SIZE) {
+			wait(&not_full);
+		}
+		buffer[(head + count) % BUFFER_SIZE] = i;
+		count++;
+		wake(&not_empty);
+		pthread_mutex_unlock(&lock);
+	}
+	count_switches();
+	return arg;
+}
+
+static void *consumer(void *arg)
+{
+	long local = 0;
+	for (long i = 0; i < ITEMS / CONSUMERS; i++) {
+		pthread_mutex_lock(&lock);
+		while (count == 0) {
+			wait(&not_empty);
+		}
+		local += buffer[head];
+		head = (head + 1) % BUFFER_SIZE;
+		count--;
+		wake(&not_full);
+		pthread_mutex_unlock(&lock);
+	}
+	pthread_mutex_lock(&lock);
+	sum += local;
+	pthread_mutex_unlock(&lock);
+	count_switches();
+	return arg;
+}
+
+int main(void)
+{
+	static const char *const names[] = {"signal", "broadcast", "polling"};
+	long expected = (long)PRODUCERS * (ITEMS / PRODUCERS) * (ITEMS / PRODUCERS - 1) / 2;
+	pthread_t threads[PRODUCERS + CONSUMERS];
+	int failed = 0;
+
+	printf("%-10s %12s %12s\n", "wait", "M items/s", "switches");
+	for (mode = SIGNAL; mode <= POLL; mode++) {
+		sum = 0;
+		switches = 0;
+		pthread_trace_np(1);
+		double start = now();
+		for (int i = 0; i < PRODUCERS; i++) {
+			pthread_create(&threads[i], NULL, producer, NULL);
+		}
+		for (int i = 0; i < CONSUMERS; i++) {
+			pthread_create(&threads[PRODUCERS + i], NULL, consumer, NULL);
+		}
+		for (int i = 0; i < PRODUCERS + CONSUMERS; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		double secs = now() - start;
+		pthread_trace_np(0);
+		printf("%-10s %12.2f %12lu\n", names[mode], ITEMS / secs / 1e6, switches);
+		failed |= sum != expected;
+	}
+	return failed;
+}
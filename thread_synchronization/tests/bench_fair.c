@@ -0,0 +1,100 @@
+/* Request latency next to background threads, round-robin against fair.
+ *
+ * Two request threads serve short requests (a fixed amount of computation)
+ * that arrive every REQUEST_PERIOD_USECS, while four background threads
+ * created at nice 19 compute without pause. The latency of a request is
+ * from its arrival to its completion.
+ * Compare the latency percentiles of
+ *   THREAD_WORKERS=1 THREAD_QUANTUM_USECS=1000 THREAD_SCHED=rr tests/bench_fair
+ *   THREAD_WORKERS=1 THREAD_QUANTUM_USECS=1000 THREAD_SCHED=fair tests/bench_fair
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "threads_ext.h"
+
+#define REQUESTERS 2
+#define BACKGROUND 4
+#define REQUESTS 500
+#define REQUEST_USECS 100
+#define REQUEST_PERIOD_USECS 2000
+
+static volatile int stop;
+static int done;
+static long request_loops;
+static double latency[REQUESTERS * REQUESTS];
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void work(long loops)
+{
+	for (volatile long i = 0; i < loops; i++) {
+	}
+}
+
+static void *background(void *arg)
+{
+	while (!stop) {
+		work(1000);
+	}
+	return arg;
+}
+
+static void *requester(void *arg)
+{
+	double *lat = arg;
+	double start = now();
+	for (int i = 0; i < REQUESTS; i++) {
+		double arrival = start + i * REQUEST_PERIOD_USECS * 1e-6;
+		while (now() < arrival) {
+			sched_yield(); // wait for the next request
+		}
+		work(request_loops);
+		lat[i] = now() - arrival;
+	}
+	__atomic_add_fetch(&done, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+int main(void)
+{
+	double t0 = now();
+	work(10000000);
+	request_loops = (long)(10000000 * REQUEST_USECS * 1e-6 / (now() - t0));
+
+	pthread_t bg[BACKGROUND], req[REQUESTERS];
+	pthread_setnice_np(pthread_self(), 19);
+	for (int i = 0; i < BACKGROUND; i++) {
+		pthread_create(&bg[i], NULL, background, NULL);
+	}
+	pthread_setnice_np(pthread_self(), 0);
+	for (int i = 0; i < REQUESTERS; i++) {
+		pthread_create(&req[i], NULL, requester, &latency[i * REQUESTS]);
+	}
+	while (__atomic_load_n(&done, __ATOMIC_SEQ_CST) < REQUESTERS) {
+		sched_yield();
+	}
+	stop = 1;
+
+	int n = REQUESTERS * REQUESTS;
+	qsort(latency, n, sizeof(latency[0]), cmp);
+	const char *policy = getenv("THREAD_SCHED");
+	printf("%s: %d us requests, p50 %.0f us, p99 %.0f us, max %.0f us\n",
+		policy != NULL ? policy : "rr", REQUEST_USECS,
+		latency[n / 2] * 1e6, latency[n * 99 / 100] * 1e6, latency[n - 1] * 1e6);
+	return 0;
+}
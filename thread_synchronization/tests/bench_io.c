@@ -0,0 +1,95 @@
+/* Echo round trips over socketpairs, one green thread per end.
+ *
+ * Every connection has a client thread that sends a small message and reads
+ * the echo, and a server thread that echoes it back. The reads would block
+ * the whole worker without the reactor; with it a thread waiting for data is
+ * parked and the others run. Try THREAD_WORKERS=1.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ROUNDS 200
+#define MSG_SIZE 64
+
+static pthread_barrier_t finished;
+
+static void *server(void *arg)
+{
+	int fd = (int)(long)arg;
+	char buf[MSG_SIZE];
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		write(fd, buf, n);
+	}
+	close(fd);
+	return NULL;
+}
+
+static void *client(void *arg)
+{
+	int fd = (int)(long)arg;
+	char buf[MSG_SIZE];
+	memset(buf, 'x', sizeof(buf));
+	for (int i = 0; i < ROUNDS; i++) {
+		write(fd, buf, sizeof(buf));
+		for (size_t got = 0; got < sizeof(buf);) {
+			ssize_t n = read(fd, buf + got, sizeof(buf) - got);
+			if (n <= 0) {
+				perror("read");
+				exit(1);
+			}
+			got += n;
+		}
+	}
+	close(fd);
+	pthread_barrier_wait(&finished);
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+	// two fds per connection
+	struct rlimit rl;
+	getrlimit(RLIMIT_NOFILE, &rl);
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+
+	int conns[] = {1, 10, 100, 1000};
+	printf("   conns   round trips/s\n");
+	for (int c = 0; c < 4; c++) {
+		int n = conns[c];
+		if ((rlim_t)(2 * n + 16) > rl.rlim_cur) {
+			break;
+		}
+		pthread_barrier_init(&finished, NULL, n + 1);
+		double t0 = now();
+		for (int i = 0; i < n; i++) {
+			int sv[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+				perror("socketpair");
+				return 1;
+			}
+			pthread_t t;
+			pthread_create(&t, NULL, server, (void *)(long)sv[0]);
+			pthread_create(&t, NULL, client, (void *)(long)sv[1]);
+		}
+		pthread_barrier_wait(&finished);
+		double dt = now() - t0;
+		pthread_barrier_destroy(&finished);
+		printf("%8d %15.0f\n", n, (double)n * ROUNDS / dt);
+	}
+	return 0;
+}
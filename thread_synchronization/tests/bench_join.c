@@ -0,0 +1,79 @@
+/* Thread churn: create and join, or create detached.
+ *
+ * Every round creates threads that return their argument and joins them,
+ * BATCH at a time, then creates as many detached threads. The cost of a
+ * thread should stay flat over the rounds: exited threads' stacks and TCBs
+ * are reused, not returned to malloc and the kernel. BATCH stays within the
+ * stack pool (STACK_POOL_MAX in threads.c); past it every stack is an mmap.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define ROUNDS 5
+#define BATCH 50
+#define CHURN 20000
+
+static int finished;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *identity(void *arg)
+{
+	return arg;
+}
+
+static void *count(void *arg)
+{
+	__atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST);
+	return arg;
+}
+
+int main(void)
+{
+	static pthread_t threads[BATCH];
+	pthread_attr_t detached;
+	pthread_attr_init(&detached);
+	pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+
+	printf(" round   create+join us   create detached us\n");
+	for (int r = 0; r < ROUNDS; r++) {
+		double t0 = now();
+		for (int done = 0; done < CHURN; done += BATCH) {
+			for (int i = 0; i < BATCH; i++) {
+				pthread_create(&threads[i], NULL, identity, (void *)(intptr_t)i);
+			}
+			for (int i = 0; i < BATCH; i++) {
+				void *ret;
+				pthread_join(threads[i], &ret);
+				if ((intptr_t)ret != i) {
+					printf("thread %d returned %ld\n", i, (long)(intptr_t)ret);
+					return 1;
+				}
+			}
+		}
+		double joined = now() - t0;
+
+		t0 = now();
+		__atomic_store_n(&finished, 0, __ATOMIC_SEQ_CST);
+		for (int i = 0; i < CHURN; i++) {
+			pthread_t t;
+			pthread_create(&t, &detached, count, NULL);
+			if (i % BATCH == BATCH - 1) {
+				while (__atomic_load_n(&finished, __ATOMIC_SEQ_CST) <= i) {
+					sched_yield();
+				}
+			}
+		}
+		double detached_time = now() - t0;
+		printf("%6d %16.2f %20.2f\n", r, joined / CHURN * 1e6, detached_time / CHURN * 1e6);
+	}
+	return 0;
+}
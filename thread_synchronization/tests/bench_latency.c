@@ -0,0 +1,70 @@
+/* Wakeup latency of an interactive thread next to a CPU-bound one.
+ *
+ * A batch thread spins while an interactive thread repeatedly yields and
+ * measures how long it takes to run again, first with the default time
+ * slice and then with a short one set by pthread_settimeslice_np().
+ * Run with THREAD_WORKERS=1 so that both threads share one worker.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "threads_ext.h"
+
+#define ROUNDS 20
+
+static volatile int stop;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *batch(void *arg)
+{
+	while (!stop) {
+	}
+	return arg;
+}
+
+static void *interactive(void *arg)
+{
+	unsigned usecs = *(unsigned *)arg;
+	pthread_settimeslice_np(pthread_self(), usecs);
+
+	double worst = 0, total = 0;
+	for (int i = 0; i < ROUNDS; i++) {
+		double t0 = now();
+		sched_yield();
+		double dt = now() - t0;
+		total += dt;
+		worst = dt > worst ? dt : worst;
+	}
+	printf("slice %6u us: mean latency %8.1f us, worst %8.1f us\n",
+		usecs, total / ROUNDS * 1e6, worst * 1e6);
+	stop = 1;
+	return NULL;
+}
+
+int main(void)
+{
+	unsigned slices[] = {0, 1000, 200};
+
+	for (int i = 0; i < 3; i++) {
+		pthread_t b, t;
+		stop = 0;
+		pthread_create(&b, NULL, batch, NULL);
+		pthread_create(&t, NULL, interactive, &slices[i]);
+		while (!stop) {
+			sched_yield();
+		}
+		// let the batch thread see stop and exit
+		for (int j = 0; j < 3; j++) {
+			sched_yield();
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,98 @@
+/* Mutex operations per second, uncontended and with several threads
+ * contending for one mutex. Then threads yield while holding the mutex, so
+ * the others queue up behind it and every unlock wakes one of them; the
+ * rate of handoffs should not depend on how long the queue is. The
+ * contended run prints how the locks were taken: with more than one worker
+ * (THREAD_WORKERS) short critical sections should mostly be taken spinning.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "threads_ext.h"
+
+#define OPS 2000000
+#define THREADS 4
+#define HANDOFFS 200000
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t done;
+static volatile long counter;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *contender(void *arg)
+{
+	for (int i = 0; i < OPS / THREADS; i++) {
+		pthread_mutex_lock(&mutex);
+		counter++;
+		pthread_mutex_unlock(&mutex);
+	}
+	pthread_barrier_wait(&done);
+	return arg;
+}
+
+static void *holder(void *arg)
+{
+	long rounds = (long)arg;
+	for (long i = 0; i < rounds; i++) {
+		pthread_mutex_lock(&mutex);
+		counter++;
+		sched_yield();
+		pthread_mutex_unlock(&mutex);
+	}
+	return arg;
+}
+
+int main(void)
+{
+	pthread_t tid;
+	pthread_barrier_init(&done, NULL, THREADS + 1);
+
+	double start = now();
+	for (int i = 0; i < OPS; i++) {
+		pthread_mutex_lock(&mutex);
+		counter++;
+		pthread_mutex_unlock(&mutex);
+	}
+	double secs = now() - start;
+	printf("uncontended: %.2f M lock/unlock pairs/s\n", OPS / secs / 1e6);
+
+	struct mutex_stats_np before, after;
+	pthread_mutex_getstats_np(&mutex, &before);
+	start = now();
+	for (int i = 0; i < THREADS; i++) {
+		pthread_create(&tid, NULL, contender, NULL);
+	}
+	pthread_barrier_wait(&done);
+	secs = now() - start;
+	printf("%d threads:   %.2f M lock/unlock pairs/s\n", THREADS, OPS / secs / 1e6);
+	pthread_mutex_getstats_np(&mutex, &after);
+	printf("  fast %lu, spun %lu, parked %lu, hold %llu ns\n", after.fast - before.fast,
+		after.spun - before.spun, after.parked - before.parked, after.hold_ns);
+
+	int queues[] = {16, 256, 4096};
+	for (int q = 0; q < 3; q++) {
+		static pthread_t holders[4096];
+		long rounds = HANDOFFS / queues[q];
+		pthread_mutex_lock(&mutex); // hold them back until all are created
+		for (int i = 0; i < queues[q]; i++) {
+			pthread_create(&holders[i], NULL, holder, (void *)rounds);
+		}
+		start = now();
+		pthread_mutex_unlock(&mutex);
+		for (int i = 0; i < queues[q]; i++) {
+			pthread_join(holders[i], NULL);
+		}
+		secs = now() - start;
+		printf("%4d waiters: %.2f M handoffs/s\n", queues[q], rounds * queues[q] / secs / 1e6);
+	}
+
+	return counter != 2L * OPS + HANDOFFS / 16 * 16 + HANDOFFS / 256 * 256 + HANDOFFS / 4096 * 4096;
+}
@@ -0,0 +1,45 @@
+/* Throughput of independent CPU-bound threads.
+ *
+ * Run with THREAD_WORKERS=1, 2, 4, ... to see how it scales with the
+ * number of workers (kernel threads); it should grow close to linearly up
+ * to the number of cores.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TASKS 64
+#define WORK 20000000
+
+static pthread_barrier_t done;
+static volatile unsigned long sink;
+
+static void *task(void *arg)
+{
+	unsigned long x = (unsigned long)arg;
+	for (long i = 0; i < WORK; i++) {
+		x = x * 6364136223846793005UL + 1442695040888963407UL;
+	}
+	sink += x;
+	pthread_barrier_wait(&done);
+	return NULL;
+}
+
+int main(void)
+{
+	struct timespec t0, t1;
+	pthread_t tid;
+
+	pthread_barrier_init(&done, NULL, TASKS + 1);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (long i = 0; i < TASKS; i++) {
+		pthread_create(&tid, NULL, task, (void *)i);
+	}
+	pthread_barrier_wait(&done);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("%d tasks in %.3f s, %.1f tasks/s\n", TASKS, secs, TASKS / secs);
+	return 0;
+}
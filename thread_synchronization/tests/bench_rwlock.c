@@ -0,0 +1,135 @@
+/* A table read by many threads and now and then updated by one.
+ *
+ * READERS threads each look up READS entries of a routing table, yielding
+ * every YIELD_EVERY lookups; a writer updates it every WRITE_USECS until the
+ * readers are done. The table is guarded by a mutex, then by a rwlock that
+ * keeps readers out while a writer waits (the default) and by one preferring
+ * readers. Reads should go faster under the rwlocks, and scale with
+ * THREAD_WORKERS; the writer should not wait long under the default policy.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+
+#define READERS 8
+#define READS 400000
+#define YIELD_EVERY 64
+#define WRITE_USECS 100
+#define ROUTES 64
+
+enum mode { MUTEX, RWLOCK, RWLOCK_READERS };
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t rwlock;
+static enum mode mode;
+static volatile long table[ROUTES];
+static volatile int done;
+static double writer_max_wait;
+static long writes;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void read_lock(void)
+{
+	if (mode == MUTEX) {
+		pthread_mutex_lock(&mutex);
+	}
+	else {
+		pthread_rwlock_rdlock(&rwlock);
+	}
+}
+
+static void write_lock(void)
+{
+	if (mode == MUTEX) {
+		pthread_mutex_lock(&mutex);
+	}
+	else {
+		pthread_rwlock_wrlock(&rwlock);
+	}
+}
+
+static void release(void)
+{
+	if (mode == MUTEX) {
+		pthread_mutex_unlock(&mutex);
+	}
+	else {
+		pthread_rwlock_unlock(&rwlock);
+	}
+}
+
+static void *reader(void *arg)
+{
+	long sum = 0;
+	for (long i = 0; i < READS; i++) {
+		read_lock();
+		sum += table[i % ROUTES];
+		release();
+		if (i % YIELD_EVERY == 0) {
+			sched_yield();
+		}
+	}
+	return (void *)sum;
+}
+
+static void *writer(void *arg)
+{
+	struct timespec interval = {0, WRITE_USECS * 1000};
+	while (!done) {
+		nanosleep(&interval, NULL);
+		double start = now();
+		write_lock();
+		double wait = now() - start;
+		for (int i = 0; i < ROUTES; i++) {
+			table[i]++;
+		}
+		writes++;
+		release();
+		if (wait > writer_max_wait) {
+			writer_max_wait = wait;
+		}
+	}
+	return arg;
+}
+
+int main(void)
+{
+	static const char *const names[] = {"mutex", "rwlock", "rwlock (readers first)"};
+	pthread_t readers[READERS], w;
+
+	printf("%-24s %12s %8s %16s\n", "lock", "M reads/s", "writes", "max write wait");
+	for (mode = MUTEX; mode <= RWLOCK_READERS; mode++) {
+		pthread_rwlockattr_t attr;
+		pthread_rwlockattr_init(&attr);
+		pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_READER_NP);
+		pthread_rwlock_init(&rwlock, mode == RWLOCK_READERS ? &attr : NULL);
+		done = 0;
+		writes = 0;
+		writer_max_wait = 0;
+
+		double start = now();
+		pthread_create(&w, NULL, writer, NULL);
+		for (int i = 0; i < READERS; i++) {
+			pthread_create(&readers[i], NULL, reader, NULL);
+		}
+		for (int i = 0; i < READERS; i++) {
+			pthread_join(readers[i], NULL);
+		}
+		double secs = now() - start;
+		done = 1;
+		pthread_join(w, NULL);
+		printf("%-24s %12.2f %8ld %13.0f us\n", names[mode], (double)READERS * READS / secs / 1e6,
+			writes, writer_max_wait * 1e6);
+		if (pthread_rwlock_destroy(&rwlock) != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,69 @@
+/* Context-switch cost as the number of (blocked) threads grows.
+ *
+ * Two threads ping-pong through sched_yield() while the other threads sit
+ * blocked on a mutex held by main. A scheduler that scans every TCB pays
+ * for the blocked ones on each switch; a ready queue does not.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define YIELDS 100000
+
+static pthread_mutex_t gate;
+static volatile int stop;
+
+static void *blocked(void *arg)
+{
+	pthread_mutex_lock(&gate);
+	pthread_mutex_unlock(&gate);
+	return arg;
+}
+
+static void *yielder(void *arg)
+{
+	while (!stop) {
+		sched_yield();
+	}
+	return arg;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	int max = argc > 1 ? atoi(argv[1]) : 4096;
+	pthread_t tid;
+	int nblocked = 0;
+
+	pthread_mutex_init(&gate, NULL);
+	pthread_mutex_lock(&gate);
+	pthread_create(&tid, NULL, yielder, NULL);
+
+	printf("%8s %12s\n", "threads", "ns/switch");
+	for (int n = 2; n <= max; n *= 4) {
+		while (nblocked < n - 2) {
+			pthread_create(&tid, NULL, blocked, NULL);
+			nblocked++;
+		}
+		// let the new threads run into the mutex
+		sched_yield();
+
+		double start = now_ns();
+		for (int i = 0; i < YIELDS; i++) {
+			sched_yield();
+		}
+		double elapsed = now_ns() - start;
+		printf("%8d %12.1f\n", n, elapsed / (2.0 * YIELDS));
+	}
+
+	stop = 1;
+	return 0;
+}
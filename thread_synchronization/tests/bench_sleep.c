@@ -0,0 +1,85 @@
+/* Sleep accuracy with many sleeping threads.
+ *
+ * Every thread sleeps SLEEPS times for a random 1-20 ms. The lateness of a
+ * wakeup (actual minus requested time) stays flat as the number of sleepers
+ * grows when arming and expiring a timeout costs O(1). With all sleepers on
+ * few CPUs the wakeups queue up behind each other, so the CPU time spent per
+ * sleep (including creating and exiting the threads) is reported as well.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SLEEPS 5
+#define MAX_THREADS 20000
+
+static pthread_barrier_t finished;
+static double lateness[MAX_THREADS * SLEEPS];
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *sleeper(void *arg)
+{
+	double *late = arg;
+	unsigned seed = (unsigned)(late - lateness);
+	for (int i = 0; i < SLEEPS; i++) {
+		int usecs = 1000 + rand_r(&seed) % 19000;
+		double t0 = now();
+		usleep(usecs);
+		late[i] = now() - t0 - usecs * 1e-6;
+	}
+	pthread_barrier_wait(&finished);
+	return NULL;
+}
+
+static double cpu_time(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+int main(void)
+{
+	int counts[] = {10, 100, 1000, 10000, MAX_THREADS};
+	printf(" threads   mean late us   p99 late us   cpu us/sleep\n");
+	for (int c = 0; c < 5; c++) {
+		int n = counts[c];
+		pthread_barrier_init(&finished, NULL, n + 1);
+		double cpu0 = cpu_time();
+		for (int i = 0; i < n; i++) {
+			pthread_t t;
+			if (pthread_create(&t, NULL, sleeper, &lateness[i * SLEEPS]) != 0) {
+				printf("pthread_create failed at %d threads\n", i);
+				return 1;
+			}
+		}
+		pthread_barrier_wait(&finished);
+		pthread_barrier_destroy(&finished);
+		double cpu = cpu_time() - cpu0;
+
+		double sum = 0;
+		for (int i = 0; i < n * SLEEPS; i++) {
+			sum += lateness[i];
+		}
+		qsort(lateness, n * SLEEPS, sizeof(lateness[0]), cmp);
+		printf("%8d %14.1f %13.1f %14.2f\n", n, sum / (n * SLEEPS) * 1e6, lateness[n * SLEEPS * 99 / 100] * 1e6,
+			cpu / (n * SLEEPS) * 1e6);
+		sleep(1); // let the threads of this round exit
+	}
+	return 0;
+}
@@ -0,0 +1,101 @@
+/* Task throughput against thread creation.
+ *
+ * Fans out FANOUT tiny tasks per task group until TASKS have run, then
+ * spawns and awaits tasks one by one, and compares both with creating and
+ * joining a thread per subtask. A last round has every task sleep briefly,
+ * so runners block and spare ones take over. The peak RSS stays bounded
+ * however many tasks are spawned.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "threads_ext.h"
+
+#define TASKS 2000000
+#define FANOUT 1000
+#define THREADS 100000
+#define SLEEPERS 1000
+
+static long sum;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *add(void *arg)
+{
+	__atomic_add_fetch(&sum, (long)arg, __ATOMIC_RELAXED);
+	return arg;
+}
+
+static void *nap(void *arg)
+{
+	usleep(10000);
+	return add(arg);
+}
+
+static long max_rss_kb(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+int main(void)
+{
+	task_group_t group = TASK_GROUP_INITIALIZER;
+	double t0 = now();
+	for (int done = 0; done < TASKS; done += FANOUT) {
+		for (int i = 0; i < FANOUT; i++) {
+			task_group_spawn(&group, add, (void *)1L);
+		}
+		task_group_wait(&group);
+	}
+	double t = now() - t0;
+	printf("task group:   %6.2f M tasks/s, sum %ld, max rss %ld KB\n", TASKS / t / 1e6, sum, max_rss_kb());
+
+	static task_t tasks[FANOUT];
+	sum = 0;
+	t0 = now();
+	for (int done = 0; done < TASKS; done += FANOUT) {
+		for (int i = 0; i < FANOUT; i++) {
+			task_spawn(&tasks[i], add, (void *)1L);
+		}
+		for (int i = 0; i < FANOUT; i++) {
+			void *ret;
+			task_await(tasks[i], &ret);
+		}
+	}
+	t = now() - t0;
+	printf("spawn/await:  %6.2f M tasks/s, sum %ld, max rss %ld KB\n", TASKS / t / 1e6, sum, max_rss_kb());
+
+	static pthread_t threads[FANOUT];
+	sum = 0;
+	t0 = now();
+	for (int done = 0; done < THREADS; done += FANOUT) {
+		for (int i = 0; i < FANOUT; i++) {
+			pthread_create(&threads[i], NULL, add, (void *)1L);
+		}
+		for (int i = 0; i < FANOUT; i++) {
+			pthread_join(threads[i], NULL);
+		}
+	}
+	t = now() - t0;
+	printf("create/join:  %6.2f M threads/s, sum %ld\n", THREADS / t / 1e6, sum);
+
+	sum = 0;
+	t0 = now();
+	for (int i = 0; i < SLEEPERS; i++) {
+		task_group_spawn(&group, nap, (void *)1L);
+	}
+	task_group_wait(&group);
+	printf("%d tasks sleeping 10 ms: %.1f ms, sum %ld, max rss %ld KB\n", SLEEPERS, (now() - t0) * 1e3, sum,
+		max_rss_kb());
+	return 0;
+}
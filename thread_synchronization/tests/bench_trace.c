@@ -0,0 +1,103 @@
+/* Cost of scheduler tracing, and what it reports.
+ *
+ * Two threads ping-pong through sched_yield() with tracing off and then on;
+ * off it should cost next to nothing. Then, traced, a thread holds a mutex
+ * for a while in short sleeps as others queue for it, and the per-thread
+ * summaries show where their time went. With a file argument the trace is
+ * written there, to be opened in chrome://tracing or ui.perfetto.dev.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "threads_ext.h"
+
+#define YIELDS 200000
+#define WAITERS 3
+
+static pthread_mutex_t lock;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *yielder(void *arg)
+{
+	for (int i = 0; i < YIELDS; i++) {
+		sched_yield();
+	}
+	return arg;
+}
+
+static double yield_cost(void)
+{
+	pthread_t a, b;
+	double t0 = now();
+	pthread_create(&a, NULL, yielder, NULL);
+	pthread_create(&b, NULL, yielder, NULL);
+	pthread_join(a, NULL);
+	pthread_join(b, NULL);
+	return (now() - t0) / (2.0 * YIELDS) * 1e9;
+}
+
+static void *holder(void *arg)
+{
+	pthread_mutex_lock(&lock);
+	for (int i = 0; i < 10; i++) {
+		usleep(2000);
+	}
+	pthread_mutex_unlock(&lock);
+	return arg;
+}
+
+static void *waiter(void *arg)
+{
+	pthread_mutex_lock(&lock);
+	for (volatile long i = 0; i < 2000000; i++) {
+	}
+	pthread_mutex_unlock(&lock);
+	return arg;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_mutex_init(&lock, NULL);
+	double off = yield_cost();
+	pthread_trace_np(1);
+	double on = yield_cost();
+	printf("sched_yield: %.1f ns untraced, %.1f ns traced\n", off, on);
+
+	pthread_t threads[WAITERS + 1];
+	pthread_create(&threads[0], NULL, holder, NULL);
+	usleep(1000);
+	for (int i = 1; i <= WAITERS; i++) {
+		pthread_create(&threads[i], NULL, waiter, NULL);
+	}
+	struct thread_stats_np stats[WAITERS + 1];
+	for (int i = 0; i <= WAITERS; i++) {
+		// stats of a thread are read before it is joined, its TCB is freed then
+		while (pthread_getstats_np(threads[i], &stats[i]) == 0 && stats[i].switches == 0) {
+			sched_yield();
+		}
+	}
+	usleep(100000);
+	printf("thread    run us  ready us  blocked us  switches\n");
+	for (int i = 0; i <= WAITERS; i++) {
+		pthread_getstats_np(threads[i], &stats[i]);
+		printf("%-7s %8llu %9llu %11llu %9lu\n", i == 0 ? "holder" : "waiter", stats[i].run_ns / 1000,
+			stats[i].ready_ns / 1000, stats[i].blocked_ns / 1000, stats[i].switches);
+		pthread_join(threads[i], NULL);
+	}
+
+	pthread_trace_np(0);
+	if (argc > 1 && pthread_trace_dump_np(argv[1]) != 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	return 0;
+}
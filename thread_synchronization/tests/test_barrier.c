@@ -0,0 +1,126 @@
+/* Barriers: central and tree barriers let no thread into a round before all
+ * have left the one before and have one serial thread per round, timed waits
+ * give up and no longer count, and a barrier is busy while threads wait.
+ * Runs on several workers.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "threads_ext.h"
+
+#define THREADS 16
+#define ROUNDS 200
+
+#define check(cond) do { if (!(cond)) { \
+	printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+static pthread_barrier_t barrier;
+static int nthreads;
+static int arrived[ROUNDS];
+static int serial[ROUNDS];
+
+static struct timespec in_ms(long ms)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += ms % 1000 * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+/* counts its arrival at each round: past the barrier, all nthreads must
+have arrived at it */
+static void *waiter(void *arg)
+{
+	for (int r = 0; r < ROUNDS; r++) {
+		__atomic_add_fetch(&arrived[r], 1, __ATOMIC_SEQ_CST);
+		int rc = pthread_barrier_wait(&barrier);
+		check(rc == 0 || rc == PTHREAD_BARRIER_SERIAL_THREAD);
+		if (rc == PTHREAD_BARRIER_SERIAL_THREAD) {
+			__atomic_add_fetch(&serial[r], 1, __ATOMIC_SEQ_CST);
+		}
+		check(__atomic_load_n(&arrived[r], __ATOMIC_SEQ_CST) == nthreads);
+	}
+	return arg;
+}
+
+static void rounds(int kind, int n)
+{
+	pthread_t threads[THREADS];
+	pthread_barrierattr_t attr;
+	pthread_barrierattr_init(&attr);
+	check(pthread_barrierattr_setkind_np(&attr, kind) == 0);
+	check(pthread_barrier_init(&barrier, &attr, n) == 0);
+	nthreads = n;
+	for (int r = 0; r < ROUNDS; r++) {
+		arrived[r] = 0;
+		serial[r] = 0;
+	}
+	for (int i = 0; i < n; i++) {
+		pthread_create(&threads[i], NULL, waiter, NULL);
+	}
+	for (int i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	for (int r = 0; r < ROUNDS; r++) {
+		check(serial[r] == 1);
+	}
+	check(pthread_barrier_destroy(&barrier) == 0);
+}
+
+static void *one_wait(void *arg)
+{
+	int rc = pthread_barrier_wait(&barrier);
+	check(rc == 0 || rc == PTHREAD_BARRIER_SERIAL_THREAD);
+	return arg;
+}
+
+int main(void)
+{
+	setenv("THREAD_WORKERS", "4", 0);
+	pthread_t t;
+
+	check(pthread_barrier_init(&barrier, NULL, 0) == EINVAL);
+
+	// every round is complete before the next, with one serial thread; also
+	// with counts that do not fill the tree
+	int kinds[] = {PTHREAD_BARRIER_CENTRAL_NP, PTHREAD_BARRIER_TREE_NP};
+	for (int k = 0; k < 2; k++) {
+		rounds(kinds[k], 1);
+		rounds(kinds[k], 5);
+		rounds(kinds[k], THREADS);
+	}
+
+	// a timed wait gives up, and the barrier then waits for a full count
+	check(pthread_barrier_init(&barrier, NULL, 2) == 0);
+	struct timespec soon = in_ms(20);
+	check(pthread_barrier_timedwait_np(&barrier, &soon) == ETIMEDOUT);
+	struct timespec bad_time = {0, 1000000000};
+	check(pthread_barrier_timedwait_np(&barrier, &bad_time) == EINVAL);
+	pthread_create(&t, NULL, one_wait, NULL);
+	struct timespec park_time = {0, 20000000};
+	nanosleep(&park_time, NULL); // let it park
+	check(pthread_barrier_destroy(&barrier) == EBUSY);
+	struct timespec later = in_ms(2000);
+	int rc = pthread_barrier_timedwait_np(&barrier, &later);
+	check(rc == 0 || rc == PTHREAD_BARRIER_SERIAL_THREAD);
+	pthread_join(t, NULL);
+	check(pthread_barrier_destroy(&barrier) == 0);
+
+	// a tree barrier cannot be left
+	pthread_barrierattr_t attr;
+	pthread_barrierattr_init(&attr);
+	pthread_barrierattr_setkind_np(&attr, PTHREAD_BARRIER_TREE_NP);
+	check(pthread_barrier_init(&barrier, &attr, 2) == 0);
+	soon = in_ms(20);
+	check(pthread_barrier_timedwait_np(&barrier, &soon) == ENOTSUP);
+	check(pthread_barrier_destroy(&barrier) == 0);
+	return 0;
+}
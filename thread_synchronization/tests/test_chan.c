@@ -0,0 +1,181 @@
+/* Channels: a pipeline of unbuffered and buffered channels that keeps every
+ * value in order, a buffer that fills up, closing with a buffer to drain and
+ * with threads waiting, and chan_select() taking from several senders. Runs
+ * on several workers.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "threads_ext.h"
+
+#define MESSAGES 5000
+#define STAGES 4
+#define CAPACITY 8
+#define PRODUCERS 4
+
+#define check(cond) do { if (!(cond)) { \
+	printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+static chan_t chans[STAGES + 1];
+static chan_t from[PRODUCERS];
+
+/* passes values on from one channel to the next, adding one */
+static void *stage(void *arg)
+{
+	long i = (long)arg, v;
+	while (chan_recv(chans[i], &v) == 0) {
+		v++;
+		check(chan_send(chans[i + 1], &v) == 0);
+	}
+	check(chan_close(chans[i + 1]) == 0);
+	return arg;
+}
+
+static void *producer(void *arg)
+{
+	long i = (long)arg;
+	for (long v = 0; v < MESSAGES; v++) {
+		long msg = i * MESSAGES + v;
+		check(chan_send(from[i], &msg) == 0);
+	}
+	check(chan_close(from[i]) == 0);
+	return arg;
+}
+
+static void *receiver(void *arg)
+{
+	long v = 1;
+	check(chan_recv(chans[0], &v) == EPIPE);
+	check(v == 0);
+	return arg;
+}
+
+static void *sender(void *arg)
+{
+	long v = 1;
+	check(chan_send(chans[0], &v) == EPIPE);
+	return arg;
+}
+
+/* run MESSAGES values through STAGES stages over channels of capacity */
+static void pipeline(unsigned capacity)
+{
+	pthread_t threads[STAGES];
+	for (int i = 0; i <= STAGES; i++) {
+		check(chan_create(&chans[i], sizeof(long), capacity) == 0);
+	}
+	for (long i = 0; i < STAGES; i++) {
+		pthread_create(&threads[i], NULL, stage, (void *)i);
+	}
+	pthread_t source;
+	from[0] = chans[0];
+	pthread_create(&source, NULL, producer, (void *)0L);
+	long v, expected = STAGES;
+	while (chan_recv(chans[STAGES], &v) == 0) {
+		check(v == expected);
+		expected++;
+	}
+	check(expected == MESSAGES + STAGES);
+	pthread_join(source, NULL);
+	for (int i = 0; i < STAGES; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	for (int i = 0; i <= STAGES; i++) {
+		check(chan_destroy(chans[i]) == 0);
+	}
+}
+
+int main(void)
+{
+	setenv("THREAD_WORKERS", "4", 0);
+	pthread_t threads[PRODUCERS];
+	chan_t chan;
+
+	check(chan_create(&chan, 0, 1) == EINVAL);
+
+	// a buffer takes CAPACITY values without a receiver, then is full
+	check(chan_create(&chan, sizeof(long), CAPACITY) == 0);
+	long v = 7;
+	struct chan_case send = {chan, CHAN_SEND, &v, -1};
+	for (int i = 0; i < CAPACITY; i++) {
+		check(chan_select(&send, 1, 0) == 0);
+		check(send.err == 0);
+	}
+	check(chan_select(&send, 1, 0) == -1);
+
+	// closed: sends fail, receives drain the buffer, then get a zero value
+	check(chan_close(chan) == 0);
+	check(chan_close(chan) == EPIPE);
+	check(chan_send(chan, &v) == EPIPE);
+	for (int i = 0; i < CAPACITY; i++) {
+		v = 0;
+		check(chan_recv(chan, &v) == 0);
+		check(v == 7);
+	}
+	check(chan_recv(chan, &v) == EPIPE);
+	check(v == 0);
+	check(chan_destroy(chan) == 0);
+
+	// closing wakes a waiting receiver and a waiting sender with EPIPE; the
+	// channel is busy while they wait (given time to park)
+	struct timespec park_time = {0, 20000000};
+	check(chan_create(&chans[0], sizeof(long), 0) == 0);
+	pthread_create(&threads[0], NULL, receiver, NULL);
+	nanosleep(&park_time, NULL);
+	check(chan_destroy(chans[0]) == EBUSY);
+	check(chan_close(chans[0]) == 0);
+	pthread_join(threads[0], NULL);
+	check(chan_destroy(chans[0]) == 0);
+
+	check(chan_create(&chans[0], sizeof(long), 0) == 0);
+	pthread_create(&threads[0], NULL, sender, NULL);
+	nanosleep(&park_time, NULL);
+	check(chan_close(chans[0]) == 0);
+	pthread_join(threads[0], NULL);
+	check(chan_destroy(chans[0]) == 0);
+
+	// every value arrives once and in order, unbuffered and buffered
+	pipeline(0);
+	pipeline(CAPACITY);
+
+	// one receiver selects over the channels of several senders
+	static char seen[PRODUCERS * MESSAGES];
+	long last[PRODUCERS];
+	struct chan_case cases[PRODUCERS];
+	long values[PRODUCERS];
+	for (long i = 0; i < PRODUCERS; i++) {
+		check(chan_create(&from[i], sizeof(long), i % 2 == 0 ? 0 : CAPACITY) == 0);
+		cases[i] = (struct chan_case){from[i], CHAN_RECV, &values[i], -1};
+		last[i] = -1;
+		pthread_create(&threads[i], NULL, producer, (void *)i);
+	}
+	for (int open = PRODUCERS; open > 0;) {
+		int i = chan_select(cases, open, 1);
+		check(i >= 0 && i < open);
+		if (cases[i].err == EPIPE) { // closed and drained: select over the others
+			struct chan_case closed = cases[i];
+			cases[i] = cases[--open];
+			cases[open] = closed;
+			continue;
+		}
+		check(cases[i].err == 0);
+		v = *(long *)cases[i].elem;
+		long p = v / MESSAGES;
+		check(p >= 0 && p < PRODUCERS && cases[i].chan == from[p]);
+		check(v > last[p]); // in order from each sender
+		check(!seen[v]);
+		seen[v] = 1;
+		last[p] = v;
+	}
+	for (int i = 0; i < PRODUCERS * MESSAGES; i++) {
+		check(seen[i]);
+	}
+	for (int i = 0; i < PRODUCERS; i++) {
+		pthread_join(threads[i], NULL);
+		check(chan_destroy(from[i]) == 0);
+	}
+	return 0;
+}
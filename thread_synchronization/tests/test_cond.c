@@ -0,0 +1,209 @@
+/* Condition variables: timed waits, a broadcast that reaches every waiter,
+ * a bounded buffer that loses no item with signal and with broadcast, and a
+ * signalled timed wait that returns before its deadline. Runs on several
+ * workers.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define WAITERS 8
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define ITEMS 4000
+#define BUFFER_SIZE 4
+
+#define check(cond) do { if (!(cond)) { \
+	printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t not_full = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+static int waiting, go;
+static long buffer[BUFFER_SIZE];
+static int head, count;
+static long sum;
+static int broadcast;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct timespec in_ms(clockid_t clock, long ms)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += ms % 1000 * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+/* waits for go, counted in waiting while it holds the mutex: all WAITERS are
+parked once the main thread holds the mutex with waiting == WAITERS */
+static void *waiter(void *arg)
+{
+	check(pthread_mutex_lock(&lock) == 0);
+	waiting++;
+	while (!go) {
+		check(pthread_cond_wait(&cond, &lock) == 0);
+	}
+	waiting--;
+	check(pthread_mutex_unlock(&lock) == 0);
+	return arg;
+}
+
+static void wake(pthread_cond_t *c)
+{
+	if (broadcast) {
+		check(pthread_cond_broadcast(c) == 0);
+	}
+	else {
+		check(pthread_cond_signal(c) == 0);
+	}
+}
+
+static void *producer(void *arg)
+{
+	for (long i = 0; i < ITEMS; i++) {
+		check(pthread_mutex_lock(&lock) == 0);
+		while (count == BUFFER_SIZE) {
+			check(pthread_cond_wait(&not_full, &lock) == 0);
+		}
+		buffer[(head + count) % BUFFER_SIZE] = i;
+		count++;
+		wake(&not_empty);
+		check(pthread_mutex_unlock(&lock) == 0);
+	}
+	return arg;
+}
+
+static void *consumer(void *arg)
+{
+	long local = 0;
+	for (long i = 0; i < (long)PRODUCERS * ITEMS / CONSUMERS; i++) {
+		check(pthread_mutex_lock(&lock) == 0);
+		while (count == 0) {
+			check(pthread_cond_wait(&not_empty, &lock) == 0);
+		}
+		local += buffer[head];
+		head = (head + 1) % BUFFER_SIZE;
+		count--;
+		wake(&not_full);
+		check(pthread_mutex_unlock(&lock) == 0);
+	}
+	check(pthread_mutex_lock(&lock) == 0);
+	sum += local;
+	check(pthread_mutex_unlock(&lock) == 0);
+	return arg;
+}
+
+/* a timed wait that is signalled well before its deadline */
+static void *timed_waiter(void *arg)
+{
+	check(pthread_mutex_lock(&lock) == 0);
+	waiting++;
+	struct timespec deadline = in_ms(CLOCK_REALTIME, 2000);
+	double start = now();
+	while (!go) {
+		check(pthread_cond_timedwait(&cond, &lock, &deadline) == 0);
+	}
+	check(now() - start < 1.0);
+	waiting--;
+	check(pthread_mutex_unlock(&lock) == 0);
+	return arg;
+}
+
+int main(void)
+{
+	setenv("THREAD_WORKERS", "4", 0);
+	pthread_t threads[PRODUCERS + CONSUMERS + WAITERS];
+
+	// timed waits time out with the mutex held again, on either clock
+	check(pthread_mutex_lock(&lock) == 0);
+	struct timespec soon = in_ms(CLOCK_REALTIME, 20);
+	check(pthread_cond_timedwait(&cond, &lock, &soon) == ETIMEDOUT);
+	struct timespec bad_time = {0, 1000000000};
+	check(pthread_cond_timedwait(&cond, &lock, &bad_time) == EINVAL);
+	check(pthread_mutex_unlock(&lock) == 0);
+
+	pthread_cond_t monotonic;
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	check(pthread_cond_init(&monotonic, &attr) == 0);
+	check(pthread_mutex_lock(&lock) == 0);
+	soon = in_ms(CLOCK_MONOTONIC, 20);
+	double start = now();
+	check(pthread_cond_timedwait(&monotonic, &lock, &soon) == ETIMEDOUT);
+	check(now() - start >= 0.015 && now() - start < 1.0);
+	check(pthread_mutex_unlock(&lock) == 0);
+	check(pthread_cond_destroy(&monotonic) == 0);
+
+	// a broadcast wakes every waiter, and the condition is busy until then
+	for (int i = 0; i < WAITERS; i++) {
+		pthread_create(&threads[i], NULL, waiter, NULL);
+	}
+	for (;;) {
+		check(pthread_mutex_lock(&lock) == 0);
+		if (waiting == WAITERS) {
+			break;
+		}
+		check(pthread_mutex_unlock(&lock) == 0);
+		sched_yield();
+	}
+	check(pthread_cond_destroy(&cond) == EBUSY);
+	go = 1;
+	check(pthread_cond_broadcast(&cond) == 0);
+	check(pthread_mutex_unlock(&lock) == 0);
+	for (int i = 0; i < WAITERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	check(waiting == 0);
+	check(pthread_cond_destroy(&cond) == 0);
+	check(pthread_cond_init(&cond, NULL) == 0);
+
+	// a bounded buffer, woken by signal and then by broadcast
+	long expected = (long)PRODUCERS * ITEMS * (ITEMS - 1) / 2;
+	for (broadcast = 0; broadcast <= 1; broadcast++) {
+		sum = 0;
+		for (int i = 0; i < PRODUCERS; i++) {
+			pthread_create(&threads[i], NULL, producer, NULL);
+		}
+		for (int i = 0; i < CONSUMERS; i++) {
+			pthread_create(&threads[PRODUCERS + i], NULL, consumer, NULL);
+		}
+		for (int i = 0; i < PRODUCERS + CONSUMERS; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		check(count == 0);
+		check(sum == expected);
+	}
+
+	// a signal ends a timed wait before its deadline
+	go = 0;
+	pthread_create(&threads[0], NULL, timed_waiter, NULL);
+	for (;;) {
+		check(pthread_mutex_lock(&lock) == 0);
+		if (waiting == 1) {
+			break;
+		}
+		check(pthread_mutex_unlock(&lock) == 0);
+		sched_yield();
+	}
+	go = 1;
+	check(pthread_cond_signal(&cond) == 0);
+	check(pthread_mutex_unlock(&lock) == 0);
+	pthread_join(threads[0], NULL);
+	return 0;
+}
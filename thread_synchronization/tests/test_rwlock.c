@@ -0,0 +1,186 @@
+/* Reader-writer locks: try and timed locks, readers admitted in one batch
+ * after a writer, the two policies, mutual exclusion under load, and a
+ * writer parked while the last reader leaves (it must not be left parked on
+ * a free lock). Runs on several workers.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BATCH 8
+#define STRESS_READERS 6
+#define STRESS_WRITERS 3
+#define STRESS_ROUNDS 2000
+#define RACES 1000
+
+#define check(cond) do { if (!(cond)) { \
+	printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_barrier_t batch;
+static volatile int readers_in, writers_in, bad;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct timespec in_ms(long ms)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += ms % 1000 * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+/* holds the read lock until all BATCH readers hold it: they only all get
+there if they are let in together */
+static void *batch_reader(void *arg)
+{
+	check(pthread_rwlock_rdlock(&rwlock) == 0);
+	pthread_barrier_wait(&batch);
+	check(pthread_rwlock_unlock(&rwlock) == 0);
+	return arg;
+}
+
+static void *stress_reader(void *arg)
+{
+	for (int i = 0; i < STRESS_ROUNDS; i++) {
+		check(pthread_rwlock_rdlock(&rwlock) == 0);
+		__atomic_add_fetch(&readers_in, 1, __ATOMIC_SEQ_CST);
+		if (writers_in != 0) {
+			bad = 1;
+		}
+		if (i % 3 == 0) {
+			sched_yield();
+		}
+		__atomic_sub_fetch(&readers_in, 1, __ATOMIC_SEQ_CST);
+		check(pthread_rwlock_unlock(&rwlock) == 0);
+	}
+	return arg;
+}
+
+static void *stress_writer(void *arg)
+{
+	for (int i = 0; i < STRESS_ROUNDS / 4; i++) {
+		check(pthread_rwlock_wrlock(&rwlock) == 0);
+		if (__atomic_add_fetch(&writers_in, 1, __ATOMIC_SEQ_CST) != 1 || readers_in != 0) {
+			bad = 1;
+		}
+		sched_yield();
+		__atomic_sub_fetch(&writers_in, 1, __ATOMIC_SEQ_CST);
+		check(pthread_rwlock_unlock(&rwlock) == 0);
+	}
+	return arg;
+}
+
+/* a reader that lets go of its lock while a writer parks on it, after a
+delay that varies with arg to hit the writer at different points (on
+another worker, which runs alongside on a multi-core machine) */
+static void *racing_reader(void *arg)
+{
+	for (long i = 0; i < (long)arg % 64 * 16; i++) {
+		__builtin_ia32_pause();
+	}
+	check(pthread_rwlock_unlock(&rwlock) == 0);
+	return arg;
+}
+
+int main(void)
+{
+	setenv("THREAD_WORKERS", "4", 0);
+	pthread_t threads[STRESS_READERS + STRESS_WRITERS];
+
+	// try and timed locks
+	check(pthread_rwlock_tryrdlock(&rwlock) == 0);
+	check(pthread_rwlock_tryrdlock(&rwlock) == 0);
+	check(pthread_rwlock_trywrlock(&rwlock) == EBUSY);
+	struct timespec soon = in_ms(20);
+	check(pthread_rwlock_timedwrlock(&rwlock, &soon) == ETIMEDOUT);
+	check(pthread_rwlock_destroy(&rwlock) == EBUSY);
+	check(pthread_rwlock_unlock(&rwlock) == 0);
+	check(pthread_rwlock_unlock(&rwlock) == 0);
+	check(pthread_rwlock_trywrlock(&rwlock) == 0);
+	check(pthread_rwlock_tryrdlock(&rwlock) == EBUSY);
+	soon = in_ms(20);
+	check(pthread_rwlock_timedrdlock(&rwlock, &soon) == ETIMEDOUT);
+	struct timespec bad_time = {0, 1000000000};
+	check(pthread_rwlock_timedrdlock(&rwlock, &bad_time) == EINVAL);
+	check(pthread_rwlock_unlock(&rwlock) == 0);
+
+	// readers parked behind a writer get in together
+	pthread_barrier_init(&batch, NULL, BATCH);
+	check(pthread_rwlock_wrlock(&rwlock) == 0);
+	for (int i = 0; i < BATCH; i++) {
+		pthread_create(&threads[i], NULL, batch_reader, NULL);
+	}
+	for (int i = 0; i < 10; i++) {
+		sched_yield();
+	}
+	check(pthread_rwlock_unlock(&rwlock) == 0);
+	for (int i = 0; i < BATCH; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_barrier_destroy(&batch);
+
+	// a waiting writer keeps new readers out, unless readers are preferred
+	pthread_t w;
+	check(pthread_rwlock_rdlock(&rwlock) == 0);
+	pthread_create(&w, NULL, stress_writer, NULL);
+	double start = now();
+	while (pthread_rwlock_tryrdlock(&rwlock) == 0) { // until the writer waits
+		check(pthread_rwlock_unlock(&rwlock) == 0);
+		check(now() - start < 2.0);
+		sched_yield();
+	}
+	check(pthread_rwlock_unlock(&rwlock) == 0);
+	pthread_join(w, NULL);
+
+	pthread_rwlock_t readers_first;
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_READER_NP);
+	check(pthread_rwlock_init(&readers_first, &attr) == 0);
+	check(pthread_rwlock_rdlock(&readers_first) == 0);
+	check(pthread_rwlock_tryrdlock(&readers_first) == 0);
+	check(pthread_rwlock_unlock(&readers_first) == 0);
+	check(pthread_rwlock_unlock(&readers_first) == 0);
+	check(pthread_rwlock_destroy(&readers_first) == 0);
+
+	// mutual exclusion
+	for (int i = 0; i < STRESS_READERS; i++) {
+		pthread_create(&threads[i], NULL, stress_reader, NULL);
+	}
+	for (int i = 0; i < STRESS_WRITERS; i++) {
+		pthread_create(&threads[STRESS_READERS + i], NULL, stress_writer, NULL);
+	}
+	for (int i = 0; i < STRESS_READERS + STRESS_WRITERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	check(!bad);
+
+	// the last reader leaves as a writer parks: the writer must get the
+	// lock then, not at its deadline
+	for (int i = 0; i < RACES; i++) {
+		check(pthread_rwlock_rdlock(&rwlock) == 0);
+		pthread_create(&w, NULL, racing_reader, (void *)(long)i);
+		start = now();
+		struct timespec deadline = in_ms(2000);
+		check(pthread_rwlock_timedwrlock(&rwlock, &deadline) == 0);
+		check(now() - start < 1.0);
+		check(pthread_rwlock_unlock(&rwlock) == 0);
+		pthread_join(w, NULL);
+	}
+	check(pthread_rwlock_destroy(&rwlock) == 0);
+	return 0;
+}
@@ -1,15 +1,29 @@
+#define _GNU_SOURCE
 #include "ec440threads.h"
+#include "threads_ext.h"
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <stddef.h>
-#include <setjmp.h>
+#include <dlfcn.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <linux/futex.h>
+#include <time.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 /* You can support more threads. At least support this many. */
 #define MAX_THREADS 128
@@ -17,23 +31,94 @@
 /* Your stack should be this many bytes in size */
 #define THREAD_STACK_SIZE 32767
 
-/* Number of microseconds between scheduling events */
+/* Free stacks kept for reuse by pthread_create, the rest are unmapped */
+#define STACK_POOL_MAX 64
+
+/* A thread created with a stack size set in its pthread_attr_t reserves that
+ * much address space but starts with this many pages committed; faults below
+ * them commit at least STACK_GROW_PAGES more, down to the reserved limit.
+ */
+#define STACK_COMMIT_PAGES 2
+#define STACK_GROW_PAGES 4
+
+/* TCBs are carved out of slabs of this many and never freed, only reused */
+#define TCB_SLAB 64
+
+/* Exited threads a worker collects before it releases their stacks and TCBs */
+#define REAP_BATCH 16
+
+/* Tasks are carved out of slabs of this many. Past TASK_QUEUE_MAX queued
+ * tasks, the spawner runs a new task itself instead of queueing it.
+ */
+#define TASK_SLAB 256
+#define TASK_QUEUE_MAX 4096
+
+/* Upper bound on the number of workers (kernel threads running green threads) */
+#define MAX_WORKERS 64
+
+/* Pause instructions a spinlock waiter spends before yielding the core */
+#define SPIN_LIMIT 1000
+
+/* TSC ticks a thread may spin for a mutex whose owner runs on another worker:
+ * twice the mutex's average hold time, at least MUTEX_SPIN_MIN; a mutex held
+ * for longer than MUTEX_SPIN_MAX on average parks its waiters right away
+ */
+#define MUTEX_SPIN_MIN 1000
+#define MUTEX_SPIN_MAX 20000
+
+/* Unlocking a mutex wakes its longest parked thread to compete for it again,
+ * but hands the mutex straight to it once it waited this long (ns)
+ */
+#define MUTEX_FAIR_NS 1000000LL
+
+/* Fan-in of the nodes of a tree barrier, and TSC ticks a thread waiting in
+ * one spins with more than one worker before it parks
+ */
+#define BARRIER_FANIN 4
+#define BARRIER_SPIN 20000
+
+/* Default time slice in microseconds, THREAD_QUANTUM_USECS in the environment
+ * overrides it and pthread_settimeslice_np() sets it per thread
+ */
 #define SCHEDULER_INTERVAL_USECS (50 * 1000)
 
-/* Size of an address in a thread stack */
-#define ADDRESS_SIZE 8
+/* The reactor keeps the state of fds below IO_CHUNK * IO_CHUNKS, allocated
+ * IO_CHUNK at a time, and takes up to IO_EVENTS events per epoll_wait
+ */
+#define IO_CHUNK 1024
+#define IO_CHUNKS 1024
+#define IO_EVENTS 64
+
+/* Timing wheel for sleeps and timed waits: WHEEL_LEVELS levels of WHEEL_SIZE
+ * slots, a slot of level 0 spans WHEEL_TICK_NS and one of level l spans
+ * WHEEL_SIZE^l of those, about 30 hours in all. Later deadlines wait in the
+ * last slot and are placed again when it comes up.
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 5
+#define WHEEL_TICK_NS 100000LL
+
+/* Buckets of the parking table where threads wait for mutexes and barriers */
+#define PARK_BUCKETS 1024
+
+/* Events each worker keeps while tracing, the oldest are overwritten */
+#define TRACE_EVENTS (1 << 16)
+
+/* Weight of a nice 0 thread under the fair policy: its virtual runtime advances
+ * at the speed of real time, heavier threads' slower and lighter threads' faster
+ */
+#define NICE_0_WEIGHT 1024
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 
-/* Extracted from private libc headers. These are not part of the public
- * interface for jmp_buf.
+/* Default MXCSR (all exceptions masked) and x87 control word (extended
+ * precision, all exceptions masked) a new thread starts with.
  */
-#define JB_RBX 0
-#define JB_RBP 1
-#define JB_R12 2
-#define JB_R13 3
-#define JB_R14 4
-#define JB_R15 5
-#define JB_RSP 6
-#define JB_PC 7
+#define MXCSR_DEFAULT 0x1f80UL
+#define FPUCW_DEFAULT 0x037fUL
 
 /* thread_status identifies the current state of a thread. You can add, rename,
  * or delete these values. This is only a suggestion. */
@@ -45,6 +130,40 @@ enum thread_status
 	TS_BLOCKED
 };
 
+/* what a blocked thread waits for */
+enum wait_reason
+{
+	WAIT_MUTEX,
+	WAIT_BARRIER,
+	WAIT_JOIN,
+	WAIT_IO,
+	WAIT_SLEEP,
+	WAIT_TASK,
+	WAIT_CHAN,
+	WAIT_COND,
+	WAIT_RWLOCK
+};
+
+enum task_state
+{
+	TASK_QUEUED,
+	TASK_RUNNING,
+	TASK_DONE,
+	TASK_FREE // in the pool
+};
+
+/* a function run by a runner thread, see task_spawn() */
+struct thread_task {
+	void *(*fn)(void *);
+	void* arg;
+	void* result;
+	enum task_state state;
+	task_group_t* group; // NULL for a task that is awaited on its own
+	struct thread_control_block* awaiter;
+	struct thread_task* next; // in the task queue or the pool
+	struct thread_task* prev;
+};
+
 /* The thread control block stores information about a thread. You will
  * need one of this per thread.
  */
@@ -52,501 +171,3698 @@ struct thread_control_block {
 	/* TODO: add a thread ID */
 	pthread_t id;
 	/* TODO: add information about its stack */
-	char* stack;
+	char* stack; // lowest usable (committed) byte
+	char* stack_top;
+	char* stack_limit; // lowest byte a growable stack may commit, NULL for pool stacks
+	                   // (the guard page is right below stack_limit or stack)
 	/* TODO: add information about its registers */
-	jmp_buf env;
+	void* sp; // saved by context_switch, the registers are on the thread's stack
+	void *(*start_routine)(void *);
+	void* arg;
 	/* TODO: add information about the status (e.g., use enum thread_status) */
 	enum thread_status status;
 	/* Add other information you need to manage this thread */
-	struct thread_control_block* next; 
+	long long slice; // time slice in ns, also bounds how long the thread waits once ready
+	int nice; // -20..19, inherited by the threads it creates
+	int weight; // of the nice value
+	long long vruntime; // run time in ns scaled by NICE_0_WEIGHT / weight
+	/* timeout of a sleep or timed wait, in a slot list of the timing wheel */
+	long long wake_at; // monotonic ns
+	struct thread_control_block* timer_next;
+	struct thread_control_block** timer_pprev; // NULL while no timeout is pending
+	int timer_level;
+	void (*on_timeout)(struct thread_control_block*); // takes the thread off what it waits on
+	void* wait_obj;
+	int wait_result; // ETIMEDOUT once the timeout expired
+	/* exit and join */
+	void* retval;
+	struct thread_control_block* joiner; // parked in pthread_join until we exit
+	bool detached; // nobody joins, the reaper frees the TCB (also set once joined)
+	bool reaped; // the stack is released, the TCB is freed once detached
+	/* time in each state while tracing, in TSC ticks */
+	unsigned long long state_since; // the last change of state
+	unsigned long long run_tsc;
+	unsigned long long ready_tsc;
+	unsigned long long blocked_tsc;
+	unsigned long switches; // times switched to
+	struct thread_task* task; // the task a runner is running
+	/* links in a wait queue, of a bucket of the parking table for a thread
+	parked on park_addr */
+	struct thread_control_block* wait_next;
+	struct thread_control_block* wait_prev;
+	const void* park_addr;
+	long long wait_since; // when it began to wait for a mutex
+	struct thread_control_block* next; // link in a ready queue, a wait list or the reap list
 };
 
 /* Declare global variables here */
-pthread_t thread_id_count;
-struct thread_control_block* curr_thread;
 typedef struct {
 	struct thread_control_block* head;
 	struct thread_control_block* tail;
+	int count;
 }Queue;
-Queue* thread_queue;
 
-/* lock functions to disable/enable scheduler 
-prevent scheduler from running when threading library is internally in a critical section 
+/* blocked threads in FIFO order, linked through wait_next and wait_prev in
+their TCBs: no allocation, and a thread that gives up is unlinked in O(1) */
+struct wait_queue {
+	struct thread_control_block* head;
+	struct thread_control_block* tail;
+};
+
+/* Scheduler tracing: every worker records its events in a ring of its own.
+ * Only the worker writes to its ring, with preemption off, so storing head
+ * publishes an event without a lock; a dump reads the rings while they fill.
+ */
+enum trace_type
+{
+	TR_SWITCH, // from thread to other, arg is the status thread is left in
+	TR_BLOCK, // arg is the wait_reason
+	TR_WAKE, // other woke thread
+	TR_CREATE, // other created thread
+	TR_EXIT
+};
+
+struct trace_event {
+	unsigned long long tsc;
+	pthread_t thread;
+	pthread_t other;
+	int type;
+	int arg;
+};
+
+struct trace_ring {
+	unsigned long long head; // events recorded so far, the next goes to head % TRACE_EVENTS
+	struct trace_event events[TRACE_EVENTS];
+};
+
+/* the trace id of the scheduler loops of the workers */
+#define TRACE_IDLE ((pthread_t)-1)
+
+/* A worker is a kernel thread that runs green threads. Each worker has its own
+ * ready queue: the running thread is off it and blocked/exited threads are never
+ * put back, so picking the next thread is O(1). A worker whose queue is empty
+ * steals half of another worker's queue, and sleeps when there is nothing to steal.
+ * Under the fair policy the ready threads are in a min-heap on vruntime instead,
+ * and ready.count is its size.
+ */
+struct worker {
+	int id;
+	pid_t tid;
+	Queue ready;
+	struct thread_control_block** heap; // fair policy, sized for all threads by pthread_create
+	int heap_cap;
+	int ready_lock; // spinlock, thieves take it too
+	long long ready_slice; // shortest slice queued since the queue was last empty
+	struct thread_control_block* curr;
+	struct thread_control_block idle; // context of the worker's scheduler loop
+	int preempt_count; // > 0 while the running code must not be switched away from
+	bool preempt_pending; // the timer fired meanwhile
+	/* left behind by the thread we switched away from, handled once we are off its stack */
+	struct thread_control_block* requeue;
+	struct thread_control_block* zombie;
+	bool release_sched_lock;
+	struct thread_control_block* reap_list; // exited threads whose stacks are still allocated
+	int reap_count;
+	timer_t timer;
+	long long slice_end; // preempt the running thread then, 0 while nothing else is ready (tickless)
+	long long timer_at; // when the timer fires, 0 while it is disarmed
+	long long run_start; // when the running thread was switched to (fair policy)
+	long long min_vruntime; // never decreases, threads that were not ready are placed near it
+	struct trace_ring* trace; // allocated when tracing is first turned on
+};
+
+static struct worker workers[MAX_WORKERS];
+static int nworkers;
+static __thread struct worker* self;
+
+static int sched_lock; // spinlock over mutexes, barriers, the stack pool and the reactor
+static struct thread_control_block* main_thread; // its id is 0, other ids are TCB addresses
+static long long quantum; // default time slice in ns
+static bool fair_policy; // THREAD_SCHED=fair: pick the ready thread with the least vruntime
+
+/* weight of nice -20..19, each step is about 10% of processor time */
+static const int nice_weight[40] = {
+	88761, 71755, 56483, 46273, 36291,
+	29154, 23254, 18705, 14949, 11916,
+	9548, 7620, 6100, 4904, 3906,
+	3121, 2501, 1991, 1586, 1277,
+	1024, 820, 655, 526, 423,
+	335, 272, 215, 172, 137,
+	110, 87, 70, 56, 45,
+	36, 29, 23, 18, 15,
+};
+static int live_threads; // the process exits when the last one does
+static unsigned work_seq; // bumped whenever a thread is queued, idle workers wait on it
+static int idle_workers;
+
+/* Reactor: read, write, accept and connect on a socket or pipe put it in
+non-blocking mode and register it with epoll (edge-triggered). A call that
+would block parks the thread on the fd until an event wakes it to try again.
+One idle worker waits in epoll_wait, busy workers poll at their timer ticks. */
+enum io_mode {
+	IO_UNKNOWN, // not used by a green thread since it was opened
+	IO_REACTOR,
+	IO_PASS // blocking as usual: a regular file, a standard stream or already non-blocking
+};
+
+struct io_fd {
+	enum io_mode mode;
+	unsigned seq; // bumped by every event, a wait that saw an older value does not park
+	struct thread_control_block* readers; // parked threads, linked through next
+	struct thread_control_block* writers;
+};
+
+static struct io_fd* io_fds[IO_CHUNKS];
+static int epoll_fd = -1;
+static int wake_fd; // eventfd, interrupts the worker blocked in epoll_wait
+static int io_waiters; // parked threads
+static int io_poller; // a worker is blocked in epoll_wait
+
+/* the timing wheel, under sched_lock */
+static struct {
+	long long tick; // the last tick whose timeouts were run
+	int count;
+	int level_count[WHEEL_LEVELS];
+	struct thread_control_block* slots[WHEEL_LEVELS][WHEEL_SIZE];
+} wheel;
+static long long wheel_due; // run the wheel then (monotonic ns), 0 while it is empty
+static timer_t wheel_timer; // signals worker 0 at wheel_due
+static long long wheel_timer_at; // 0 while it is disarmed
+
+/* tracing, see pthread_trace_np() */
+static bool trace_on;
+static unsigned long long trace_epoch; // TSC when tracing was last turned on
+static unsigned long long tsc_base; // TSC and monotonic clock at scheduler_init,
+static long long tsc_base_ns; // to convert TSC ticks to time
+
+/* the kernel threads of the workers come from the pthread_create we replace */
+static int (*real_pthread_create)(pthread_t*, const pthread_attr_t*, void *(*)(void *), void*);
+
+/* stack pool: page-aligned stacks with a PROT_NONE guard page below them.
+Free stacks are linked through their first word. */
+static size_t page_size;
+static size_t stack_size; // THREAD_STACK_SIZE rounded up to whole pages
+static size_t default_stacksize; // what pthread_attr_getstacksize gives for a new attr
+static char* stack_pool;
+static int stack_pool_count;
+
+/* growable stacks of exited threads kept for reuse, up to STACK_POOL_MAX; the
+record is at the top of the stack, and only the top STACK_COMMIT_PAGES stay
+committed */
+struct grow_stack {
+	struct grow_stack* next;
+	char* limit;
+	char* stack;
+};
+static struct grow_stack* grow_pool;
+static int grow_pool_count;
+
+/* free TCBs, linked through next */
+static struct thread_control_block* tcb_pool;
+
+/* Parking table, under sched_lock: a thread blocked on a mutex or barrier
+waits in the bucket of its address, so those objects hold no pointers and
+need no allocation. A bucket queues the threads of all addresses that hash to
+it in FIFO order; finding the threads of one address skips only those. */
+static struct wait_queue park_table[PARK_BUCKETS];
+
+/* tasks, under sched_lock: the queue of tasks not started yet and the
+runners, threads that run them. task_runners counts the runners neither
+parked nor blocked in a task, there are nworkers of those while tasks wait. */
+static struct thread_task* task_head;
+static struct thread_task* task_tail;
+static int task_queued;
+static struct thread_task* task_pool; // free tasks, linked through next
+static struct thread_control_block* idle_runners; // parked, linked through next
+static int idle_runner_count;
+static int task_runners;
+
+/* the worker we are running on; a thread can move to another worker at every
+switch, so it must be looked up again after one */
+static __attribute__((noinline)) struct worker* this_worker()
+{
+	asm volatile("");
+	return self;
+}
+
+#define curr_thread (this_worker()->curr)
+
+/* spinlocks are held for a few instructions, but the kernel thread holding one
+can be descheduled: then give the core away instead of spinning out our slice */
+static void spin_lock(int* l)
+{
+	int spins = 0;
+	while (__atomic_exchange_n(l, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(l, __ATOMIC_RELAXED)) {
+			if (++spins < SPIN_LIMIT) {
+				__builtin_ia32_pause();
+			}
+			else {
+				syscall(SYS_sched_yield);
+			}
+		}
+	}
+}
+
+static void spin_unlock(int* l)
+{
+	__atomic_store_n(l, 0, __ATOMIC_RELEASE);
+}
+
+static void schedule(int signal);
+static void task_runner_add();
+static void slice_check(struct worker* w);
+
+/* keep the timer of this worker from preempting the running thread: the
+signal handler only notes the tick and preempt_on() switches for it. The count
+belongs to the worker (kernel thread), like a signal mask would. A tick between
+reading the worker and raising its count can still move the thread, which then
+raised the count of the worker it left: it takes that back and tries again on
+the worker it runs on now. */
+static void preempt_off()
+{
+	for (;;) {
+		struct worker* w = this_worker();
+		if (w == NULL) { // before the first pthread_create there is no timer
+			return;
+		}
+		__atomic_add_fetch(&w->preempt_count, 1, __ATOMIC_RELAXED);
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		if (this_worker() == w) {
+			return;
+		}
+		if (__atomic_sub_fetch(&w->preempt_count, 1, __ATOMIC_RELAXED) == 0 && w->preempt_pending) {
+			// its own preempt_on() saw our count and left the tick: hand it back
+			syscall(SYS_tgkill, getpid(), w->tid, SIGALRM);
+		}
+	}
+}
+
+static void preempt_on()
+{
+	struct worker* w = this_worker();
+	if (w != NULL) {
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_sub_fetch(&w->preempt_count, 1, __ATOMIC_RELAXED) == 0) {
+			w = this_worker(); // preemptible again, a tick may have moved us
+			if (w->preempt_pending) {
+				w->preempt_pending = false;
+				slice_check(w);
+			}
+		}
+	}
+}
+
+/* lock functions to disable/enable scheduler
+prevent scheduler from running when threading library is internally in a critical section
 (users of library will use barriers and mutexes for critical sections that are external to thelibrary)
 */
 static void lock()
 {
-	sigset_t sig;
-	sigemptyset(&sig);
-	sigaddset(&sig, SIGALRM);
-	sigprocmask(SIG_BLOCK, &sig, NULL);
+	preempt_off();
+	spin_lock(&sched_lock);
+}
+
+static void unlock()
+{
+	spin_unlock(&sched_lock);
+	preempt_on();
+}
+
+/* append a TCB to the tail of a queue */
+void queue_insert(Queue* queue, struct thread_control_block* new_thread) {
+	new_thread->next = NULL;
+	if(queue->head == NULL) {
+		queue->head = new_thread;
+	}
+	else {
+		queue->tail->next = new_thread;
+	}
+	queue->tail = new_thread;
+	queue->count++;
+}
+
+/* take the TCB at the head of a queue, NULL if it is empty */
+struct thread_control_block* queue_remove(Queue* queue) {
+	struct thread_control_block* t = queue->head;
+	if(t != NULL) {
+		queue->head = t->next;
+		if(queue->head == NULL) {
+			queue->tail = NULL;
+		}
+		t->next = NULL;
+		queue->count--;
+	}
+	return t;
+}
+
+/* append a blocked thread to a wait queue (lock() held) */
+static void wait_enqueue(struct wait_queue* q, struct thread_control_block* t)
+{
+	t->wait_next = NULL;
+	t->wait_prev = q->tail;
+	if (q->tail != NULL) {
+		q->tail->wait_next = t;
+	}
+	else {
+		q->head = t;
+	}
+	q->tail = t;
+}
+
+/* take a thread out of a wait queue it is on (lock() held) */
+static void wait_unlink(struct wait_queue* q, struct thread_control_block* t)
+{
+	if (t->wait_prev != NULL) {
+		t->wait_prev->wait_next = t->wait_next;
+	}
+	else {
+		q->head = t->wait_next;
+	}
+	if (t->wait_next != NULL) {
+		t->wait_next->wait_prev = t->wait_prev;
+	}
+	else {
+		q->tail = t->wait_prev;
+	}
+}
+
+/* the bucket of the parking table for addr */
+static struct wait_queue* park_bucket(const void* addr)
+{
+	uint64_t h = (uint64_t)(uintptr_t)addr * 0x9e3779b97f4a7c15ULL;
+	return &park_table[(h >> 32) % PARK_BUCKETS];
+}
+
+/* park thread t on addr, it calls thread_block() next (lock() held) */
+static void park_enqueue(const void* addr, struct thread_control_block* t)
+{
+	t->park_addr = addr;
+	wait_enqueue(park_bucket(addr), t);
+}
+
+/* take the longest parked thread on addr out of the table, NULL if there is
+none (lock() held) */
+static struct thread_control_block* park_dequeue(const void* addr)
+{
+	struct wait_queue* q = park_bucket(addr);
+	for (struct thread_control_block* t = q->head; t != NULL; t = t->wait_next) {
+		if (t->park_addr == addr) {
+			wait_unlink(q, t);
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* take a parked thread out of the table, when it gives up waiting (lock() held) */
+static void park_unlink(struct thread_control_block* t)
+{
+	wait_unlink(park_bucket(t->park_addr), t);
+}
+
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* is tracing on? A load and a predicted branch when it is off */
+static inline bool tracing()
+{
+	return __builtin_expect(__atomic_load_n(&trace_on, __ATOMIC_RELAXED), 0);
+}
+
+/* append an event to the ring of worker w, the one we are running on (preemption off) */
+static void trace_record(struct worker* w, int type, struct thread_control_block* t,
+	struct thread_control_block* other, int arg, unsigned long long tsc)
+{
+	struct trace_ring* ring = w->trace;
+	struct trace_event* e = &ring->events[ring->head % TRACE_EVENTS];
+	e->tsc = tsc;
+	e->thread = t == &w->idle ? TRACE_IDLE : t->id;
+	e->other = other == NULL ? 0 : other == &w->idle ? TRACE_IDLE : other->id;
+	e->type = type;
+	e->arg = arg;
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* add the time t spent in its state since it last changed to counter (tracing) */
+static void trace_charge(struct thread_control_block* t, unsigned long long* counter, unsigned long long now)
+{
+	unsigned long long since = t->state_since > trace_epoch ? t->state_since : trace_epoch;
+	*counter += now - since;
+	t->state_since = now;
+}
+
+/* make the timer of worker w fire by w->slice_end. A timer that fires before
+the slice is over just re-arms itself, so moving the end later costs no syscall. */
+static void timer_update(struct worker* w)
+{
+	if (w->slice_end == 0 || (w->timer_at != 0 && w->timer_at <= w->slice_end)) {
+		return;
+	}
+	struct itimerspec its;
+	its.it_interval.tv_sec = 0;
+	its.it_interval.tv_nsec = 0;
+	its.it_value.tv_sec = w->slice_end / 1000000000LL;
+	its.it_value.tv_nsec = w->slice_end % 1000000000LL;
+	timer_settime(w->timer, TIMER_ABSTIME, &its, NULL);
+	w->timer_at = w->slice_end;
+}
+
+/* start the time slice of t, about to run on worker w (preemption off);
+a thread with nothing else ready next to it is not interrupted at all,
+unless other threads wait for I/O */
+static void slice_begin(struct worker* w, struct thread_control_block* t)
+{
+	if (t == &w->idle) {
+		w->slice_end = 0;
+		return;
+	}
+	if (__atomic_load_n(&w->ready.count, __ATOMIC_RELAXED) == 0) {
+		// threads waiting for I/O need the ticks to poll for events
+		w->slice_end = __atomic_load_n(&io_waiters, __ATOMIC_RELAXED) > 0 ? now_ns() + t->slice : 0;
+		timer_update(w);
+		return;
+	}
+	w->slice_end = now_ns() + (t->slice < w->ready_slice ? t->slice : w->ready_slice);
+	timer_update(w);
+}
+
+/* add a ready thread to the run queue of worker w (its ready_lock held) */
+static void runq_insert(struct worker* w, struct thread_control_block* t)
+{
+	if (!fair_policy) {
+		queue_insert(&w->ready, t);
+		return;
+	}
+	int i = w->ready.count++;
+	while (i > 0 && w->heap[(i - 1) / 2]->vruntime > t->vruntime) {
+		w->heap[i] = w->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	w->heap[i] = t;
+}
+
+/* take the next thread to run from the run queue of worker w, NULL if it is
+empty (its ready_lock held) */
+static struct thread_control_block* runq_remove(struct worker* w)
+{
+	if (!fair_policy) {
+		return queue_remove(&w->ready);
+	}
+	if (w->ready.count == 0) {
+		return NULL;
+	}
+	struct thread_control_block* t = w->heap[0];
+	struct thread_control_block* last = w->heap[--w->ready.count];
+	int i = 0;
+	for (;;) {
+		int c = 2 * i + 1;
+		if (c >= w->ready.count) {
+			break;
+		}
+		if (c + 1 < w->ready.count && w->heap[c + 1]->vruntime < w->heap[c]->vruntime) {
+			c++;
+		}
+		if (w->heap[c]->vruntime >= last->vruntime) {
+			break;
+		}
+		w->heap[i] = w->heap[c];
+		i = c;
+	}
+	w->heap[i] = last;
+	return t;
+}
+
+/* where t is in the run queue of worker w, -1 if it is not in it (its
+ready_lock held) */
+static int runq_find(struct worker* w, struct thread_control_block* t)
+{
+	if (!fair_policy) {
+		int i = 0;
+		for (struct thread_control_block* q = w->ready.head; q != NULL; q = q->next, i++) {
+			if (q == t) {
+				return i;
+			}
+		}
+		return -1;
+	}
+	for (int i = 0; i < w->ready.count; i++) {
+		if (w->heap[i] == t) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* move the thread at position i of the fair heap of worker w into place
+after its vruntime changed (its ready_lock held) */
+static void runq_fix(struct worker* w, int i)
+{
+	struct thread_control_block* t = w->heap[i];
+	while (i > 0 && w->heap[(i - 1) / 2]->vruntime > t->vruntime) {
+		w->heap[i] = w->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	for (;;) {
+		int c = 2 * i + 1;
+		if (c >= w->ready.count) {
+			break;
+		}
+		if (c + 1 < w->ready.count && w->heap[c + 1]->vruntime < w->heap[c]->vruntime) {
+			c++;
+		}
+		if (w->heap[c]->vruntime >= t->vruntime) {
+			break;
+		}
+		w->heap[i] = w->heap[c];
+		i = c;
+	}
+	w->heap[i] = t;
+}
+
+/* make room for n threads in the run queue of every worker (lock() held) */
+static int runq_reserve(int n)
+{
+	for (int i = 0; fair_policy && i < nworkers; i++) {
+		struct worker* w = &workers[i];
+		if (w->heap_cap >= n) {
+			continue;
+		}
+		int cap = w->heap_cap > 0 ? w->heap_cap : 64;
+		while (cap < n) {
+			cap *= 2;
+		}
+		spin_lock(&w->ready_lock);
+		struct thread_control_block** heap = realloc(w->heap, cap * sizeof(*heap));
+		if (heap != NULL) {
+			w->heap = heap;
+			w->heap_cap = cap;
+		}
+		spin_unlock(&w->ready_lock);
+		if (heap == NULL) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* queue a ready thread on worker w and wake an idle worker to pick it up */
+static void ready_push(struct worker* w, struct thread_control_block* t)
+{
+	// a thread that was blocked or ran on another worker gets at most half a
+	// quantum of credit, it cannot claim the processor for the time it was away
+	if (fair_policy && t->vruntime < w->min_vruntime - quantum / 2) {
+		t->vruntime = w->min_vruntime - quantum / 2;
+	}
+
+	spin_lock(&w->ready_lock);
+	if (w->ready.count == 0 || t->slice < w->ready_slice) {
+		w->ready_slice = t->slice;
+	}
+	runq_insert(w, t);
+	spin_unlock(&w->ready_lock);
+
+	// the running thread keeps the processor for at most its own time slice or
+	// that of t, whichever ends first, and so do the threads after it as long as
+	// t may still be queued: a short slice gives a short wakeup latency
+	if (w->curr != &w->idle) {
+		long long now = now_ns();
+		long long end = now + t->slice;
+		if (w->slice_end == 0 && now + w->curr->slice < end) {
+			end = now + w->curr->slice;
+		}
+		if (w->slice_end == 0 || end < w->slice_end) {
+			w->slice_end = end;
+			timer_update(w);
+		}
+	}
+
+	__atomic_add_fetch(&work_seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&idle_workers, __ATOMIC_SEQ_CST) > 0) {
+		if (syscall(SYS_futex, &work_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0) == 0 &&
+			__atomic_load_n(&io_poller, __ATOMIC_SEQ_CST)) {
+			uint64_t one = 1;
+			syscall(SYS_write, wake_fd, &one, sizeof(one));
+		}
+	}
+}
+
+/* take half of the ready threads of another worker, returns the first one */
+static struct thread_control_block* steal(struct worker* w)
+{
+	for (int i = 1; i < nworkers; i++) {
+		struct worker* victim = &workers[(w->id + i) % nworkers];
+		if (__atomic_load_n(&victim->ready.count, __ATOMIC_RELAXED) == 0) {
+			continue;
+		}
+
+		Queue batch = {NULL, NULL, 0};
+		spin_lock(&victim->ready_lock);
+		int n = (victim->ready.count + 1) / 2;
+		while (n-- > 0) {
+			queue_insert(&batch, runq_remove(victim));
+		}
+		spin_unlock(&victim->ready_lock);
+
+		struct thread_control_block* t = queue_remove(&batch);
+		if (t == NULL) {
+			continue;
+		}
+		if (batch.head != NULL) {
+			spin_lock(&w->ready_lock);
+			if (w->ready.count == 0) {
+				w->ready_slice = batch.head->slice;
+			}
+			while (batch.head != NULL) {
+				if (batch.head->slice < w->ready_slice) {
+					w->ready_slice = batch.head->slice;
+				}
+				runq_insert(w, queue_remove(&batch));
+			}
+			spin_unlock(&w->ready_lock);
+		}
+		return t;
+	}
+	return NULL;
+}
+
+/* the next thread for worker w to run, NULL if there is none anywhere */
+static struct thread_control_block* find_next(struct worker* w)
+{
+	struct thread_control_block* t = NULL;
+	if (__atomic_load_n(&w->ready.count, __ATOMIC_RELAXED) > 0) {
+		spin_lock(&w->ready_lock);
+		t = runq_remove(w);
+		spin_unlock(&w->ready_lock);
+	}
+	return t != NULL ? t : steal(w);
+}
+
+/* put t in the slot of the wheel for t->wake_at, O(1) (lock() held) */
+static void wheel_insert(struct thread_control_block* t)
+{
+	long long expires = (t->wake_at + WHEEL_TICK_NS - 1) / WHEEL_TICK_NS;
+	if (expires <= wheel.tick) {
+		expires = wheel.tick + 1;
+	}
+	long long delta = expires - wheel.tick;
+	if (delta >= 1LL << (WHEEL_BITS * WHEEL_LEVELS)) {
+		expires = wheel.tick + (1LL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+		delta = expires - wheel.tick;
+	}
+	int level = 0;
+	while (delta >= 1LL << (WHEEL_BITS * (level + 1))) {
+		level++;
+	}
+
+	struct thread_control_block** slot = &wheel.slots[level][(expires >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)];
+	t->timer_next = *slot;
+	if (*slot != NULL) {
+		(*slot)->timer_pprev = &t->timer_next;
+	}
+	*slot = t;
+	t->timer_pprev = slot;
+	t->timer_level = level;
+	wheel.level_count[level]++;
+	wheel.count++;
+}
+
+/* take t out of the wheel, O(1) (lock() held) */
+static void wheel_remove(struct thread_control_block* t)
+{
+	*t->timer_pprev = t->timer_next;
+	if (t->timer_next != NULL) {
+		t->timer_next->timer_pprev = t->timer_pprev;
+	}
+	t->timer_pprev = NULL;
+	wheel.level_count[t->timer_level]--;
+	wheel.count--;
+}
+
+/* make a blocked thread runnable again, cancelling its timeout (lock() held) */
+static void thread_wake(struct thread_control_block* t)
+{
+	if (t->timer_pprev != NULL) {
+		wheel_remove(t);
+	}
+	if (tracing()) {
+		struct worker* w = this_worker();
+		unsigned long long now = __builtin_ia32_rdtsc();
+		trace_charge(t, &t->blocked_tsc, now);
+		trace_record(w, TR_WAKE, t, w->curr, 0, now);
+	}
+	t->status = TS_READY;
+	ready_push(this_worker(), t);
+}
+
+/* take a stack from the pool or map a new one, NULL if out of memory (lock() held) */
+static char* stack_alloc()
+{
+	if (stack_pool != NULL) {
+		char* stack = stack_pool;
+		stack_pool = *(char**)stack;
+		stack_pool_count--;
+		return stack;
+	}
+
+	char* map = mmap(NULL, page_size + stack_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	// an overflow runs into the guard page and faults instead of corrupting memory
+	if (mprotect(map, page_size, PROT_NONE) == -1) {
+		munmap(map, page_size + stack_size);
+		return NULL;
+	}
+	return map + page_size;
+}
+
+/* return a stack that is no longer in use to the pool (lock() held) */
+static void stack_free(char* stack)
+{
+	if (stack_pool_count >= STACK_POOL_MAX) {
+		munmap(stack - page_size, page_size + stack_size);
+		return;
+	}
+	*(char**)stack = stack_pool;
+	stack_pool = stack;
+	stack_pool_count++;
+}
+
+/* reserve size bytes of address space for a growable stack and commit its top
+pages, or reuse a pooled stack of that size (lock() held) */
+static int stack_reserve(struct thread_control_block* t, size_t size)
+{
+	size = (size + page_size - 1) & ~(page_size - 1);
+	for (struct grow_stack** g = &grow_pool; *g != NULL; g = &(*g)->next) {
+		char* top = (char*)(*g + 1);
+		if ((size_t)(top - (*g)->limit) == size) {
+			t->stack_limit = (*g)->limit;
+			t->stack_top = top;
+			t->stack = (*g)->stack;
+			*g = (*g)->next;
+			grow_pool_count--;
+			return 0;
+		}
+	}
+
+	char* map = mmap(NULL, page_size + size, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+
+	t->stack_limit = map + page_size;
+	t->stack_top = t->stack_limit + size;
+	t->stack = t->stack_top - STACK_COMMIT_PAGES * page_size;
+	if (mprotect(t->stack, STACK_COMMIT_PAGES * page_size, PROT_READ | PROT_WRITE) == -1) {
+		munmap(map, page_size + size);
+		return -1;
+	}
+	return 0;
+}
+
+/* pool the growable stack of a thread that is no longer running on it, or
+unmap it (lock() held). A pooled stack gives back the pages it grew by and
+starts over from its top pages, so a deep thread does not leave them
+resident for the next one. */
+static void stack_unreserve(struct thread_control_block* t)
+{
+	if (grow_pool_count >= STACK_POOL_MAX) {
+		munmap(t->stack_limit - page_size, t->stack_top - t->stack_limit + page_size);
+		return;
+	}
+	char* commit = t->stack_top - STACK_COMMIT_PAGES * page_size;
+	if (t->stack < commit) {
+		madvise(t->stack, commit - t->stack, MADV_DONTNEED);
+		mprotect(t->stack, commit - t->stack, PROT_NONE);
+		t->stack = commit;
+	}
+	struct grow_stack* g = (struct grow_stack*)t->stack_top - 1;
+	g->limit = t->stack_limit;
+	g->stack = t->stack;
+	g->next = grow_pool;
+	grow_pool = g;
+	grow_pool_count++;
+}
+
+/* SIGSEGV handler, runs on the alternate signal stack: a fault in the reserved
+part of the running thread's stack commits more of it, anything else is fatal */
+static void stack_fault(int signal, siginfo_t* info, void* context)
+{
+	struct thread_control_block* t = self != NULL ? curr_thread : NULL;
+	char* addr = info->si_addr;
+
+	// when the frame of a timer signal does not fit in the committed stack, the
+	// kernel sends SIGSEGV without an address instead and the tick is lost
+	bool lost_tick = false;
+	if (t != NULL && t->stack_limit != NULL && info->si_code == SI_KERNEL && addr == NULL) {
+		char* sp = (char*)((ucontext_t*)context)->uc_mcontext.gregs[REG_RSP];
+		if (sp >= t->stack && sp <= t->stack_top) {
+			addr = t->stack - 1;
+			lost_tick = true;
+		}
+	}
+
+	if (t != NULL && t->stack_limit != NULL && addr >= t->stack_limit && addr < t->stack) {
+		char* low = (char*)((uintptr_t)addr & ~(uintptr_t)(page_size - 1));
+		if (low > t->stack - STACK_GROW_PAGES * page_size) {
+			low = t->stack - STACK_GROW_PAGES * page_size;
+		}
+		if (low < t->stack_limit) {
+			low = t->stack_limit;
+		}
+		if (mprotect(low, t->stack - low, PROT_READ | PROT_WRITE) == 0) {
+			t->stack = low;
+			if (lost_tick) {
+				// fire again now that the frame fits, SIGALRM is blocked until we return
+				struct worker* w = self;
+				if (w->preempt_count > 0) {
+					w->preempt_pending = true;
+				}
+				else {
+					w->timer_at = 0;
+					timer_update(w);
+				}
+			}
+			return;
+		}
+	}
+
+	if (t != NULL && t->stack_top != NULL && addr >= t->stack - page_size && addr < t->stack) {
+		static const char msg[] = "ERROR: thread stack overflow\n";
+		write(STDERR_FILENO, msg, sizeof(msg) - 1);
+	}
+	// retrying the access with the default action kills the process
+	struct sigaction act;
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = SIG_DFL;
+	sigaction(SIGSEGV, &act, NULL);
+}
+
+/* take a TCB from the pool, carving a new slab when it is empty; NULL if out
+of memory (lock() held) */
+static struct thread_control_block* tcb_alloc()
+{
+	if (tcb_pool == NULL) {
+		struct thread_control_block* slab = malloc(TCB_SLAB * sizeof(struct thread_control_block));
+		if (slab == NULL) {
+			return NULL;
+		}
+		for (int i = 0; i < TCB_SLAB; i++) {
+			slab[i].next = tcb_pool;
+			tcb_pool = &slab[i];
+		}
+	}
+	struct thread_control_block* t = tcb_pool;
+	tcb_pool = t->next;
+	memset(t, 0, sizeof(*t));
+	return t;
+}
+
+/* return a TCB to the pool (lock() held) */
+static void tcb_free(struct thread_control_block* t)
+{
+	t->next = tcb_pool;
+	tcb_pool = t;
+}
+
+/* release the stacks of the exited threads a worker collected, and the TCBs
+nobody will join (lock() held) */
+static void reap(struct worker* w)
+{
+	while (w->reap_list != NULL) {
+		struct thread_control_block* t = w->reap_list;
+		w->reap_list = t->next;
+		if (t->stack_limit != NULL) {
+			stack_unreserve(t);
+		}
+		else if (t->stack != NULL) { // the main thread runs on the process stack
+			stack_free(t->stack);
+		}
+		t->reaped = true;
+		if (t->detached) {
+			tcb_free(t);
+		}
+	}
+	w->reap_count = 0;
+}
+
+/* the owner of an exited or running thread is done with it: free its TCB now
+if the reaper is done with it too, or let the reaper free it (lock() held) */
+static void thread_release(struct thread_control_block* t)
+{
+	if (t->reaped) {
+		tcb_free(t);
+	}
+	else {
+		t->detached = true;
+	}
+}
+
+/* runs on the thread we switched to, right after the switch: the thread we
+left could not be queued, freed or unlock the scheduler while still on its stack */
+static void finish_switch()
+{
+	struct worker* w = this_worker();
+	if (w->requeue != NULL) {
+		ready_push(w, w->requeue);
+		w->requeue = NULL;
+	}
+	if (w->zombie != NULL) {
+		// thread churn pays for the releases a batch at a time
+		w->zombie->next = w->reap_list;
+		w->reap_list = w->zombie;
+		w->zombie = NULL;
+		if (++w->reap_count >= REAP_BATCH) {
+			reap(w);
+		}
+	}
+	if (w->release_sched_lock) {
+		w->release_sched_lock = false;
+		spin_unlock(&sched_lock);
+	}
+}
+
+/* switch from the running thread to next with preemption off; the caller has
+set the status of the running thread and what finish_switch should do with it */
+static void switch_to(struct thread_control_block* next)
+{
+	struct worker* w = this_worker();
+	struct thread_control_block* prev = w->curr;
+	if (fair_policy) {
+		// charge the running thread for its time on the processor
+		long long now = now_ns();
+		if (prev != &w->idle) {
+			prev->vruntime += (now - w->run_start) * NICE_0_WEIGHT / prev->weight;
+		}
+		w->run_start = now;
+		if (next != &w->idle && next->vruntime > w->min_vruntime) {
+			w->min_vruntime = next->vruntime;
+		}
+	}
+	if (tracing()) {
+		unsigned long long now = __builtin_ia32_rdtsc();
+		if (prev != &w->idle) {
+			trace_charge(prev, &prev->run_tsc, now);
+		}
+		if (next != &w->idle) {
+			trace_charge(next, &next->ready_tsc, now);
+			next->switches++;
+		}
+		trace_record(w, TR_SWITCH, prev, next, prev->status, now);
+	}
+	slice_begin(w, next);
+	// nothing between setting w->curr and the switch may grow the stack,
+	// stack_fault would take the fault for next
+	w->curr = next;
+	next->status = TS_RUNNING;
+	context_switch(&prev->sp, next->sp);
+	finish_switch();
+}
+
+/* park the running thread, called with lock() held after it was put on a wait
+list; returns with lock() held again once it has been woken */
+static void thread_block(enum wait_reason why)
+{
+	struct worker* w = this_worker();
+	struct thread_control_block* t = w->curr;
+	if (tracing()) {
+		trace_record(w, TR_BLOCK, t, NULL, why, __builtin_ia32_rdtsc());
+	}
+	// a runner blocked in a task leaves the task queue to a spare one
+	if (t->task != NULL) {
+		task_runners--;
+		task_runner_add();
+	}
+	t->status = TS_BLOCKED;
+	struct thread_control_block* next = find_next(w);
+	w->release_sched_lock = true;
+	switch_to(next != NULL ? next : &w->idle);
+	spin_lock(&sched_lock);
+	if (t->task != NULL) {
+		task_runners++;
+	}
+}
+
+/* first function a new thread runs, entered from context_start */
+static void thread_start(struct thread_control_block* t)
+{
+	finish_switch();
+	preempt_on();
+	pthread_exit(t->start_routine(t->arg));
+}
+
+/* lay out a stack as if the thread had called context_switch:
+ * the control words, r15, r14, r13, r12, rbx and rbp, then the return
+ * address. Returning to context_start calls r12 with r13 as its
+ * argument, so the thread begins in fn(arg) with the stack 16-byte
+ * aligned as the AMD64 calling convention requires.
+ */
+static void context_init(struct thread_control_block* t, void (*fn)(void*), void* arg)
+{
+	unsigned long* sp = (unsigned long*)t->stack_top;
+	*--sp = (unsigned long)context_start; // return address
+	*--sp = 0; // rbp
+	*--sp = 0; // rbx
+	*--sp = (unsigned long)fn; // r12
+	*--sp = (unsigned long)arg; // r13
+	*--sp = 0; // r14
+	*--sp = 0; // r15
+	*--sp = (FPUCW_DEFAULT << 32) | MXCSR_DEFAULT;
+	t->sp = sp;
+}
+
+/* wake the threads parked on a list of an fd (lock() held) */
+static void io_wake(struct thread_control_block** list)
+{
+	while (*list != NULL) {
+		struct thread_control_block* t = *list;
+		*list = t->next;
+		__atomic_sub_fetch(&io_waiters, 1, __ATOMIC_RELAXED);
+		thread_wake(t);
+	}
+}
+
+/* wake the threads parked on the fds of n events, they are queued on this worker */
+static void reactor_events(struct epoll_event* events, int n)
+{
+	if (n <= 0) {
+		return;
+	}
+
+	lock();
+	for (int i = 0; i < n; i++) {
+		int fd = events[i].data.fd;
+		if (fd == wake_fd) {
+			uint64_t count;
+			syscall(SYS_read, wake_fd, &count, sizeof(count));
+			continue;
+		}
+		struct io_fd* f = &io_fds[fd / IO_CHUNK][fd % IO_CHUNK];
+		__atomic_add_fetch(&f->seq, 1, __ATOMIC_RELEASE);
+		if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			io_wake(&f->readers);
+		}
+		if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+			io_wake(&f->writers);
+		}
+	}
+	unlock();
+}
+
+/* pick up the events that are already there */
+static void reactor_poll()
+{
+	struct epoll_event events[IO_EVENTS];
+	reactor_events(events, epoll_wait(epoll_fd, events, IO_EVENTS, 0));
+}
+
+static void schedule(int signal)
+{
+	/* TODO: implement your round-robin scheduler
+	 * 1. Determine which is the next thread that should run
+	 * 2. Switch to the next thread (context_switch saves the registers of
+	 *    the current one on its stack)
+	 */
+
+	struct worker* w = this_worker();
+	if (w == NULL || w->curr == &w->idle) {
+		return; // the scheduler loop itself is never preempted
+	}
+	if (w->preempt_count > 0) {
+		w->preempt_pending = true; // switch when the critical section ends
+		return;
+	}
+
+	preempt_off();
+	w = this_worker(); // a tick before preempt_off() may have moved us
+	// at a tick, or when there is nothing else to run, pick up the threads
+	// whose I/O is ready
+	bool io = __atomic_load_n(&io_waiters, __ATOMIC_RELAXED) > 0;
+	if (signal != 0 && io) {
+		reactor_poll();
+	}
+	struct thread_control_block* next = find_next(w);
+	if (next == NULL && signal == 0 && io) {
+		reactor_poll();
+		next = find_next(w);
+	}
+	if (next == NULL) {
+		// nothing else to run
+		slice_begin(w, w->curr);
+		preempt_on();
+		return;
+	}
+
+	// the running thread goes to the back of the ready queue once we are off its stack,
+	// we continue here once we are switched back to (maybe on another worker)
+	w->curr->status = TS_READY;
+	w->requeue = w->curr;
+	switch_to(next);
+	preempt_on();
+}
+
+/* make the wheel timer fire by due (lock() held) */
+static void wheel_arm(long long due)
+{
+	if (wheel_due == 0 || due < wheel_due) {
+		__atomic_store_n(&wheel_due, due, __ATOMIC_RELAXED);
+	}
+	if (wheel_timer_at != 0 && wheel_timer_at <= due) {
+		return; // it fires early and the wheel arms it again
+	}
+	struct itimerspec its;
+	its.it_interval.tv_sec = 0;
+	its.it_interval.tv_nsec = 0;
+	its.it_value.tv_sec = due / 1000000000LL;
+	its.it_value.tv_nsec = due % 1000000000LL;
+	timer_settime(wheel_timer, TIMER_ABSTIME, &its, NULL);
+	wheel_timer_at = due;
+}
+
+/* wake t at deadline (monotonic ns) unless something else wakes it first; then
+on_timeout(t) takes it off the list it waits on (lock() held) */
+static void wheel_add(struct thread_control_block* t, long long deadline,
+	void (*on_timeout)(struct thread_control_block*), void* obj)
+{
+	t->wake_at = deadline;
+	t->on_timeout = on_timeout;
+	t->wait_obj = obj;
+	t->wait_result = 0;
+	long long tick = (deadline + WHEEL_TICK_NS - 1) / WHEEL_TICK_NS;
+	if (wheel.count == 0) {
+		wheel.tick = now_ns() / WHEEL_TICK_NS; // it does not move while empty
+	}
+	wheel_insert(t);
+	wheel_arm(tick * WHEEL_TICK_NS); // the wheel wakes t at the end of its tick
+}
+
+/* the timeout of t, out of the wheel, expired (lock() held) */
+static void wheel_expire(struct thread_control_block* t)
+{
+	if (t->on_timeout != NULL) {
+		t->on_timeout(t);
+	}
+	thread_wake(t);
+}
+
+/* run the timeouts of the ticks up to target: at the start of every slot of
+level l the threads there move down, those in the level 0 slot of a tick are
+woken. Ticks with nothing to move or wake are skipped. (lock() held) */
+static void wheel_advance(long long target)
+{
+	while (wheel.tick < target && wheel.count > 0) {
+		int level = 0;
+		while (wheel.level_count[level] == 0) {
+			level++;
+		}
+		if (level > 0) {
+			// nothing below level: jump to the start of its next slot
+			long long start = ((wheel.tick >> (WHEEL_BITS * level)) + 1) << (WHEEL_BITS * level);
+			wheel.tick = (start <= target ? start : target + 1) - 1;
+			if (wheel.tick == target) {
+				break;
+			}
+		}
+
+		wheel.tick++;
+		for (int l = 1; l < WHEEL_LEVELS && (wheel.tick & ((1LL << (WHEEL_BITS * l)) - 1)) == 0; l++) {
+			struct thread_control_block** slot = &wheel.slots[l][(wheel.tick >> (WHEEL_BITS * l)) & (WHEEL_SIZE - 1)];
+			while (*slot != NULL) {
+				struct thread_control_block* t = *slot;
+				wheel_remove(t);
+				if ((t->wake_at + WHEEL_TICK_NS - 1) / WHEEL_TICK_NS <= wheel.tick) {
+					wheel_expire(t); // due at this very tick
+				}
+				else {
+					wheel_insert(t);
+				}
+			}
+		}
+		struct thread_control_block** slot = &wheel.slots[0][wheel.tick & (WHEEL_SIZE - 1)];
+		while (*slot != NULL) {
+			struct thread_control_block* t = *slot;
+			wheel_remove(t);
+			wheel_expire(t);
+		}
+	}
+	if (wheel.count == 0) {
+		wheel.tick = target;
+	}
+}
+
+/* the earliest time something in the wheel may be due: the first busy slot of
+level 0 or the next slot of a higher level, whichever comes first (lock() held) */
+static long long wheel_next()
+{
+	long long tick = 0;
+	for (int i = 1; wheel.level_count[0] > 0 && i <= WHEEL_SIZE; i++) {
+		if (wheel.slots[0][(wheel.tick + i) & (WHEEL_SIZE - 1)] != NULL) {
+			tick = wheel.tick + i;
+			break;
+		}
+	}
+	for (int l = 1; l < WHEEL_LEVELS; l++) {
+		if (wheel.level_count[l] > 0) {
+			long long start = ((wheel.tick >> (WHEEL_BITS * l)) + 1) << (WHEEL_BITS * l);
+			if (tick == 0 || start < tick) {
+				tick = start;
+			}
+			break;
+		}
+	}
+	return tick * WHEEL_TICK_NS;
+}
+
+/* wake the threads whose timeouts are due, called at ticks and from the
+scheduler loop */
+static void timers_check()
+{
+	long long due = __atomic_load_n(&wheel_due, __ATOMIC_RELAXED);
+	if (due == 0 || now_ns() < due) {
+		return;
+	}
+
+	lock();
+	long long now = now_ns();
+	wheel_advance(now / WHEEL_TICK_NS);
+	if (wheel_timer_at <= now) {
+		wheel_timer_at = 0; // it fired
+	}
+	__atomic_store_n(&wheel_due, 0, __ATOMIC_RELAXED);
+	if (wheel.count > 0) {
+		wheel_arm(wheel_next());
+	}
+	unlock();
+}
+
+/* preempt the running thread of worker w if its time slice is over (preemption on) */
+static void slice_check(struct worker* w)
+{
+	timers_check();
+	w->timer_at = 0; // the timer is one-shot
+	if (w->slice_end == 0) {
+		return;
+	}
+	if (now_ns() < w->slice_end) {
+		timer_update(w); // the slice was extended after the timer was armed
+		return;
+	}
+	schedule(SIGALRM);
+}
+
+/* SIGALRM handler, the timer of this worker fired */
+static void timer_tick(int signal)
+{
+	struct worker* w = this_worker();
+	if (w == NULL) {
+		return;
+	}
+	if (w->preempt_count > 0) {
+		// also the case in the scheduler loop, which is never preempted
+		w->preempt_pending = true;
+		if (w->curr == &w->idle) {
+			// the wheel timer: make the loop of a sleeping worker check it
+			__atomic_add_fetch(&work_seq, 1, __ATOMIC_SEQ_CST);
+		}
+		return;
+	}
+	slice_check(w);
+}
+
+/* the scheduler loop of a worker, runs with preemption off on the worker's own stack */
+static void worker_loop(struct worker* w)
+{
+	for (;;) {
+		unsigned seq = __atomic_load_n(&work_seq, __ATOMIC_SEQ_CST);
+		timers_check();
+		struct thread_control_block* next = find_next(w);
+		if (next != NULL) {
+			switch_to(next);
+			continue;
+		}
+
+		// nothing to run anywhere: sleep until a thread is queued, or for one
+		// worker while threads wait for I/O, until an fd is ready. Stacks of
+		// exited threads are not held meanwhile.
+		if (w->reap_count > 0) {
+			lock();
+			reap(w);
+			unlock();
+			continue;
+		}
+		__atomic_add_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&io_waiters, __ATOMIC_SEQ_CST) > 0 &&
+			!__atomic_exchange_n(&io_poller, 1, __ATOMIC_SEQ_CST)) {
+			struct epoll_event events[IO_EVENTS];
+			int n = 0;
+			if (__atomic_load_n(&work_seq, __ATOMIC_SEQ_CST) == seq) {
+				n = epoll_wait(epoll_fd, events, IO_EVENTS, -1);
+			}
+			__atomic_store_n(&io_poller, 0, __ATOMIC_SEQ_CST);
+			__atomic_sub_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+			reactor_events(events, n);
+			continue;
+		}
+		syscall(SYS_futex, &work_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+		__atomic_sub_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/* scheduler loop of worker 0, which runs on a stack of its own */
+static void idle_start(struct worker* w)
+{
+	finish_switch();
+	worker_loop(w);
+}
+
+/* per kernel thread setup: the alternate signal stack and the preemption timer,
+which is armed once a second thread is ready on the worker */
+static void worker_setup(struct worker* w)
+{
+	self = w;
+	w->tid = syscall(SYS_gettid);
+	w->run_start = now_ns();
+
+	// grow stacks on demand, the handler cannot run on the stack that faulted
+	stack_t ss;
+	ss.ss_sp = malloc(SIGSTKSZ);
+	ss.ss_size = SIGSTKSZ;
+	ss.ss_flags = 0;
+	sigaltstack(&ss, NULL);
+
+	// the timer of a worker interrupts only that worker
+	struct sigevent sev;
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGALRM;
+	sev.sigev_notify_thread_id = w->tid;
+	if (timer_create(CLOCK_MONOTONIC, &sev, &w->timer) == -1) {
+		perror("ERROR");
+	}
+}
+
+/* entry point of the kernel threads of workers 1 and up */
+static void* worker_main(void* arg)
+{
+	struct worker* w = arg;
+	worker_setup(w);
+	w->curr = &w->idle;
+	worker_loop(w);
+	return NULL;
+}
+
+/* allocate the trace rings of the workers that have none yet (lock() held) */
+static int trace_alloc()
+{
+	for (int i = 0; i < nworkers; i++) {
+		if (workers[i].trace == NULL) {
+			workers[i].trace = calloc(1, sizeof(struct trace_ring));
+			if (workers[i].trace == NULL) {
+				return ENOMEM;
+			}
+		}
+	}
+	return 0;
+}
+
+/* THREAD_TRACE=file: trace the whole run and write the trace at exit */
+static void trace_at_exit()
+{
+	const char* path = getenv("THREAD_TRACE");
+	if (path != NULL && pthread_trace_dump_np(path) != 0) {
+		perror("ERROR");
+	}
+}
+
+static void scheduler_init()
+{
+	/* TODO: do everything that is needed to initialize your scheduler. For example:
+	 * - Allocate/initialize global threading data structures
+	 * - Create a TCB for the main thread. Note: This is less complicated
+	 *   than the TCBs you create for all other threads. In this case, your
+	 *   current stack and registers are already exactly what they need to be!
+	 *   Just make sure they are correctly referenced in your TCB.
+	 * - Set up your timers to call schedule() at a 50 ms interval (SCHEDULER_INTERVAL_USECS)
+	*/
+
+	// initialize global variables
+	live_threads = 1;
+	page_size = sysconf(_SC_PAGESIZE);
+	stack_size = (THREAD_STACK_SIZE + page_size - 1) & ~(page_size - 1);
+	real_pthread_create = dlsym(RTLD_NEXT, "pthread_create");
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_getstacksize(&attr, &default_stacksize);
+	pthread_attr_destroy(&attr);
+
+	// one worker per core unless THREAD_WORKERS says otherwise
+	const char* env = getenv("THREAD_WORKERS");
+	nworkers = env != NULL ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nworkers < 1 || real_pthread_create == NULL) {
+		nworkers = 1;
+	}
+	if (nworkers > MAX_WORKERS) {
+		nworkers = MAX_WORKERS;
+	}
+	env = getenv("THREAD_QUANTUM_USECS");
+	long usecs = env != NULL ? atol(env) : 0;
+	quantum = (usecs > 0 ? usecs : SCHEDULER_INTERVAL_USECS) * 1000LL;
+
+	// round-robin unless THREAD_SCHED=fair
+	env = getenv("THREAD_SCHED");
+	fair_policy = env != NULL && strcmp(env, "fair") == 0;
+
+	for (int i = 0; i < nworkers; i++) {
+		workers[i].id = i;
+		workers[i].preempt_count = 1; // scheduler loops and this function
+	}
+
+	// create tcb for main thread, it keeps running on worker 0
+	main_thread = tcb_alloc();
+	main_thread->id = 0;
+	main_thread->stack = NULL;
+	main_thread->stack_top = NULL;
+	main_thread->stack_limit = NULL;
+	main_thread->status = TS_RUNNING;
+	main_thread->slice = quantum;
+	main_thread->nice = 0;
+	main_thread->weight = NICE_0_WEIGHT;
+	main_thread->vruntime = 0;
+	main_thread->timer_pprev = NULL;
+	workers[0].curr = main_thread;
+
+	// the scheduler loop of worker 0 gets a stack of its own
+	struct thread_control_block* idle = &workers[0].idle;
+	idle->stack = stack_alloc();
+	idle->stack_top = idle->stack + stack_size;
+	idle->stack_limit = NULL;
+	context_init(idle, (void (*)(void*))idle_start, &workers[0]);
+
+	// the reactor, with the eventfd that interrupts its epoll_wait
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = wake_fd;
+	if (epoll_fd == -1 || wake_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == -1) {
+		perror("ERROR");
+	}
+
+	// set up the timers to call schedule()
+	struct sigaction act;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = SA_NODEFER | SA_RESTART; // blocking calls outside the reactor go on
+	act.sa_handler = timer_tick;
+	sigaction(SIGALRM, &act, NULL);
+
+	// a tick must not switch threads while we are on the alternate stack
+	sigaddset(&act.sa_mask, SIGALRM);
+	act.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	act.sa_sigaction = stack_fault;
+	sigaction(SIGSEGV, &act, NULL);
+
+	worker_setup(&workers[0]);
+
+	// the timing wheel, its timer signals worker 0
+	wheel.tick = now_ns() / WHEEL_TICK_NS;
+	struct sigevent sev;
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGALRM;
+	sev.sigev_notify_thread_id = workers[0].tid;
+	if (timer_create(CLOCK_MONOTONIC, &sev, &wheel_timer) == -1) {
+		perror("ERROR");
+	}
+	for (int i = 1; i < nworkers; i++) {
+		pthread_t kthread;
+		if (real_pthread_create(&kthread, NULL, worker_main, &workers[i]) != 0) {
+			perror("ERROR");
+			nworkers = i;
+			break;
+		}
+	}
+
+	tsc_base = __builtin_ia32_rdtsc();
+	tsc_base_ns = now_ns();
+	if (getenv("THREAD_TRACE") != NULL && trace_alloc() == 0) {
+		trace_epoch = tsc_base;
+		trace_on = true;
+		atexit(trace_at_exit);
+	}
+
+	// main keeps running on worker 0
+	workers[0].preempt_count = 0;
+	workers[0].preempt_pending = false;
+}
+
+/* Create the timers and the workers for the scheduler. Create thread 0. */
+static void scheduler_start()
+{
+	static bool is_first_call = true;
+	if (is_first_call)
+	{
+		is_first_call = false;
+		scheduler_init();
+	}
+}
+
+/* create a thread that starts in start_routine(arg) and queue it on this
+worker, returns 0 or an error number (lock() held) */
+static int thread_create(struct thread_control_block** out, const pthread_attr_t *attr,
+	void *(*start_routine) (void *), void *arg)
+{
+	int detach_state = PTHREAD_CREATE_JOINABLE;
+	if (attr != NULL && pthread_attr_getdetachstate(attr, &detach_state) != 0) {
+		return EINVAL;
+	}
+	if (runq_reserve(live_threads + 1) == -1) {
+		return EAGAIN;
+	}
+	struct thread_control_block* my_thread = tcb_alloc();
+	if (my_thread == NULL) {
+		return EAGAIN;
+	}
+
+	// create the stack, growable up to the size asked for in attr; an attr that
+	// only has the default size gets a pool stack like no attr at all
+	size_t limit = 0;
+	if (attr != NULL && pthread_attr_getstacksize(attr, &limit) == 0) {
+		if (limit < (size_t)PTHREAD_STACK_MIN) {
+			tcb_free(my_thread);
+			return EINVAL;
+		}
+		if (limit == default_stacksize) {
+			limit = 0;
+		}
+	}
+	if (stack_pool == NULL || grow_pool == NULL) {
+		reap(this_worker()); // stacks of exited threads are as good as new ones
+	}
+	if (limit > 0) {
+		if (stack_reserve(my_thread, limit) == -1) {
+			tcb_free(my_thread);
+			return EAGAIN;
+		}
+	}
+	else {
+		my_thread->stack = stack_alloc();
+		if (my_thread->stack == NULL) {
+			tcb_free(my_thread);
+			return EAGAIN;
+		}
+		my_thread->stack_top = my_thread->stack + stack_size;
+		my_thread->stack_limit = NULL;
+	}
+
+	// the thread id is the TCB address
+	my_thread->id = (pthread_t)my_thread;
+	my_thread->slice = quantum;
+	my_thread->nice = curr_thread->nice;
+	my_thread->weight = curr_thread->weight;
+	my_thread->vruntime = this_worker()->min_vruntime;
+	my_thread->timer_pprev = NULL;
+	my_thread->detached = detach_state == PTHREAD_CREATE_DETACHED;
+	live_threads++;
+
+	// the thread begins in thread_start(my_thread)
+	my_thread->start_routine = start_routine;
+	my_thread->arg = arg;
+	context_init(my_thread, (void (*)(void*))thread_start, my_thread);
+
+	if (tracing()) {
+		my_thread->state_since = __builtin_ia32_rdtsc();
+		trace_record(this_worker(), TR_CREATE, my_thread, curr_thread, 0, my_thread->state_since);
+	}
+
+	// set my_thread as ready and add it to the runnable thread queue of this worker
+	my_thread->status = TS_READY;
+	ready_push(this_worker(), my_thread);
+
+	*out = my_thread;
+	return 0;
+}
+
+int pthread_create(
+	pthread_t *thread, const pthread_attr_t *attr,
+	void *(*start_routine) (void *), void *arg)
+{
+	scheduler_start();
+
+	lock();
+	/* TODO: Return 0 on successful thread creation, non-zero for an error.
+	 *       Be sure to set *thread on success.
+	 * Hints:
+	 * The general purpose is to create a TCB:
+	 * - Create a stack.
+	 * - Assign the stack pointer in the thread's registers. Important: where
+	 *   within the stack should the stack pointer be? It may help to draw
+	 *   an empty stack diagram to answer that question.
+	 * - Assign the program counter in the thread's registers.
+	 * - Remember to set your new thread as TS_READY, but only  after you
+	 *   have initialized everything for the new thread.
+	 * - Optionally: run your scheduler immediately (can also wait for the
+	 *   next scheduling event).
+	 */
+
+	struct thread_control_block* my_thread;
+	int err = thread_create(&my_thread, attr, start_routine, arg);
+
+	// set *thread on success
+	if (err == 0) {
+		*thread = my_thread->id;
+	}
+
+	unlock();
+	return err;
+}
+
+void pthread_exit(void *value_ptr)
+{
+	/* TODO: Exit the current thread instead of exiting the entire process.
+	 * Hints:
+	 * - Release all resources for the current thread. CAREFUL though.
+	 *   If you free() the currently-in-use stack then do something like
+	 *   call a function or add/remove variables from the stack, bad things
+	 *   can happen.
+	 * - Update the thread's status to indicate that it has exited
+	*/
+
+	lock();
+	struct worker* w = this_worker();
+	if (tracing()) {
+		trace_record(w, TR_EXIT, w->curr, NULL, 0, __builtin_ia32_rdtsc());
+	}
+	w->curr->status = TS_EXITED;
+	w->curr->retval = value_ptr;
+	if (--live_threads == 0) { // no threads remain so exit the program
+		unlock(); // atexit handlers and destructors may take it
+		exit(0);
+	}
+	if (w->curr->joiner != NULL) {
+		thread_wake(w->curr->joiner);
+	}
+
+	// we are still running on our stack, the next thread releases it
+	// and the scheduler lock
+	struct thread_control_block* next = find_next(w);
+	w->zombie = w->curr;
+	w->release_sched_lock = true;
+	switch_to(next != NULL ? next : &w->idle);
+	__builtin_unreachable();
+}
+
+pthread_t pthread_self(void)
+{
+	return self != NULL ? curr_thread->id : 0;
+}
+
+/* the TCB of a thread id (lock() held or the thread known to be alive). As
+with glibc, an id that is not of a thread that is still running or can still
+be joined is undefined behavior: it is used as a TCB pointer unchecked. */
+static struct thread_control_block* thread_lookup(pthread_t thread)
+{
+	return thread == 0 ? main_thread : (struct thread_control_block*)thread;
+}
+
+int pthread_join(pthread_t thread, void **retval)
+{
+	scheduler_start();
+
+	lock();
+	struct thread_control_block* t = thread_lookup(thread);
+	if (t == curr_thread) {
+		unlock();
+		return EDEADLK;
+	}
+	if (t->detached || t->joiner != NULL) {
+		unlock();
+		return EINVAL;
+	}
+
+	// park until pthread_exit wakes us
+	if (t->status != TS_EXITED) {
+		t->joiner = curr_thread;
+		thread_block(WAIT_JOIN);
+	}
+	if (retval != NULL) {
+		*retval = t->retval;
+	}
+	thread_release(t);
+	unlock();
+	return 0;
+}
+
+int pthread_detach(pthread_t thread)
+{
+	scheduler_start();
+
+	lock();
+	struct thread_control_block* t = thread_lookup(thread);
+	if (t->detached || t->joiner != NULL) {
+		unlock();
+		return EINVAL;
+	}
+	thread_release(t);
+	unlock();
+	return 0;
+}
+
+/* give t a new time slice and nice value (lock() held). A queued thread
+keeps the lag of its vruntime behind or ahead of its worker, scaled to the
+new weight, and moves in the fair heap; a shorter slice shortens the wait
+of the threads queued with it. */
+static void thread_retune(struct thread_control_block* t, long long slice, int nice)
+{
+	int weight = nice_weight[nice + 20];
+	for (int i = 0; t->status == TS_READY && i < nworkers; i++) {
+		struct worker* w = &workers[i];
+		spin_lock(&w->ready_lock);
+		int at = runq_find(w, t);
+		if (at >= 0) {
+			if (fair_policy && weight != t->weight) {
+				t->vruntime = w->min_vruntime + (t->vruntime - w->min_vruntime) * t->weight / weight;
+				t->weight = weight;
+				runq_fix(w, at);
+			}
+			if (slice < w->ready_slice) {
+				w->ready_slice = slice;
+			}
+			t->slice = slice;
+			t->nice = nice;
+			spin_unlock(&w->ready_lock);
+			return;
+		}
+		spin_unlock(&w->ready_lock);
+	}
+	// running, blocked or on its way into a run queue
+	t->slice = slice;
+	t->nice = nice;
+	t->weight = weight;
+}
+
+int pthread_settimeslice_np(pthread_t thread, unsigned usecs)
+{
+	scheduler_start();
+	struct thread_control_block* t = thread_lookup(thread);
+	lock();
+	thread_retune(t, usecs > 0 ? usecs * 1000LL : quantum, t->nice);
+	unlock();
+	return 0;
+}
+
+int pthread_setnice_np(pthread_t thread, int nice)
+{
+	if (nice < -20 || nice > 19) {
+		return EINVAL;
+	}
+	scheduler_start();
+	struct thread_control_block* t = thread_lookup(thread);
+	lock();
+	thread_retune(t, t->slice, nice);
+	unlock();
+	return 0;
+}
+
+int pthread_trace_np(int enable)
+{
+	scheduler_start();
+
+	lock();
+	int err = enable ? trace_alloc() : 0;
+	if (err == 0 && enable != trace_on) {
+		trace_epoch = __builtin_ia32_rdtsc();
+		__atomic_store_n(&trace_on, enable != 0, __ATOMIC_RELAXED);
+	}
+	unlock();
+	return err;
+}
+
+/* nanoseconds per TSC tick, measured against the monotonic clock since
+scheduler_init (at least a millisecond of it) */
+static double tsc_scale()
+{
+	long long ns;
+	unsigned long long tsc;
+	do {
+		ns = now_ns();
+		tsc = __builtin_ia32_rdtsc();
+	} while (ns - tsc_base_ns < 1000000LL);
+	return (double)(ns - tsc_base_ns) / (double)(tsc - tsc_base);
+}
+
+int pthread_getstats_np(pthread_t thread, struct thread_stats_np *stats)
+{
+	scheduler_start();
+	double scale = tsc_scale();
+
+	lock();
+	struct thread_control_block* t = thread_lookup(thread);
+	unsigned long long run = t->run_tsc, ready = t->ready_tsc, blocked = t->blocked_tsc;
+	if (tracing()) {
+		// and the time in the current state so far
+		unsigned long long now = __builtin_ia32_rdtsc();
+		unsigned long long since = t->state_since > trace_epoch ? t->state_since : trace_epoch;
+		if (t->status == TS_RUNNING) {
+			run += now - since;
+		}
+		else if (t->status == TS_READY) {
+			ready += now - since;
+		}
+		else if (t->status == TS_BLOCKED) {
+			blocked += now - since;
+		}
+	}
+	stats->run_ns = run * scale;
+	stats->ready_ns = ready * scale;
+	stats->blocked_ns = blocked * scale;
+	stats->switches = t->switches;
+	unlock();
+	return 0;
+}
+
+/* the name of a thread in a trace */
+static void trace_name(char* buf, size_t size, pthread_t id)
+{
+	if (id == 0) {
+		snprintf(buf, size, "main");
+	}
+	else if (id == TRACE_IDLE) {
+		snprintf(buf, size, "idle");
+	}
+	else {
+		snprintf(buf, size, "thread %#lx", (unsigned long)id);
+	}
+}
+
+int pthread_trace_dump_np(const char *path)
+{
+	static const char* const wait_names[] = {"mutex", "barrier", "join", "io", "sleep", "task", "channel", "cond", "rwlock"};
+	static const char* const status_names[] = {"exited", "running", "ready", "blocked"};
+
+	scheduler_start();
+	double scale = tsc_scale() / 1000.0; // trace timestamps are in microseconds
+	FILE* f = fopen(path, "w");
+	if (f == NULL) {
+		return errno;
+	}
+
+	int pid = getpid();
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"green threads\"}}", pid);
+	for (int i = 0; i < nworkers; i++) {
+		struct trace_ring* ring = workers[i].trace;
+		if (ring == NULL) {
+			continue;
+		}
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}",
+			pid, i, i);
+
+		// the worker runs one thread from one switch to the next
+		unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		unsigned long long first = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+		bool running = false;
+		pthread_t curr = 0;
+		double curr_since = 0;
+		for (unsigned long long n = first; n < head; n++) {
+			struct trace_event e = ring->events[n % TRACE_EVENTS];
+			double ts = (double)(e.tsc - tsc_base) * scale;
+			char name[64], other[64];
+			trace_name(name, sizeof(name), e.thread);
+			trace_name(other, sizeof(other), e.other);
+			switch (e.type) {
+			case TR_SWITCH:
+				if (running && curr == e.thread && e.thread != TRACE_IDLE) {
+					fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+						"\"args\":{\"then\":\"%s\",\"next\":\"%s\"}}",
+						name, pid, i, curr_since, ts - curr_since, status_names[e.arg], other);
+				}
+				running = true;
+				curr = e.other;
+				curr_since = ts;
+				break;
+			case TR_BLOCK:
+				fprintf(f, ",\n{\"name\":\"block on %s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,"
+					"\"args\":{\"thread\":\"%s\"}}", wait_names[e.arg], pid, i, ts, name);
+				break;
+			case TR_WAKE:
+			case TR_CREATE:
+				fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,"
+					"\"args\":{\"thread\":\"%s\",\"by\":\"%s\"}}",
+					e.type == TR_WAKE ? "wake" : "create", pid, i, ts, name, other);
+				break;
+			case TR_EXIT:
+				fprintf(f, ",\n{\"name\":\"exit\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,"
+					"\"args\":{\"thread\":\"%s\"}}", pid, i, ts, name);
+				break;
+			}
+		}
+	}
+	fprintf(f, "\n]}\n");
+	return fclose(f) == 0 ? 0 : errno;
+}
+
+/* give up the processor to the next ready thread */
+int sched_yield(void)
+{
+	if (self != NULL) {
+		schedule(0);
+	}
+	return 0;
+}
+
+/* the reactor state of fd if a green thread calls it and it is a socket or
+pipe the reactor handles, NULL for a blocking call as usual */
+static struct io_fd* io_attach(int fd)
+{
+	if (self == NULL || fd <= STDERR_FILENO || fd >= IO_CHUNK * IO_CHUNKS) {
+		return NULL; // the standard streams may be shared with other processes
+	}
+	struct io_fd* chunk = __atomic_load_n(&io_fds[fd / IO_CHUNK], __ATOMIC_ACQUIRE);
+	if (chunk != NULL) {
+		enum io_mode mode = __atomic_load_n(&chunk[fd % IO_CHUNK].mode, __ATOMIC_ACQUIRE);
+		if (mode != IO_UNKNOWN) {
+			return mode == IO_REACTOR ? &chunk[fd % IO_CHUNK] : NULL;
+		}
+	}
+
+	lock();
+	if (chunk == NULL && (chunk = io_fds[fd / IO_CHUNK]) == NULL) {
+		chunk = calloc(IO_CHUNK, sizeof(struct io_fd));
+		if (chunk == NULL) {
+			unlock();
+			return NULL;
+		}
+		__atomic_store_n(&io_fds[fd / IO_CHUNK], chunk, __ATOMIC_RELEASE);
+	}
+
+	struct io_fd* f = &chunk[fd % IO_CHUNK];
+	if (f->mode == IO_UNKNOWN) {
+		int flags = fcntl(fd, F_GETFL);
+		struct stat st;
+		if (flags == -1 || fstat(fd, &st) == -1) {
+			unlock();
+			return NULL; // not open, the call fails with EBADF
+		}
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.fd = fd;
+		enum io_mode mode = IO_PASS;
+		if (!(flags & O_NONBLOCK) && (S_ISSOCK(st.st_mode) || S_ISFIFO(st.st_mode)) &&
+			fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0) {
+			if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+				mode = IO_REACTOR;
+			}
+			else {
+				fcntl(fd, F_SETFL, flags);
+			}
+		}
+		__atomic_store_n(&f->mode, mode, __ATOMIC_RELEASE);
+	}
+	unlock();
+	return f->mode == IO_REACTOR ? f : NULL;
+}
+
+/* park the running thread until f is ready for reading or writing, unless
+an event came since seq was read */
+static void io_wait(struct io_fd* f, bool write, unsigned seq)
+{
+	lock();
+	if (f->seq == seq) {
+		struct thread_control_block** list = write ? &f->writers : &f->readers;
+		struct thread_control_block* t = curr_thread;
+		t->next = *list;
+		*list = t;
+		__atomic_add_fetch(&io_waiters, 1, __ATOMIC_RELAXED);
+		thread_block(WAIT_IO);
+	}
+	unlock();
+}
+
+/* the event sequence of f before an attempt, 0 when there is no f */
+static unsigned io_seq(struct io_fd* f)
+{
+	return f != NULL ? __atomic_load_n(&f->seq, __ATOMIC_ACQUIRE) : 0;
+}
+
+/* errno belongs to the worker: a thread moved to another one in between would
+read the wrong value, so a call and its errno are taken without preemption */
+static long io_syscall(long number, long a, long b, long c, int* err)
+{
+	preempt_off();
+	long rc = syscall(number, a, b, c);
+	*err = rc == -1 ? errno : 0;
+	preempt_on();
+	return rc;
+}
+
+ssize_t read(int fd, void* buf, size_t count)
+{
+	struct io_fd* f = io_attach(fd);
+	for (;;) {
+		unsigned seq = io_seq(f);
+		int err;
+		ssize_t n = io_syscall(SYS_read, fd, (long)buf, count, &err);
+		if (n != -1 || f == NULL || err != EAGAIN) {
+			if (err != 0) {
+				errno = err;
+			}
+			return n;
+		}
+		io_wait(f, false, seq);
+	}
+}
+
+ssize_t write(int fd, const void* buf, size_t count)
+{
+	struct io_fd* f = io_attach(fd);
+	for (;;) {
+		unsigned seq = io_seq(f);
+		int err;
+		ssize_t n = io_syscall(SYS_write, fd, (long)buf, count, &err);
+		if (n != -1 || f == NULL || err != EAGAIN) {
+			if (err != 0) {
+				errno = err;
+			}
+			return n;
+		}
+		io_wait(f, true, seq);
+	}
+}
+
+int accept(int fd, __SOCKADDR_ARG addr, socklen_t* restrict len)
+{
+	struct io_fd* f = io_attach(fd);
+	for (;;) {
+		unsigned seq = io_seq(f);
+		int err;
+		int rc = io_syscall(SYS_accept, fd, (long)addr.__sockaddr__, (long)len, &err);
+		if (rc != -1 || f == NULL || err != EAGAIN) {
+			if (err != 0) {
+				errno = err;
+			}
+			return rc;
+		}
+		io_wait(f, false, seq);
+	}
+}
+
+int connect(int fd, __CONST_SOCKADDR_ARG addr, socklen_t len)
+{
+	struct io_fd* f = io_attach(fd);
+	unsigned seq = io_seq(f);
+	int err;
+	int rc = io_syscall(SYS_connect, fd, (long)addr.__sockaddr__, len, &err);
+	if (rc != -1 || f == NULL || err != EINPROGRESS) {
+		if (err != 0) {
+			errno = err;
+		}
+		return rc;
+	}
+
+	// the socket turns writable once the connection is established or failed
+	for (;;) {
+		struct pollfd p = {fd, POLLOUT, 0};
+		if (poll(&p, 1, 0) == 1) {
+			break;
+		}
+		io_wait(f, true, seq);
+		seq = io_seq(f);
+	}
+	socklen_t size = sizeof(err);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &size) == -1) {
+		return -1;
+	}
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+int close(int fd)
+{
+	struct io_fd* chunk = fd >= 0 && fd < IO_CHUNK * IO_CHUNKS ?
+		__atomic_load_n(&io_fds[fd / IO_CHUNK], __ATOMIC_ACQUIRE) : NULL;
+	if (chunk != NULL && chunk[fd % IO_CHUNK].mode != IO_UNKNOWN) {
+		// the next file with this number starts over, parked threads fail with EBADF
+		struct io_fd* f = &chunk[fd % IO_CHUNK];
+		lock();
+		if (f->mode == IO_REACTOR) {
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+			io_wake(&f->readers);
+			io_wake(&f->writers);
+		}
+		__atomic_add_fetch(&f->seq, 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&f->mode, IO_UNKNOWN, __ATOMIC_RELEASE);
+		unlock();
+	}
+	return syscall(SYS_close, fd);
+}
+
+/* park the running thread until the monotonic clock reaches deadline (ns) */
+static void thread_sleep(long long deadline)
+{
+	lock();
+	wheel_add(curr_thread, deadline, NULL, NULL);
+	thread_block(WAIT_SLEEP);
+	unlock();
+}
+
+/* the monotonic deadline of a timeout, far enough out not to overflow */
+static long long deadline_after(time_t sec, long nsec)
+{
+	if (sec > 1000000000L) {
+		sec = 1000000000L; // about 30 years
+	}
+	return now_ns() + sec * 1000000000LL + nsec;
+}
+
+/* the monotonic deadline of an abstime on clock, -1 if it is not valid */
+static long long abstime_deadline(clockid_t clock, const struct timespec* abstime)
+{
+	if (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000L) {
+		return -1;
+	}
+	struct timespec rt;
+	clock_gettime(clock, &rt);
+	time_t sec = abstime->tv_sec - rt.tv_sec;
+	long nsec = abstime->tv_nsec - rt.tv_nsec;
+	if (sec < 0 || (sec == 0 && nsec < 0)) {
+		return now_ns();
+	}
+	return deadline_after(sec, nsec);
+}
+
+/* a green thread sleeps on the timing wheel and the worker runs others */
+int nanosleep(const struct timespec* req, struct timespec* rem)
+{
+	if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000L) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (self == NULL) {
+		return syscall(SYS_nanosleep, req, rem);
+	}
+	thread_sleep(deadline_after(req->tv_sec, req->tv_nsec));
+	return 0;
+}
+
+int usleep(useconds_t usec)
+{
+	struct timespec req = {usec / 1000000, usec % 1000000 * 1000L};
+	return nanosleep(&req, NULL);
+}
+
+unsigned int sleep(unsigned int seconds)
+{
+	struct timespec req = {seconds, 0};
+	nanosleep(&req, NULL);
+	return 0;
+}
+
+/* Start Project 3 – Thread Synchronization */
+/* mutex functions */
+
+/* The state of a mutex lives in the pthread_mutex_t itself. All zero, as
+ * PTHREAD_MUTEX_INITIALIZER sets it, is an unlocked mutex. Locking and
+ * unlocking without contention is a single atomic instruction; threads that
+ * have to wait park on the mutex's address in the parking table.
+ * Unlocking wakes a parked thread, but does not hold the mutex for it: a
+ * running thread may take it first, sparing switches when threads lock it
+ * over and over. A thread parked longer than MUTEX_FAIR_NS is handed the
+ * mutex, so none waits for ever.
+ * With several workers a mutex is adaptive: a thread finding it locked by a
+ * thread running on another worker spins for about its usual hold time
+ * before it parks. The counts of the paths to the mutex are only changed by
+ * the thread holding it.
+ */
+enum mutex_state
+{
+	MUTEX_UNLOCKED,
+	MUTEX_LOCKED,
+	MUTEX_CONTENDED // locked, and threads may be parked on it
+};
+
+struct thread_mutex {
+	int state;
+	unsigned hold_avg; // moving average of the hold time in TSC ticks
+	struct thread_control_block* owner; // with several workers, else NULL
+	unsigned long long acquired; // TSC when the owner took it, 0 with one worker
+	unsigned fast; // taken right away
+	unsigned spun; // taken after spinning
+	unsigned parked; // handed over after parking
+};
+
+_Static_assert(sizeof(struct thread_mutex) <= sizeof(pthread_mutex_t), "mutex state does not fit");
+
+/* the running thread took m, on the path counted in *path */
+static inline void mutex_acquired(struct thread_mutex* m, unsigned* path)
+{
+	*path += 1;
+	if (nworkers > 1) {
+		__atomic_store_n(&m->owner, curr_thread, __ATOMIC_RELAXED);
+		m->acquired = __builtin_ia32_rdtsc();
+	}
+}
+
+/* spin while the owner of m runs on another worker, for up to twice its
+average hold time; returns whether the mutex was taken */
+static bool mutex_spin(struct thread_mutex* m)
+{
+	unsigned long long budget = 2ULL * __atomic_load_n(&m->hold_avg, __ATOMIC_RELAXED);
+	if (nworkers == 1 || budget > 2ULL * MUTEX_SPIN_MAX) {
+		return false;
+	}
+	if (budget < MUTEX_SPIN_MIN) {
+		budget = MUTEX_SPIN_MIN;
+	}
+
+	unsigned long long end = __builtin_ia32_rdtsc() + budget;
+	do {
+		int state = __atomic_load_n(&m->state, __ATOMIC_RELAXED);
+		if (state == MUTEX_UNLOCKED) {
+			if (__atomic_compare_exchange_n(&m->state, &state, MUTEX_LOCKED, false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				return true;
+			}
+		}
+		// the owner can only release it soon if it is running
+		struct thread_control_block* owner = __atomic_load_n(&m->owner, __ATOMIC_RELAXED);
+		if (owner != NULL && __atomic_load_n(&owner->status, __ATOMIC_RELAXED) != TS_RUNNING) {
+			return false;
+		}
+		__builtin_ia32_pause();
+	} while (__builtin_ia32_rdtsc() < end);
+	return false;
+}
+
+/* pthread_mutex_init() initializes a given mutex_t */
+int pthread_mutex_init(pthread_mutex_t *restrict mutex, const pthread_mutexattr_t *restrict attr) 
+{	
+	struct thread_mutex* m = (struct thread_mutex*)mutex;
+	memset(m, 0, sizeof(*m));
+	return 0;
+}
+
+/* destroy the referenced mutex */
+int pthread_mutex_destroy(pthread_mutex_t *mutex) 
+{	
+	struct thread_mutex* m = (struct thread_mutex*)mutex;
+	if (__atomic_load_n(&m->state, __ATOMIC_RELAXED) != MUTEX_UNLOCKED) {
+		return EBUSY;
+	}
+	return 0;
+}
+
+/* a thread waiting for a mutex timed out: take it out of the parking table (lock() held) */
+static void mutex_timeout(struct thread_control_block* t)
+{
+	park_unlink(t);
+	t->wait_result = ETIMEDOUT;
+}
+
+/* lock m, parking until it is free, or until the monotonic deadline (ns)
+unless it is 0. A thread woken by mutex_unpark() comes here, not through the
+fast path: threads may still be parked, the mutex has to be marked contended. */
+static int mutex_lock_contended(struct thread_mutex* m, long long deadline)
+{
+	lock();
+	long long since = 0;
+	for (;;) {
+		// mark it contended so that its unlock looks for parked threads; if
+		// it was unlocked meanwhile, that takes it
+		if (__atomic_exchange_n(&m->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE) == MUTEX_UNLOCKED) {
+			unlock();
+			mutex_acquired(m, since == 0 ? &m->fast : &m->parked);
+			return 0;
+		}
+		long long now = now_ns();
+		if (deadline != 0 && now >= deadline) {
+			unlock();
+			return ETIMEDOUT;
+		}
+
+		// the thread blocks until it is woken to try again or handed the mutex
+		curr_thread->status = TS_BLOCKED;
+		curr_thread->wait_since = since = since != 0 ? since : now;
+		park_enqueue(m, curr_thread);
+		if (deadline != 0) {
+			wheel_add(curr_thread, deadline, mutex_timeout, m);
+		}
+		thread_block(WAIT_MUTEX);
+		if (curr_thread->wait_result != EAGAIN) {
+			break;
+		}
+	}
+	if (curr_thread->wait_result == ETIMEDOUT) {
+		unlock();
+		return ETIMEDOUT;
+	}
+
+	unlock();
+	mutex_acquired(m, &m->parked);
+	return 0;
+}
+
+/* lock a mutex, waiting until the monotonic deadline (ns) unless it is 0 */
+static int mutex_lock(pthread_mutex_t *mutex, long long deadline)
+{
+	struct thread_mutex* m = (struct thread_mutex*)mutex;
+	int unlocked = MUTEX_UNLOCKED;
+	if (__atomic_compare_exchange_n(&m->state, &unlocked, MUTEX_LOCKED, false,
+		__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		mutex_acquired(m, &m->fast);
+		return 0;
+	}
+	if (mutex_spin(m)) {
+		mutex_acquired(m, &m->spun);
+		return 0;
+	}
+	return mutex_lock_contended(m, deadline);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	return mutex_lock(mutex, 0);
+}
+
+/* like pthread_mutex_lock, but gives up with ETIMEDOUT at abstime (CLOCK_REALTIME) */
+int pthread_mutex_timedlock(pthread_mutex_t *restrict mutex, const struct timespec *restrict abstime)
+{
+	long long deadline = abstime_deadline(CLOCK_REALTIME, abstime);
+	if (deadline == -1) {
+		return EINVAL;
+	}
+	return mutex_lock(mutex, deadline);
+}
+
+/* the running thread lets go of m; returns false when threads may be parked
+on it, one must then be woken by mutex_unpark() */
+static bool mutex_release(struct thread_mutex* m)
+{
+	if (m->acquired != 0) {
+		long long hold = __builtin_ia32_rdtsc() - m->acquired;
+		if (hold > INT_MAX) {
+			hold = INT_MAX;
+		}
+		long long avg = m->hold_avg;
+		__atomic_store_n(&m->hold_avg, (unsigned)(avg + (hold - avg) / 8), __ATOMIC_RELAXED);
+		m->acquired = 0;
+		__atomic_store_n(&m->owner, NULL, __ATOMIC_RELAXED);
+	}
+	int locked = MUTEX_LOCKED;
+	return __atomic_compare_exchange_n(&m->state, &locked, MUTEX_UNLOCKED, false,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+/* wake the longest parked thread of a released contended mutex: it tries
+again (EAGAIN) and marks the mutex contended, if others are still parked, as
+it takes it. Once it has waited MUTEX_FAIR_NS, the mutex stays locked (and
+contended) for it instead (lock() held) */
+static void mutex_unpark(struct thread_mutex* m)
+{
+	struct thread_control_block* next = park_dequeue(m);
+	if (next != NULL && now_ns() - next->wait_since >= MUTEX_FAIR_NS) {
+		next->wait_result = 0;
+		thread_wake(next);
+		return;
+	}
+	__atomic_store_n(&m->state, MUTEX_UNLOCKED, __ATOMIC_RELEASE);
+	if (next != NULL) {
+		next->wait_result = EAGAIN;
+		thread_wake(next);
+	}
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) 
+{	
+	struct thread_mutex* m = (struct thread_mutex*)mutex;
+	if (!mutex_release(m)) {
+		lock();
+		mutex_unpark(m);
+		unlock();
+	}
+	return 0;
+}
+
+int pthread_mutex_getstats_np(pthread_mutex_t *mutex, struct mutex_stats_np *stats)
+{
+	scheduler_start();
+	struct thread_mutex* m = (struct thread_mutex*)mutex;
+	stats->fast = m->fast;
+	stats->spun = m->spun;
+	stats->parked = m->parked;
+	stats->hold_ns = __atomic_load_n(&m->hold_avg, __ATOMIC_RELAXED) * tsc_scale();
+	return 0;
+}
+
+
+/* condition variable functions */
+
+/* The state of a condition variable lives in the pthread_cond_t, all zero
+ * (PTHREAD_COND_INITIALIZER) is a valid one. Its waiters park on its address.
+ * Signalling does not wake a waiter that would only block again on the mutex,
+ * which the signaller usually holds: the waiter moves to the mutex's queue
+ * and is woken as the mutex is unlocked (wait morphing). A broadcast so
+ * wakes the waiters one at a time. Only changed under sched_lock.
+ */
+struct thread_cond {
+	unsigned waiters; // parked on the condition
+	clockid_t clock; // of timed waits
+	struct thread_mutex* mutex; // the mutex of the waiters
+};
+
+_Static_assert(sizeof(struct thread_cond) <= sizeof(pthread_cond_t), "condition state does not fit");
+
+/* pthread_cond_init() initializes a given cond_t */
+int pthread_cond_init(pthread_cond_t *restrict cond, const pthread_condattr_t *restrict attr)
+{
+	struct thread_cond* c = (struct thread_cond*)cond;
+	memset(c, 0, sizeof(*c));
+	c->clock = CLOCK_REALTIME;
+	if (attr != NULL) {
+		pthread_condattr_getclock(attr, &c->clock);
+	}
+	return 0;
+}
+
+/* destroy the referenced condition variable */
+int pthread_cond_destroy(pthread_cond_t *cond)
+{
+	struct thread_cond* c = (struct thread_cond*)cond;
+	if (__atomic_load_n(&c->waiters, __ATOMIC_RELAXED) > 0) {
+		return EBUSY;
+	}
+	return 0;
+}
+
+/* a thread waiting for a condition timed out: take it out of the parking table (lock() held) */
+static void cond_timeout(struct thread_control_block* t)
+{
+	struct thread_cond* c = t->wait_obj;
+	park_unlink(t);
+	c->waiters -= 1;
+	t->wait_result = ETIMEDOUT;
+}
+
+/* release mutex and wait for the condition, until the monotonic deadline (ns)
+unless it is 0; returns holding the mutex again */
+static int cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, long long deadline)
+{
+	struct thread_cond* c = (struct thread_cond*)cond;
+	struct thread_mutex* m = (struct thread_mutex*)mutex;
+
+	lock();
+	// park before releasing the mutex: no signal can come in between
+	c->mutex = m;
+	__atomic_store_n(&c->waiters, c->waiters + 1, __ATOMIC_RELAXED);
+	curr_thread->status = TS_BLOCKED;
+	park_enqueue(c, curr_thread);
+	curr_thread->wait_result = 0;
+	if (deadline != 0) {
+		wheel_add(curr_thread, deadline, cond_timeout, c);
+	}
+	if (!mutex_release(m)) {
+		mutex_unpark(m);
+	}
+	thread_block(WAIT_COND);
+	int err = curr_thread->wait_result;
+	unlock();
+
+	if (err == 0) { // the mutex was handed to the thread
+		mutex_acquired(m, &m->parked);
+		return 0;
+	}
+	if (err == EAGAIN) { // woken from the mutex's queue
+		return mutex_lock_contended(m, 0);
+	}
+	mutex_lock(mutex, 0);
+	return err;
+}
+
+/* wake up to n threads waiting on c, by moving them to the mutex (lock() held) */
+static void cond_wake(struct thread_cond* c, unsigned n)
+{
+	struct thread_mutex* m = c->mutex;
+	long long now = now_ns();
+	struct thread_control_block* t;
+	while (n-- > 0 && (t = park_dequeue(c)) != NULL) {
+		__atomic_store_n(&c->waiters, c->waiters - 1, __ATOMIC_RELAXED);
+		// once signalled, a timed wait can no longer time out
+		if (t->timer_pprev != NULL) {
+			wheel_remove(t);
+		}
+		int unlocked = MUTEX_UNLOCKED;
+		if (__atomic_compare_exchange_n(&m->state, &unlocked, MUTEX_LOCKED, false,
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ||
+			__atomic_exchange_n(&m->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE) == MUTEX_UNLOCKED) {
+			thread_wake(t); // the mutex was free, it is t's now
+		}
+		else {
+			t->wait_since = now;
+			park_enqueue(m, t); // it is woken as the mutex is unlocked
+		}
+	}
+}
+
+int pthread_cond_wait(pthread_cond_t *restrict cond, pthread_mutex_t *restrict mutex)
+{
+	scheduler_start();
+	return cond_wait(cond, mutex, 0);
+}
+
+int pthread_cond_timedwait(pthread_cond_t *restrict cond, pthread_mutex_t *restrict mutex,
+	const struct timespec *restrict abstime)
+{
+	scheduler_start();
+	struct thread_cond* c = (struct thread_cond*)cond;
+	long long deadline = abstime_deadline(c->clock, abstime);
+	if (deadline == -1) {
+		return EINVAL;
+	}
+	return cond_wait(cond, mutex, deadline);
+}
+
+int pthread_cond_signal(pthread_cond_t *cond)
+{
+	struct thread_cond* c = (struct thread_cond*)cond;
+	if (__atomic_load_n(&c->waiters, __ATOMIC_RELAXED) == 0) {
+		return 0;
+	}
+	lock();
+	cond_wake(c, 1);
+	unlock();
+	return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+	struct thread_cond* c = (struct thread_cond*)cond;
+	if (__atomic_load_n(&c->waiters, __ATOMIC_RELAXED) == 0) {
+		return 0;
+	}
+	lock();
+	cond_wake(c, UINT_MAX);
+	unlock();
+	return 0;
+}
+
+
+/* reader-writer lock functions */
+
+/* The state of a reader-writer lock lives in the pthread_rwlock_t, all zero
+ * (PTHREAD_RWLOCK_INITIALIZER) is a valid one. Taking and releasing it is an
+ * atomic instruction on its state word while no thread is parked on it, so
+ * readers on different workers never take the scheduler lock. Otherwise
+ * threads park on one of two addresses in the lock, for readers and writers,
+ * and a releasing thread hands the lock to the next: after a writer, all
+ * parked readers in one batch; after the last reader, a writer.
+ * By default a writer waiting keeps new readers out, and the batches keep
+ * writers from shutting out readers in turn. With a PTHREAD_RWLOCK_PREFER_READER_NP
+ * attribute (the kind of a default one) readers get in as long as no writer
+ * holds the lock, which may starve writers.
+ */
+#define RW_WRITER 0x80000000u // held by a writer
+#define RW_PARKED 0x40000000u // threads are parked on it
+#define RW_READERS 0x3fffffffu // the count of readers holding it
+
+struct thread_rwlock {
+	unsigned state;
+	// threads parked on each, under sched_lock; their addresses are the keys
+	// readers and writers park on
+	unsigned readers_parked;
+	unsigned writers_parked;
+	bool prefer_readers;
+};
+
+_Static_assert(sizeof(struct thread_rwlock) <= sizeof(pthread_rwlock_t), "rwlock state does not fit");
+
+/* pthread_rwlock_init() initializes a given rwlock_t */
+int pthread_rwlock_init(pthread_rwlock_t *restrict rwlock, const pthread_rwlockattr_t *restrict attr)
+{
+	struct thread_rwlock* rw = (struct thread_rwlock*)rwlock;
+	memset(rw, 0, sizeof(*rw));
+	int kind;
+	if (attr != NULL && pthread_rwlockattr_getkind_np(attr, &kind) == 0) {
+		rw->prefer_readers = kind == PTHREAD_RWLOCK_PREFER_READER_NP;
+	}
+	return 0;
+}
+
+/* destroy the referenced rwlock */
+int pthread_rwlock_destroy(pthread_rwlock_t *rwlock)
+{
+	struct thread_rwlock* rw = (struct thread_rwlock*)rwlock;
+	if (__atomic_load_n(&rw->state, __ATOMIC_RELAXED) != 0) {
+		return EBUSY;
+	}
+	return 0;
+}
+
+/* hand rw to the parked threads that can have it now, and clear RW_PARKED
+when none is left. writer_first picks a writer over readers for a free lock,
+as after its last reader (lock() held) */
+static void rwlock_admit(struct thread_rwlock* rw, bool writer_first)
+{
+	unsigned state = __atomic_load_n(&rw->state, __ATOMIC_ACQUIRE);
+	if (!(state & RW_WRITER)) {
+		bool free = (state & RW_READERS) == 0;
+		struct thread_control_block* t;
+		if (rw->readers_parked > 0 && (rw->writers_parked == 0 ||
+			rw->prefer_readers || (free && !writer_first))) {
+			// the readers that queued up get in together
+			__atomic_add_fetch(&rw->state, rw->readers_parked, __ATOMIC_ACQUIRE);
+			while ((t = park_dequeue(&rw->readers_parked)) != NULL) {
+				thread_wake(t);
+			}
+			rw->readers_parked = 0;
+		}
+		else if (free && rw->writers_parked > 0) {
+			// RW_PARKED keeps others out, and there is no holder to release it
+			__atomic_or_fetch(&rw->state, RW_WRITER, __ATOMIC_ACQUIRE);
+			rw->writers_parked -= 1;
+			thread_wake(park_dequeue(&rw->writers_parked));
+		}
+	}
+	if (rw->readers_parked == 0 && rw->writers_parked == 0) {
+		__atomic_and_fetch(&rw->state, ~RW_PARKED, __ATOMIC_RELEASE);
+	}
+}
+
+/* a thread waiting for a rwlock timed out: take it out of the parking table,
+the readers a writer kept out may get in now (lock() held) */
+static void rwlock_timeout(struct thread_control_block* t)
+{
+	struct thread_rwlock* rw = t->wait_obj;
+	if (t->park_addr == &rw->readers_parked) {
+		rw->readers_parked -= 1;
+	}
+	else {
+		rw->writers_parked -= 1;
+	}
+	park_unlink(t);
+	t->wait_result = ETIMEDOUT;
+	rwlock_admit(rw, true);
+}
+
+/* take rw for reading or writing, waiting until the monotonic deadline (ns)
+unless it is 0, or not at all if it is -1 */
+static int rwlock_lock(pthread_rwlock_t *rwlock, bool write, long long deadline)
+{
+	struct thread_rwlock* rw = (struct thread_rwlock*)rwlock;
+	unsigned state = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+	if (write) {
+		if (state == 0 && __atomic_compare_exchange_n(&rw->state, &state, RW_WRITER, false,
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			return 0;
+		}
+	}
+	else {
+		while (!(state & (RW_WRITER | RW_PARKED))) {
+			if ((state & RW_READERS) == RW_READERS) {
+				return EAGAIN;
+			}
+			if (__atomic_compare_exchange_n(&rw->state, &state, state + 1, true,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				return 0;
+			}
+		}
+	}
+
+	scheduler_start();
+
+	lock();
+	// a last reader may have left without handing the lock on yet
+	rwlock_admit(rw, true);
+	// holders release it without lock() until RW_PARKED is set: take it or set
+	// RW_PARKED against the same state, so that no release goes unseen
+	state = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+	for (;;) {
+		if (write ? (state & ~RW_PARKED) == 0 :
+			!(state & RW_WRITER) && (rw->writers_parked == 0 || rw->prefer_readers)) {
+			if (__atomic_compare_exchange_n(&rw->state, &state, state + (write ? RW_WRITER : 1),
+				false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				unlock();
+				return 0;
+			}
+			continue;
+		}
+		if (deadline == -1 || (deadline != 0 && now_ns() >= deadline)) {
+			unlock();
+			return deadline == -1 ? EBUSY : ETIMEDOUT;
+		}
+		if ((state & RW_PARKED) || __atomic_compare_exchange_n(&rw->state, &state,
+			state | RW_PARKED, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+
+	// the thread blocks until the lock is handed to it
+	unsigned* parked = write ? &rw->writers_parked : &rw->readers_parked;
+	*parked += 1;
+	curr_thread->status = TS_BLOCKED;
+	park_enqueue(parked, curr_thread);
+	curr_thread->wait_result = 0;
+	if (deadline != 0) {
+		wheel_add(curr_thread, deadline, rwlock_timeout, rw);
+	}
+	thread_block(WAIT_RWLOCK);
+	int err = curr_thread->wait_result;
+	unlock();
+	return err;
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
+{
+	return rwlock_lock(rwlock, false, 0);
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
+{
+	return rwlock_lock(rwlock, true, 0);
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock)
+{
+	return rwlock_lock(rwlock, false, -1);
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock)
+{
+	return rwlock_lock(rwlock, true, -1);
+}
+
+/* like pthread_rwlock_rdlock, but gives up with ETIMEDOUT at abstime (CLOCK_REALTIME) */
+int pthread_rwlock_timedrdlock(pthread_rwlock_t *restrict rwlock, const struct timespec *restrict abstime)
+{
+	long long deadline = abstime_deadline(CLOCK_REALTIME, abstime);
+	if (deadline == -1) {
+		return EINVAL;
+	}
+	return rwlock_lock(rwlock, false, deadline);
+}
+
+/* like pthread_rwlock_wrlock, but gives up with ETIMEDOUT at abstime (CLOCK_REALTIME) */
+int pthread_rwlock_timedwrlock(pthread_rwlock_t *restrict rwlock, const struct timespec *restrict abstime)
+{
+	long long deadline = abstime_deadline(CLOCK_REALTIME, abstime);
+	if (deadline == -1) {
+		return EINVAL;
+	}
+	return rwlock_lock(rwlock, true, deadline);
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
+{
+	struct thread_rwlock* rw = (struct thread_rwlock*)rwlock;
+	unsigned state = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+	if (state & RW_WRITER) {
+		if (state == RW_WRITER && __atomic_compare_exchange_n(&rw->state, &state, 0, false,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			return 0;
+		}
+		// with RW_PARKED set no other thread can change the state
+		lock();
+		__atomic_and_fetch(&rw->state, ~RW_WRITER, __ATOMIC_RELEASE);
+		rwlock_admit(rw, false);
+		unlock();
+		return 0;
+	}
+
+	if (__atomic_sub_fetch(&rw->state, 1, __ATOMIC_RELEASE) == RW_PARKED) {
+		lock();
+		rwlock_admit(rw, true);
+		unlock();
+	}
+	return 0;
+}
+
+
+/* barrier functions */
+
+/* The state of a barrier lives in the pthread_barrier_t itself. A central
+ * barrier (the default) counts the threads in under sched_lock, they wait for
+ * the others parked on its address and the last one wakes them all.
+ * A tree barrier combines arrivals up a tree of BARRIER_FANIN-way nodes: an
+ * atomic ticket places each arrival in a leaf, only the last arrival at a
+ * node goes on to its parent, and the last at the root releases the round
+ * by setting the sense the waiters of the round wait for (sense reversal:
+ * even and odd rounds wait for opposite values). Released threads then wake
+ * the waiters parked on the nodes they came up through, so both arrival and
+ * release take steps logarithmic in the number of threads, spread over them.
+ */
+struct thread_barrier {
+	// number of threads needed
+	unsigned threads_required;
+	// count the number of threads in the barrier
+	unsigned threads_in;
+	// the tree of a tree barrier, NULL for a central one
+	struct barrier_tree* tree;
+};
+
+_Static_assert(sizeof(struct thread_barrier) <= sizeof(pthread_barrier_t), "barrier state does not fit");
+
+/* a node of a tree barrier, on a cache line of its own */
+struct barrier_node {
+	unsigned arrived; // this round
+	unsigned required; // threads or child nodes
+	// threads parked on the node, changed under sched_lock, by the sense they
+	// wait for: the next round may arrive before this one is woken. Their
+	// addresses are the keys the threads park on.
+	unsigned parked[2];
+	struct barrier_node* parent; // NULL for the root
+} __attribute__((aligned(64)));
+
+struct barrier_tree {
+	unsigned long long tickets; // arrivals so far
+	int sense __attribute__((aligned(64))); // the sense the last round was released with
+	struct barrier_node nodes[]; // the leaves first, the root last
+};
+
+/* the attributes of a barrier, in a pthread_barrierattr_t */
+struct thread_barrierattr {
+	unsigned char pshared;
+	unsigned char kind;
+};
+
+_Static_assert(sizeof(struct thread_barrierattr) <= sizeof(pthread_barrierattr_t), "barrier attributes do not fit");
+
+int pthread_barrierattr_init(pthread_barrierattr_t *attr)
+{
+	memset(attr, 0, sizeof(*attr));
+	return 0;
+}
+
+int pthread_barrierattr_getpshared(const pthread_barrierattr_t *restrict attr, int *restrict pshared)
+{
+	*pshared = ((const struct thread_barrierattr*)attr)->pshared;
+	return 0;
+}
+
+int pthread_barrierattr_setpshared(pthread_barrierattr_t *attr, int pshared)
+{
+	if (pshared != PTHREAD_PROCESS_PRIVATE && pshared != PTHREAD_PROCESS_SHARED) {
+		return EINVAL;
+	}
+	((struct thread_barrierattr*)attr)->pshared = pshared;
+	return 0;
+}
+
+int pthread_barrierattr_getkind_np(const pthread_barrierattr_t *attr, int *kind)
+{
+	*kind = ((const struct thread_barrierattr*)attr)->kind;
+	return 0;
+}
+
+int pthread_barrierattr_setkind_np(pthread_barrierattr_t *attr, int kind)
+{
+	if (kind != PTHREAD_BARRIER_CENTRAL_NP && kind != PTHREAD_BARRIER_TREE_NP) {
+		return EINVAL;
+	}
+	((struct thread_barrierattr*)attr)->kind = kind;
+	return 0;
+}
+
+/* allocate the tree of a barrier for count threads, NULL if out of memory */
+static struct barrier_tree* barrier_tree_alloc(unsigned count)
+{
+	// a level has a node for every BARRIER_FANIN nodes (or threads) below it
+	size_t nodes = 0;
+	for (unsigned width = count; width > 1 || nodes == 0; width = (width + BARRIER_FANIN - 1) / BARRIER_FANIN) {
+		nodes += (width + BARRIER_FANIN - 1) / BARRIER_FANIN;
+	}
+	size_t size = sizeof(struct barrier_tree) + nodes * sizeof(struct barrier_node);
+	struct barrier_tree* tree = aligned_alloc(64, size);
+	if (tree == NULL) {
+		return NULL;
+	}
+	memset(tree, 0, size);
+
+	struct barrier_node* level = tree->nodes;
+	unsigned width = count;
+	for (;;) {
+		unsigned n = (width + BARRIER_FANIN - 1) / BARRIER_FANIN;
+		struct barrier_node* above = level + n;
+		for (unsigned i = 0; i < n; i++) {
+			level[i].required = i < n - 1 ? BARRIER_FANIN : width - (n - 1) * BARRIER_FANIN;
+			level[i].parent = n > 1 ? &above[i / BARRIER_FANIN] : NULL;
+		}
+		if (n == 1) {
+			return tree;
+		}
+		level = above;
+		width = n;
+	}
+}
+
+/* pthread_barrier_init() initializes a given barrier_t */
+int pthread_barrier_init(pthread_barrier_t *restrict barrier, const pthread_barrierattr_t *restrict attr, unsigned count)
+{	
+	if (count == 0) {
+		return EINVAL;
+	}
+
+	struct thread_barrier* b = (struct thread_barrier*)barrier;
+	b->threads_required = count;
+	b->threads_in = 0;
+	b->tree = NULL;
+	if (attr != NULL && ((const struct thread_barrierattr*)attr)->kind == PTHREAD_BARRIER_TREE_NP) {
+		b->tree = barrier_tree_alloc(count);
+		if (b->tree == NULL) {
+			return ENOMEM;
+		}
+	}
+	return 0;
+}
+
+/* destory the referenced barrier */
+int pthread_barrier_destroy(pthread_barrier_t *barrier) 
+{	
+	scheduler_start();
+
+	lock();
+	struct thread_barrier* b = (struct thread_barrier*)barrier;
+	if (b->threads_in > 0 ||
+		(b->tree != NULL && __atomic_load_n(&b->tree->tickets, __ATOMIC_ACQUIRE) % b->threads_required != 0)) {
+		unlock();
+		return EBUSY;
+	}
+	b->threads_required = 0;
+	free(b->tree);
+	b->tree = NULL;
+	unlock();
+	return 0;
+}
+
+/* wait in a node of a tree until tree->sense is release: spin a while with
+several workers, the thread releasing the round may be running on another,
+unless threads that may still have to arrive are ready on this one; then park */
+static void barrier_node_wait(struct barrier_tree* tree, struct barrier_node* node, int release)
+{
+	if (nworkers > 1) {
+		struct worker* w = this_worker();
+		unsigned long long end = __builtin_ia32_rdtsc() + BARRIER_SPIN;
+		while (__atomic_load_n(&tree->sense, __ATOMIC_ACQUIRE) != release &&
+			__atomic_load_n(&w->ready.count, __ATOMIC_RELAXED) == 0 &&
+			__builtin_ia32_rdtsc() < end) {
+			__builtin_ia32_pause();
+		}
+	}
+	unsigned* parked = &node->parked[release];
+	lock();
+	// counted before the sense is checked again, so that the thread that
+	// releases the node either sees it or it sees the new sense
+	__atomic_add_fetch(parked, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&tree->sense, __ATOMIC_SEQ_CST) == release) {
+		__atomic_sub_fetch(parked, 1, __ATOMIC_RELAXED);
+		unlock();
+		return;
+	}
+	curr_thread->status = TS_BLOCKED;
+	park_enqueue(parked, curr_thread);
+	thread_block(WAIT_BARRIER);
+	unlock();
+}
+
+/* wake the threads waiting for release on the nodes a released thread came
+up through, from the top: they go on to wake the nodes below */
+static void barrier_tree_release(struct barrier_node** path, int depth, int release)
+{
+	while (depth-- > 0) {
+		unsigned* parked = &path[depth]->parked[release];
+		if (__atomic_load_n(parked, __ATOMIC_SEQ_CST) == 0) {
+			continue;
+		}
+		lock();
+		struct thread_control_block* t;
+		while ((t = park_dequeue(parked)) != NULL) {
+			__atomic_sub_fetch(parked, 1, __ATOMIC_RELAXED);
+			thread_wake(t);
+		}
+		unlock();
+	}
+}
+
+/* wait at a tree barrier for count threads */
+static int barrier_tree_wait(struct barrier_tree* tree, unsigned count)
+{
+	unsigned long long ticket = __atomic_fetch_add(&tree->tickets, 1, __ATOMIC_ACQ_REL);
+	int release = (ticket / count & 1) ^ 1;
+	struct barrier_node* node = &tree->nodes[ticket % count / BARRIER_FANIN];
+
+	// the last to arrive at a node goes up, after it is reset for the next
+	// round: no thread arrives there before the root releases this one
+	struct barrier_node* path[8 * sizeof(unsigned)];
+	int depth = 0;
+	while (__atomic_add_fetch(&node->arrived, 1, __ATOMIC_ACQ_REL) == node->required) {
+		__atomic_store_n(&node->arrived, 0, __ATOMIC_RELAXED);
+		path[depth++] = node;
+		if (node->parent == NULL) {
+			__atomic_store_n(&tree->sense, release, __ATOMIC_SEQ_CST);
+			barrier_tree_release(path, depth, release);
+			return PTHREAD_BARRIER_SERIAL_THREAD;
+		}
+		node = node->parent;
+	}
+
+	barrier_node_wait(tree, node, release);
+	barrier_tree_release(path, depth, release);
+	return 0;
+}
+
+/* a thread waiting at a barrier timed out: it leaves the barrier (lock() held) */
+static void barrier_timeout(struct thread_control_block* t)
+{
+	struct thread_barrier* b = t->wait_obj;
+	park_unlink(t);
+	b->threads_in -= 1;
+	t->wait_result = ETIMEDOUT;
+}
+
+/* wait for all threads to reach the barrier then proceed, or until the
+monotonic deadline (ns) unless it is 0 */
+static int barrier_wait(pthread_barrier_t *barrier, long long deadline)
+{
+	/*
+	* The pthread_barrier_wait() function enters the referenced barrier. 
+	* The calling thread shall not proceed until the required number of threads 
+	* (from count in pthread_barrier_init) have already entered the barrier. 
+	* Other threads shall be allowed to proceed while this thread is in a barrier 
+	* (unless they are also blocked for other reasons). 
+	* Upon exiting a barrier, the order that the threads are awoken is undefined. 
+	* Exactly one of the returned threads shall return PTHREAD_BARRIER_SERIAL_THREAD 
+	* (it does not matter which one). 
+	* The rest of the threads shall return 0.
+	*/
+	scheduler_start();
+
+	lock();
+	struct thread_barrier* b = (struct thread_barrier*)barrier;
+
+	b->threads_in += 1;
+	if (b->threads_in > b->threads_required) {
+		b->threads_in -= 1;
+		unlock();
+		return EINVAL;
+	}
+
+	if (b->threads_in < b->threads_required) {
+		if (deadline != 0 && now_ns() >= deadline) {
+			b->threads_in -= 1;
+			unlock();
+			return ETIMEDOUT;
+		}
+		curr_thread->status = TS_BLOCKED;
+		park_enqueue(b, curr_thread);
+		if (deadline != 0) {
+			wheel_add(curr_thread, deadline, barrier_timeout, b);
+		}
+		thread_block(WAIT_BARRIER);
+		if (deadline != 0 && curr_thread->wait_result == ETIMEDOUT) {
+			unlock();
+			return ETIMEDOUT;
+		}
+		unlock();
+		return 0;
+	}
+	else {	// release the threads in the barrier
+		struct thread_control_block* t;
+		while ((t = park_dequeue(b)) != NULL) {
+			thread_wake(t);
+		}
+		b->threads_in = 0;
+	}
+
+	unlock();
+	return PTHREAD_BARRIER_SERIAL_THREAD;
+}
+
+int pthread_barrier_wait(pthread_barrier_t *barrier)
+{
+	struct thread_barrier* b = (struct thread_barrier*)barrier;
+	if (b->tree != NULL) {
+		scheduler_start();
+		return barrier_tree_wait(b->tree, b->threads_required);
+	}
+	return barrier_wait(barrier, 0);
+}
+
+int pthread_barrier_timedwait_np(pthread_barrier_t *barrier, const struct timespec *abstime)
+{
+	if (((struct thread_barrier*)barrier)->tree != NULL) {
+		return ENOTSUP;
+	}
+	long long deadline = abstime_deadline(CLOCK_REALTIME, abstime);
+	if (deadline == -1) {
+		return EINVAL;
+	}
+	return barrier_wait(barrier, deadline);
+}
+
+/* tasks */
+
+/* take a task from the pool, carving a new slab when it is empty; NULL if out
+of memory (lock() held) */
+static struct thread_task* task_alloc()
+{
+	if (task_pool == NULL) {
+		struct thread_task* slab = malloc(TASK_SLAB * sizeof(struct thread_task));
+		if (slab == NULL) {
+			return NULL;
+		}
+		for (int i = 0; i < TASK_SLAB; i++) {
+			slab[i].state = TASK_FREE;
+			slab[i].next = task_pool;
+			task_pool = &slab[i];
+		}
+	}
+	struct thread_task* t = task_pool;
+	task_pool = t->next;
+	return t;
 }
 
-static void unlock()
+/* return a task to the pool (lock() held) */
+static void task_free(struct thread_task* t)
 {
-	sigset_t sig;
-	sigemptyset(&sig);
-	sigaddset(&sig, SIGALRM);
-	sigprocmask(SIG_UNBLOCK, &sig, NULL);
+	t->state = TASK_FREE;
+	t->next = task_pool;
+	task_pool = t;
 }
 
-/* insert a TCB to the circular list/queue of available runnable threads */
-void queue_insert(Queue* queue, struct thread_control_block* new_thread) {
-	lock();
-	if(queue->head == NULL) {
-		queue->head = new_thread;
-		queue->tail = new_thread;
+/* take a task out of the queue (lock() held) */
+static void task_unlink(struct thread_task* t)
+{
+	if (t->prev != NULL) {
+		t->prev->next = t->next;
 	}
 	else {
-		queue->tail->next = new_thread;
-		queue->tail = new_thread;
-		queue->tail->next = queue->head;
+		task_head = t->next;
 	}
-	unlock();
-}
-
-/* determine which is the next thread to run */
-struct thread_control_block* get_next_thread() {
-	lock();
-	if(curr_thread->next == NULL) {
-		return curr_thread;
+	if (t->next != NULL) {
+		t->next->prev = t->prev;
 	}
 	else {
-		return curr_thread->next;
+		task_tail = t->prev;
 	}
-	unlock();
+	task_queued--;
 }
 
-static void schedule(int signal)
+/* the function of a task returned: hand the result to whoever waits for it
+(lock() held) */
+static void task_finish(struct thread_task* t, void* result)
 {
-	/* TODO: implement your round-robin scheduler
-	 * 1. Use setjmp() to update your currently-active thread's jmp_buf
-	 *    You DON'T need to manually modify registers here.
-	 * 2. Determine which is the next thread that should run
-	 * 3. Switch to the next thread (use longjmp on that thread's jmp_buf)
-	 */
-
-	lock();
-	// update curr_thread's jmp_buf
-	if (!setjmp(curr_thread->env)) {
-		if(curr_thread->status == TS_RUNNING) {
-			curr_thread->status = TS_READY;
-		}
-		for (int i = 0; i <= MAX_THREADS; i++) {
-			curr_thread = get_next_thread();
-			// make it so a blocked thread is not chosen by the scheduler
-			if (curr_thread->status == TS_READY) {
-				// activate the next ready thread
-				curr_thread->status = TS_RUNNING;
-				unlock();
-				longjmp(curr_thread->env, 1);
-				break;
-			}
+	t->result = result;
+	t->state = TASK_DONE;
+	task_group_t* group = t->group;
+	if (group != NULL) {
+		task_free(t); // tasks of a group are not awaited one by one
+		if (--group->pending == 0 && group->waiter != NULL) {
+			thread_wake(group->waiter);
+			group->waiter = NULL;
 		}
 	}
-	else { // thread called longjmp and is now running/return back to env
-		curr_thread->status = TS_RUNNING;
+	else if (t->awaiter != NULL) {
+		thread_wake(t->awaiter);
 	}
 }
 
-static void scheduler_init()
+/* a runner: runs queued tasks, parks when there are none or when a runner
+that was blocked came back and there are too many */
+static void* task_runner(void* arg)
 {
-	/* TODO: do everything that is needed to initialize your scheduler. For example:
-	 * - Allocate/initialize global threading data structures
-	 * - Create a TCB for the main thread. Note: This is less complicated
-	 *   than the TCBs you create for all other threads. In this case, your
-	 *   current stack and registers are already exactly what they need to be!
-	 *   Just make sure they are correctly referenced in your TCB.
-	 * - Set up your timers to call schedule() at a 50 ms interval (SCHEDULER_INTERVAL_USECS)
-	*/
-
 	lock();
-	// initialize global variables
-	thread_id_count = 0;
-	curr_thread = (struct thread_control_block*)malloc(sizeof(struct thread_control_block));
-	thread_queue = (Queue*)malloc(sizeof(Queue));
-	thread_queue->head = NULL;
-	thread_queue->tail = NULL;
-
-	// create tcb for main thread and add to runnnable thread queue
-	struct thread_control_block* main_thread = (struct thread_control_block*)malloc(sizeof(struct thread_control_block));
-	main_thread->id = thread_id_count;
-	main_thread->status = TS_READY;
-	queue_insert(thread_queue, main_thread);
-	curr_thread = main_thread;
-
-	// set up the timer to call schedule()
-	struct sigaction act;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = SA_NODEFER;
-	act.sa_handler = schedule;
-	sigaction(SIGALRM, &act, NULL);
-	if(ualarm(SCHEDULER_INTERVAL_USECS, SCHEDULER_INTERVAL_USECS) < 0) {
-		perror("ERROR");
-	}
+	for (;;) {
+		if (task_head == NULL || task_runners > nworkers) {
+			task_runners--;
+			if (idle_runner_count >= nworkers) {
+				break; // enough spares parked already
+			}
+			curr_thread->next = idle_runners;
+			idle_runners = curr_thread;
+			idle_runner_count++;
+			thread_block(WAIT_TASK);
+			continue; // whoever woke us counted us in task_runners
+		}
 
+		struct thread_task* t = task_head;
+		task_unlink(t);
+		t->state = TASK_RUNNING;
+		curr_thread->task = t;
+		unlock();
+		void* result = t->fn(t->arg);
+		lock();
+		curr_thread->task = NULL;
+		task_finish(t, result);
+	}
 	unlock();
+	return arg;
 }
 
-
-int pthread_create(
-	pthread_t *thread, const pthread_attr_t *attr,
-	void *(*start_routine) (void *), void *arg)
+/* keep nworkers runners running while tasks are queued: wake a parked one or
+create one (lock() held) */
+static void task_runner_add()
 {
-	lock();
-	// Create the timer and handler for the scheduler. Create thread 0.
-	static bool is_first_call = true;
-	if (is_first_call)
-	{
-		is_first_call = false;
-		scheduler_init();
+	if (task_head == NULL || task_runners >= nworkers) {
+		return;
+	}
+	struct thread_control_block* r = idle_runners;
+	if (r != NULL) {
+		idle_runners = r->next;
+		idle_runner_count--;
+		thread_wake(r);
+	}
+	else if (thread_create(&r, NULL, task_runner, NULL) == 0) {
+		r->detached = true;
 	}
+	else {
+		return; // the runners there are will get to the queue
+	}
+	task_runners++;
+}
 
-	/* TODO: Return 0 on successful thread creation, non-zero for an error.
-	 *       Be sure to set *thread on success.
-	 * Hints:
-	 * The general purpose is to create a TCB:
-	 * - Create a stack.
-	 * - Assign the stack pointer in the thread's registers. Important: where
-	 *   within the stack should the stack pointer be? It may help to draw
-	 *   an empty stack diagram to answer that question.
-	 * - Assign the program counter in the thread's registers.
-	 * - Wait... HOW can you assign registers of that new stack?
-	 *   1. call setjmp() to initialize a jmp_buf with your current thread
-	 *   2. modify the internal data in that jmp_buf to create a new thread environment
-	 *      env->__jmpbuf[JB_...] = ...
-	 *      See the additional note about registers below
-	 *   3. Later, when your scheduler runs, it will longjmp using your
-	 *      modified thread environment, which will apply all the changes
-	 *      you made here.
-	 * - Remember to set your new thread as TS_READY, but only  after you
-	 *   have initialized everything for the new thread.
-	 * - Optionally: run your scheduler immediately (can also wait for the
-	 *   next scheduling event).
-	 */
+/* queue fn(arg) as a task, or run it right here when the queue is full; *out
+is the task unless it is one of a group (lock() held) */
+static int task_start(struct thread_task** out, task_group_t* group, void *(*fn)(void *), void* arg)
+{
+	struct thread_task* t = task_alloc();
+	if (t == NULL) {
+		return EAGAIN;
+	}
+	t->fn = fn;
+	t->arg = arg;
+	t->group = group;
+	t->awaiter = NULL;
+	if (out != NULL) {
+		*out = t;
+	}
+	if (group != NULL) {
+		group->pending++;
+	}
 
-	/*
-	 * Setting registers for a new thread:
-	 * When creating a new thread that will begin in start_routine, we
-	 * also need to ensure that `arg` is passed to the start_routine.
-	 * We cannot simply store `arg` in a register and set PC=start_routine.
-	 * This is because the AMD64 calling convention keeps the first arg in
-	 * the EDI register, which is not a register we control in jmp_buf.
-	 * We provide a start_thunk function that copies R13 to RDI then jumps
-	 * to R12, effectively calling function_at_R12(value_in_R13). So
-	 * you can call your start routine with the given argument by setting
-	 * your new thread's PC to be ptr_mangle(start_thunk), and properly
-	 * assigning R12 and R13.
-	 *
-	 * Don't forget to assign RSP too! Functions know where to
-	 * return after they finish based on the calling convention (AMD64 in
-	 * our case). The address to return to after finishing start_routine
-	 * should be the first thing you push on your stack.
-	*/
+	// the runners are far behind, so the spawner does the work: this bounds
+	// the memory of the queue however fast tasks are spawned
+	if (task_queued >= TASK_QUEUE_MAX) {
+		t->state = TASK_RUNNING;
+		unlock();
+		void* result = fn(arg);
+		lock();
+		task_finish(t, result);
+		return 0;
+	}
 
-	struct thread_control_block* my_thread = (struct thread_control_block*)malloc(sizeof(struct thread_control_block));
-	char* sp;
-	
-	// set the thread id 
-	thread_id_count += 1;
-	my_thread->id = thread_id_count;
-
-	// create the stack and assign a stack pointer sp
-	my_thread->stack = (char*)malloc(THREAD_STACK_SIZE);
-	sp = my_thread->stack + THREAD_STACK_SIZE;
-	unsigned long int exit_addr = (unsigned long int)pthread_exit;
-	memcpy(sp - ADDRESS_SIZE, &exit_addr, ADDRESS_SIZE);
-	sp -= ADDRESS_SIZE;
-
-	// assign my_thread registers using setjmp 
-	setjmp(my_thread->env);
-	my_thread->env[0].__jmpbuf[JB_PC] = ptr_mangle((unsigned long int)start_thunk);
-	my_thread->env[0].__jmpbuf[JB_R12] = (unsigned long int)start_routine;
-	my_thread->env[0].__jmpbuf[JB_R13] = (unsigned long int)arg;
-	my_thread->env[0].__jmpbuf[JB_RSP] = ptr_mangle((unsigned long int)sp);
-
-	// set my_thread as ready and add it to the runnable thread queue
-	my_thread->status = TS_READY;
-	queue_insert(thread_queue, my_thread);
+	t->state = TASK_QUEUED;
+	t->next = NULL;
+	t->prev = task_tail;
+	if (task_tail != NULL) {
+		task_tail->next = t;
+	}
+	else {
+		task_head = t;
+	}
+	task_tail = t;
+	task_queued++;
+	task_runner_add();
+	return 0;
+}
 
-	// set *thread on success
-	*thread = my_thread->id;
+int task_spawn(task_t *task, void *(*fn)(void *), void *arg)
+{
+	scheduler_start();
 
+	lock();
+	int err = task_start(task, NULL, fn, arg);
 	unlock();
-	return 0;
+	return err;
 }
 
-void pthread_exit(void *value_ptr)
+int task_await(task_t task, void **result)
 {
-	/* TODO: Exit the current thread instead of exiting the entire process.
-	 * Hints:
-	 * - Release all resources for the current thread. CAREFUL though.
-	 *   If you free() the currently-in-use stack then do something like
-	 *   call a function or add/remove variables from the stack, bad things
-	 *   can happen.
-	 * - Update the thread's status to indicate that it has exited
-	*/
+	scheduler_start();
 
 	lock();
-	curr_thread->status = TS_EXITED;
-	if(curr_thread->stack != NULL) {
-		free(curr_thread->stack);
+	struct thread_task* t = task;
+	if (t->group != NULL || t->awaiter != NULL || t->state == TASK_FREE) {
+		unlock();
+		return EINVAL;
 	}
-
-	// call schedule if a thread remains
-	if (curr_thread->next != NULL) {
-		free(curr_thread);
-		schedule(0);
+	if (t->state == TASK_QUEUED) {
+		// no runner took it yet: run it here rather than wait for one
+		task_unlink(t);
+		t->state = TASK_RUNNING;
+		unlock();
+		t->result = t->fn(t->arg);
+		lock();
+		t->state = TASK_DONE;
 	}
-	else { // no threads remain so exit the program
-		exit(0);
+	else if (t->state == TASK_RUNNING) {
+		t->awaiter = curr_thread;
+		thread_block(WAIT_TASK);
 	}
-
+	if (result != NULL) {
+		*result = t->result;
+	}
+	task_free(t);
 	unlock();
-	__builtin_unreachable();
+	return 0;
 }
 
-pthread_t pthread_self(void)
+void task_group_init(task_group_t *group)
 {
-	return curr_thread->id;
+	group->pending = 0;
+	group->waiter = NULL;
 }
 
-/* Start Project 3 – Thread Synchronization */
-/* mutex functions */
-struct mutex_node {
-	struct thread_control_block* mthread;
-	struct mutex_node* next;
-};
-
-struct thread_mutex {
-	// status of the mutex lock
-	bool locked;
-	// list of threads (TCBs) waiting for the mutex
-	struct mutex_node* wthreads;
-};
+int task_group_spawn(task_group_t *group, void *(*fn)(void *), void *arg)
+{
+	scheduler_start();
 
-/* pthread_mutex_init() initializes a given mutex_t */
-int pthread_mutex_init(pthread_mutex_t *restrict mutex, const pthread_mutexattr_t *restrict attr) 
-{	
 	lock();
-	struct thread_mutex* _mutex = (struct thread_mutex*)malloc(sizeof(struct thread_mutex));
-	_mutex->locked = false;
-	_mutex->wthreads = (struct mutex_node*)malloc(sizeof(struct mutex_node));
-	_mutex->wthreads = NULL;
-
-	// copy address of my_mutex to the given pthread_mutex_t mutex memory 
-	memcpy(&mutex->__align, &_mutex, sizeof(_mutex));
-
+	int err = task_start(NULL, group, fn, arg);
 	unlock();
-	return 0;
+	return err;
 }
 
-/* destroy the referenced mutex */
-int pthread_mutex_destroy(pthread_mutex_t *mutex) 
-{	
+int task_group_wait(task_group_t *group)
+{
+	scheduler_start();
+
 	lock();
-	struct thread_mutex* m;
-	unsigned long p;
-	if (memcpy(&p, &mutex->__align, sizeof(m)) == NULL) {
-		return -1;
+	if (group->waiter != NULL) {
+		unlock();
+		return EINVAL;
+	}
+	if (group->pending > 0) {
+		group->waiter = curr_thread;
+		thread_block(WAIT_TASK);
 	}
-	m = (struct thread_mutex*)p;
-	free(m);
 	unlock();
 	return 0;
 }
 
-int pthread_mutex_lock(pthread_mutex_t *mutex) 
-{	
-	lock();
-	struct thread_mutex* m;
-	unsigned long p;
-	if (memcpy(&p, &mutex->__align, sizeof(m)) == NULL) {
-		return -1;
+/* channels */
+
+/* Channels hand values between threads. A thread that cannot go on parks on
+ * the send or receive queue of the channel in a waiter on its own stack; the
+ * thread on the other side copies the value straight to or from the waiter's
+ * element and wakes it. A thread in chan_select() has a waiter on every
+ * channel it selects on, the first one taken off a queue takes the others
+ * off theirs. Everything is under sched_lock.
+ */
+struct chan_waiter;
+
+struct chan_queue {
+	struct chan_waiter* head;
+	struct chan_waiter* tail;
+};
+
+struct chan_select {
+	struct chan_waiter* waiters; // one per case
+	int n;
+	int fired; // the case that completed
+};
+
+struct chan_waiter {
+	struct thread_control_block* thread;
+	void* elem; // the value to send or where to receive it
+	int err; // EPIPE if the channel was closed
+	struct chan_queue* queue;
+	struct chan_waiter* next;
+	struct chan_waiter* prev;
+	struct chan_select* select; // NULL outside chan_select()
+	int index; // of the case in the select
+};
+
+struct thread_chan {
+	size_t elem_size;
+	unsigned cap; // 0 for an unbuffered channel
+	unsigned count;
+	unsigned head; // the oldest buffered value
+	bool closed;
+	struct chan_queue sendq;
+	struct chan_queue recvq;
+	char* buf;
+};
+
+/* put a waiter at the tail of a queue (lock() held) */
+static void chan_enqueue(struct chan_queue* q, struct chan_waiter* w)
+{
+	w->queue = q;
+	w->next = NULL;
+	w->prev = q->tail;
+	if (q->tail != NULL) {
+		q->tail->next = w;
+	}
+	else {
+		q->head = w;
 	}
-	m = (struct thread_mutex*)p;
+	q->tail = w;
+}
 
-	if (m->locked == false) {
-		// curr_thread aquires the lock and proceeds
-		m->locked = true;
+/* take a waiter off its queue (lock() held) */
+static void chan_unlink(struct chan_waiter* w)
+{
+	struct chan_queue* q = w->queue;
+	if (w->prev != NULL) {
+		w->prev->next = w->next;
 	}
 	else {
-		// the thread blocks until the mutex is available
-		curr_thread->status = TS_BLOCKED;
-		// add thread to list of waiting threads
-		struct mutex_node* new = (struct mutex_node*)malloc(sizeof(struct mutex_node)); 
-		new->mthread = curr_thread;
-		new->next = NULL;
-
-		if (m->wthreads == NULL) {
-			m->wthreads = new;
-		}
-		else{
-			struct mutex_node* temp = m->wthreads;
-			while(m->wthreads->next){
-				m->wthreads = m->wthreads->next;
-			}
-			m->wthreads->next = new;
-			m->wthreads = temp;
-		}
-		schedule(0);
+		q->head = w->next;
 	}
-	
-	if (!m->locked) {
-		perror("ERROR");
-		return -1;
+	if (w->next != NULL) {
+		w->next->prev = w->prev;
+	}
+	else {
+		q->tail = w->prev;
 	}
-
-	unlock();
-	return 0;
 }
 
-int pthread_mutex_unlock(pthread_mutex_t *mutex) 
-{	
-	lock();
-	struct thread_mutex* m;
-	unsigned long p;
-	if (memcpy(&p, &mutex->__align, sizeof(m)) == NULL) {
-		return -1;
+/* take the first waiter off q, and the other waiters of its select off their
+queues; NULL if nobody waits (lock() held) */
+static struct chan_waiter* chan_dequeue(struct chan_queue* q)
+{
+	struct chan_waiter* w = q->head;
+	if (w == NULL) {
+		return NULL;
 	}
-	m = (struct thread_mutex*)p;
-
-	if (m->wthreads != NULL) {
-		m->wthreads->mthread->status = TS_READY;
-		m->wthreads = m->wthreads->next;
+	if (w->select != NULL) {
+		for (int i = 0; i < w->select->n; i++) {
+			chan_unlink(&w->select->waiters[i]);
+		}
+		w->select->fired = w->index;
 	}
 	else {
-		m->wthreads = NULL;
-		m->locked = false;
+		chan_unlink(w);
 	}
-	
-	unlock();
-	return 0;
+	return w;
 }
 
+/* wake a waiter taken off a queue (lock() held) */
+static void chan_wake(struct chan_waiter* w, int err)
+{
+	w->err = err;
+	thread_wake(w->thread);
+}
 
-/* barrier functions */
-struct barrier_node {
-	struct thread_control_block* bthread;
-	struct barrier_node* next;
-};
+/* send elem without waiting if a receiver waits or there is room, EPIPE on a
+closed channel, EAGAIN otherwise (lock() held) */
+static int chan_try_send(struct thread_chan* c, const void* elem)
+{
+	if (c->closed) {
+		return EPIPE;
+	}
+	struct chan_waiter* r = chan_dequeue(&c->recvq);
+	if (r != NULL) {
+		// only a channel with an empty buffer has receivers waiting
+		memcpy(r->elem, elem, c->elem_size);
+		chan_wake(r, 0);
+		return 0;
+	}
+	if (c->count < c->cap) {
+		memcpy(c->buf + (size_t)((c->head + c->count) % c->cap) * c->elem_size, elem, c->elem_size);
+		c->count++;
+		return 0;
+	}
+	return EAGAIN;
+}
 
-struct thread_barrier {
-	// number of threads needed
-	int threads_required;
-	// count the number of threads in the barrier
-	int threads_in;
-	// list of threads in the barrier
-	struct barrier_node* bthreads;
-};
+/* receive into elem without waiting if a value is buffered or a sender waits,
+a zero value and EPIPE from a closed and drained channel, EAGAIN otherwise
+(lock() held) */
+static int chan_try_recv(struct thread_chan* c, void* elem)
+{
+	if (c->count > 0) {
+		char* slot = c->buf + (size_t)c->head * c->elem_size;
+		memcpy(elem, slot, c->elem_size);
+		c->head = (c->head + 1) % c->cap;
+		c->count--;
+		// a sender waiting for room moves its value to the back of the buffer
+		struct chan_waiter* s = chan_dequeue(&c->sendq);
+		if (s != NULL) {
+			memcpy(c->buf + (size_t)((c->head + c->count) % c->cap) * c->elem_size, s->elem, c->elem_size);
+			c->count++;
+			chan_wake(s, 0);
+		}
+		return 0;
+	}
+	struct chan_waiter* s = chan_dequeue(&c->sendq);
+	if (s != NULL) {
+		memcpy(elem, s->elem, c->elem_size);
+		chan_wake(s, 0);
+		return 0;
+	}
+	if (c->closed) {
+		memset(elem, 0, c->elem_size);
+		return EPIPE;
+	}
+	return EAGAIN;
+}
 
-/* pthread_barrier_init() initializes a given barrier_t */
-int pthread_barrier_init(pthread_barrier_t *restrict barrier, const pthread_barrierattr_t *restrict attr, unsigned count)
-{	
-	lock();
-	if (count == 0) {
+int chan_create(chan_t *chan, size_t elem_size, unsigned capacity)
+{
+	if (elem_size == 0) {
 		return EINVAL;
 	}
+	struct thread_chan* c = malloc(sizeof(struct thread_chan) + (size_t)capacity * elem_size);
+	if (c == NULL) {
+		return ENOMEM;
+	}
+	c->elem_size = elem_size;
+	c->cap = capacity;
+	c->count = 0;
+	c->head = 0;
+	c->closed = false;
+	c->sendq.head = c->sendq.tail = NULL;
+	c->recvq.head = c->recvq.tail = NULL;
+	c->buf = (char*)(c + 1);
+	*chan = c;
+	return 0;
+}
 
-	struct thread_barrier* _barrier = (struct thread_barrier*)malloc(sizeof(struct thread_barrier)); 
-	_barrier->threads_required = count;
-	_barrier->threads_in = 0;
-	_barrier->bthreads = (struct barrier_node*)malloc(sizeof(struct barrier_node)); 
-	_barrier->bthreads = NULL;
+int chan_destroy(chan_t chan)
+{
+	scheduler_start();
 
-	memcpy(&barrier->__align, &_barrier, sizeof(_barrier));
+	lock();
+	if (chan->sendq.head != NULL || chan->recvq.head != NULL) {
+		unlock();
+		return EBUSY;
+	}
 	unlock();
+	free(chan);
 	return 0;
 }
 
-/* destory the referenced barrier */
-int pthread_barrier_destroy(pthread_barrier_t *barrier) 
-{	
+int chan_close(chan_t chan)
+{
+	scheduler_start();
+
 	lock();
-	struct thread_barrier* b;
-	unsigned long p;
-	if (memcpy(&p, &barrier->__align, sizeof(b)) == NULL) {
-		return -1;
+	if (chan->closed) {
+		unlock();
+		return EPIPE;
+	}
+	// receivers waiting get a zero value, senders waiting fail
+	chan->closed = true;
+	struct chan_waiter* w;
+	while ((w = chan_dequeue(&chan->recvq)) != NULL) {
+		memset(w->elem, 0, chan->elem_size);
+		chan_wake(w, EPIPE);
+	}
+	while ((w = chan_dequeue(&chan->sendq)) != NULL) {
+		chan_wake(w, EPIPE);
 	}
-	b = (struct thread_barrier*)p;
-	struct barrier_node* tmp;
-	//if (b->bthreads != NULL) {
-		while (b->bthreads != NULL) {
-			tmp = b->bthreads;
-			b->bthreads = b->bthreads->next;
-			free(tmp);
-		}
-	//}
-	//b->bthreads = NULL;
-	b->threads_in = 0;
-	b->threads_required = 0;
-	free(b);
 	unlock();
 	return 0;
 }
 
-/* wait for all threads to reach the barrier then proceed */
-int pthread_barrier_wait(pthread_barrier_t *barrier)
+int chan_send(chan_t chan, const void *elem)
 {
-	/*
-	* The pthread_barrier_wait() function enters the referenced barrier. 
-	* The calling thread shall not proceed until the required number of threads 
-	* (from count in pthread_barrier_init) have already entered the barrier. 
-	* Other threads shall be allowed to proceed while this thread is in a barrier 
-	* (unless they are also blocked for other reasons). 
-	* Upon exiting a barrier, the order that the threads are awoken is undefined. 
-	* Exactly one of the returned threads shall return PTHREAD_BARRIER_SERIAL_THREAD 
-	* (it does not matter which one). 
-	* The rest of the threads shall return 0.
-	*/
+	scheduler_start();
+
 	lock();
-	struct thread_barrier* b;
-	unsigned long p;
-	if (memcpy(&p, &barrier->__align, sizeof(b)) == NULL) {
-		return -1;
+	int err = chan_try_send(chan, elem);
+	if (err == EAGAIN) {
+		struct chan_waiter w;
+		w.thread = curr_thread;
+		w.elem = (void*)elem;
+		w.select = NULL;
+		chan_enqueue(&chan->sendq, &w);
+		thread_block(WAIT_CHAN);
+		err = w.err;
 	}
-	b = (struct thread_barrier*)p;
+	unlock();
+	return err;
+}
 
-	b->threads_in += 1;
-	if (b->threads_in > b->threads_required) {
-      	return EINVAL;
-    }
+int chan_recv(chan_t chan, void *elem)
+{
+	scheduler_start();
 
-	if (b->threads_in < b->threads_required) {
-		curr_thread->status = TS_BLOCKED;
-		// add thread to list of waiting threads
-		struct barrier_node* new = (struct barrier_node*)malloc(sizeof(struct barrier_node)); 
-		new->bthread = curr_thread;
-		new->next = NULL;
-		
-		if (b->bthreads == NULL) {
-			b->bthreads = new;
-		}
-		else{
-			struct barrier_node* temp = b->bthreads;
-			while(b->bthreads->next){
-				b->bthreads = b->bthreads->next;
-			}
-			b->bthreads->next = new;
-			b->bthreads = temp;
-		}
-		schedule(0);
-		return 0;
+	lock();
+	int err = chan_try_recv(chan, elem);
+	if (err == EAGAIN) {
+		struct chan_waiter w;
+		w.thread = curr_thread;
+		w.elem = elem;
+		w.select = NULL;
+		chan_enqueue(&chan->recvq, &w);
+		thread_block(WAIT_CHAN);
+		err = w.err;
 	}
-	else {	// release the threads in the barrier
-		struct barrier_node* temp;
-		while (b->bthreads != NULL) {
-			b->bthreads->bthread->status = TS_READY;
-			b->bthreads = b->bthreads->next;
-			//printf("thread = %lx freed \n", b->bthreads->bthread->id);
-			//temp = b->bthreads;
-			//free(temp);
+	unlock();
+	return err;
+}
+
+int chan_select(struct chan_case *cases, int n, int block)
+{
+	if (n < 0 || n > CHAN_SELECT_MAX) {
+		return -1;
+	}
+	scheduler_start();
+
+	lock();
+	// try the cases from a rotating start, so that no ready case starves
+	static unsigned rotor;
+	unsigned start = n > 0 ? rotor++ % n : 0;
+	for (int k = 0; k < n; k++) {
+		int i = (start + k) % n;
+		struct chan_case* cc = &cases[i];
+		int err = cc->op == CHAN_SEND ? chan_try_send(cc->chan, cc->elem) : chan_try_recv(cc->chan, cc->elem);
+		if (err != EAGAIN) {
+			cc->err = err;
+			unlock();
+			return i;
 		}
-		b->threads_in = 0;
+	}
+	if (!block || n == 0) {
+		unlock();
+		return -1;
 	}
 
+	// park on every channel until one of them takes us off
+	struct chan_waiter waiters[CHAN_SELECT_MAX];
+	struct chan_select sel;
+	sel.waiters = waiters;
+	sel.n = n;
+	for (int i = 0; i < n; i++) {
+		struct chan_waiter* w = &waiters[i];
+		w->thread = curr_thread;
+		w->elem = cases[i].elem;
+		w->select = &sel;
+		w->index = i;
+		chan_enqueue(cases[i].op == CHAN_SEND ? &cases[i].chan->sendq : &cases[i].chan->recvq, w);
+	}
+	thread_block(WAIT_CHAN);
+	cases[sel.fired].err = waiters[sel.fired].err;
 	unlock();
-	return PTHREAD_BARRIER_SERIAL_THREAD;
+	return sel.fired;
 }
 
 /* Don't implement main in this file!
@@ -0,0 +1,170 @@
+#ifndef __THREADS_EXT__
+#define __THREADS_EXT__
+/*
+ * Extensions of this thread library beyond the pthread interface.
+ * Programs using them include this header and link threads.o as usual.
+ */
+#include <pthread.h>
+
+/* The functions here that take a pthread_t, like pthread_join, must be given
+ * the id of a thread that is running or can still be joined; any other id is
+ * undefined behavior, as it is with glibc.
+ */
+
+/* Set the time slice of a thread in microseconds, 0 for the default quantum
+ * (50 ms or THREAD_QUANTUM_USECS). A thread is preempted when its slice is
+ * over, and a ready thread waits for the running one at most its own slice,
+ * so a short slice gives an interactive thread a short wakeup latency.
+ * A thread with nothing else ready on its worker is never interrupted.
+ */
+int pthread_settimeslice_np(pthread_t thread, unsigned usecs);
+
+/* Set the nice value of a thread, -20 (highest share) to 19 (lowest).
+ * Threads inherit it from the thread that creates them. It only has an
+ * effect under the fair policy (THREAD_SCHED=fair), which runs the ready
+ * thread with the least run time scaled by its weight; each nice step is
+ * about 10% of processor time. The default policy is round-robin.
+ * Returns EINVAL for a nice value out of range.
+ */
+int pthread_setnice_np(pthread_t thread, int nice);
+
+/* Like pthread_barrier_wait, but gives up at abstime (CLOCK_REALTIME, as for
+ * pthread_mutex_timedlock) and returns ETIMEDOUT. The thread then no longer
+ * counts towards the barrier. Returns EINVAL for an invalid abstime, and
+ * ENOTSUP for a tree barrier, which cannot be left.
+ */
+int pthread_barrier_timedwait_np(pthread_barrier_t *barrier, const struct timespec *abstime);
+
+/* Kinds of barrier, set in a pthread_barrierattr_t. A central barrier (the
+ * default) counts arrivals under the scheduler lock and the last one wakes
+ * all the others. A tree barrier combines arrivals up a tree of small nodes
+ * and wakes the waiters down it from many threads, so its cost grows with
+ * the logarithm of the thread count; pthread_barrier_init allocates the
+ * tree and returns ENOMEM if it cannot.
+ */
+#define PTHREAD_BARRIER_CENTRAL_NP 0
+#define PTHREAD_BARRIER_TREE_NP 1
+
+int pthread_barrierattr_setkind_np(pthread_barrierattr_t *attr, int kind);
+int pthread_barrierattr_getkind_np(const pthread_barrierattr_t *attr, int *kind);
+
+/* How often a mutex was taken on each path since it was initialized, and
+ * its average hold time. With more than one worker a thread finding the
+ * mutex locked by a running thread spins for about that long before it
+ * parks; with one worker it parks right away and hold times are not measured.
+ */
+struct mutex_stats_np {
+	unsigned long fast; // taken without waiting
+	unsigned long spun; // taken after spinning
+	unsigned long parked; // handed over after parking
+	unsigned long long hold_ns;
+};
+
+int pthread_mutex_getstats_np(pthread_mutex_t *mutex, struct mutex_stats_np *stats);
+
+/* Scheduler tracing. While it is on, each worker records thread switches,
+ * blocking (and on what), wakeups, creation and exit with TSC timestamps in
+ * a ring of its own, and per-thread time is accounted. Off it costs a flag
+ * test per event. THREAD_TRACE=file in the environment traces the whole run
+ * and writes the trace to file at exit. Returns ENOMEM if the rings cannot
+ * be allocated.
+ */
+int pthread_trace_np(int enable);
+
+/* Write the events in the rings as a Chrome/Perfetto JSON trace (one track
+ * per worker), returns 0 or an errno value. Events recorded during the dump
+ * may be garbled; turn tracing off first for an exact trace.
+ */
+int pthread_trace_dump_np(const char *path);
+
+/* time a thread spent in each state while tracing was on */
+struct thread_stats_np {
+	unsigned long long run_ns;
+	unsigned long long ready_ns; // runnable, waiting for a worker
+	unsigned long long blocked_ns; // on a mutex, barrier, join, I/O or sleep
+	unsigned long switches; // times it was switched to
+};
+
+int pthread_getstats_np(pthread_t thread, struct thread_stats_np *stats);
+
+/* Tasks: functions run by a pool of runner threads, as many running as there
+ * are workers. A task runs on the stack of its runner and only ties it up
+ * when it blocks, a spare runner then takes over the other tasks. Spawning
+ * a task costs far less than creating a thread. When tasks are spawned
+ * faster than they run, the spawner runs them itself past a queue limit.
+ * Spawn functions return EAGAIN when out of memory.
+ */
+typedef struct thread_task *task_t;
+
+/* Queue fn(arg) as a task. Every task spawned this way is awaited once. */
+int task_spawn(task_t *task, void *(*fn)(void *), void *arg);
+
+/* Wait for a task to finish and store what its function returned in
+ * *result unless it is NULL. A task no runner has started yet runs in the
+ * caller. Returns EINVAL for a task already awaited, as long as no task has
+ * been spawned since: a later spawn may reuse the same task_t.
+ */
+int task_await(task_t task, void **result);
+
+/* A scope for tasks that are not awaited one by one: task_group_wait()
+ * returns once all tasks spawned in the group have finished, and must be
+ * called before the group goes out of scope.
+ */
+typedef struct {
+	int pending; // tasks spawned but not finished
+	struct thread_control_block *waiter;
+} task_group_t;
+
+#define TASK_GROUP_INITIALIZER {0, NULL}
+
+void task_group_init(task_group_t *group);
+int task_group_spawn(task_group_t *group, void *(*fn)(void *), void *arg);
+
+/* Returns EINVAL if another thread already waits for the group. */
+int task_group_wait(task_group_t *group);
+
+/* Channels pass values of a fixed size between threads, in order. A send
+ * waits until a receiver takes the value or, on a buffered channel, until
+ * there is room in the buffer; a receive waits for a value. A waiting
+ * receiver gets the value straight from the sender.
+ */
+typedef struct thread_chan *chan_t;
+
+/* Create a channel of elements of elem_size bytes that buffers up to
+ * capacity of them, 0 for an unbuffered channel where every send waits for
+ * its receiver. Returns EINVAL for elem_size 0, ENOMEM when out of memory.
+ */
+int chan_create(chan_t *chan, size_t elem_size, unsigned capacity);
+
+/* Returns EBUSY while threads wait on the channel. */
+int chan_destroy(chan_t chan);
+
+/* Close a channel: sends fail with EPIPE, receives drain the buffer and then
+ * return EPIPE with a zeroed element. Returns EPIPE if already closed.
+ */
+int chan_close(chan_t chan);
+
+/* Returns 0, or EPIPE when the channel is or gets closed. */
+int chan_send(chan_t chan, const void *elem);
+int chan_recv(chan_t chan, void *elem);
+
+#define CHAN_SEND 0
+#define CHAN_RECV 1
+#define CHAN_SELECT_MAX 64
+
+/* one operation of a chan_select() */
+struct chan_case {
+	chan_t chan;
+	int op; // CHAN_SEND or CHAN_RECV
+	void *elem; // the value to send or where to receive one
+	int err; // set for the case that completes: 0 or EPIPE
+};
+
+/* Complete one of n cases, waiting for one to become possible unless block
+ * is 0. When several are possible, one is picked in turn. Returns the index
+ * of the case that completed, or -1 when block is 0 and none could, or when
+ * n is above CHAN_SELECT_MAX.
+ */
+int chan_select(struct chan_case *cases, int n, int block);
+
+#endif